@@ -0,0 +1,49 @@
+
+TARGET = imgp-batch
+
+SOURCES +=  imgp/BatchMain.cpp \
+            imgp/BatchProcessor.cpp \
+            imgp/StreamingPipeline.cpp \
+            imgp/StripIO.cpp \
+            imgp/ImagePipeline.cpp \
+            imgp/Convolution.cpp \
+            imgp/FftConvolution.cpp \
+            imgp/FourierTransform.cpp \
+            imgp/KernelRegistry.cpp \
+            imgp/Simd.cpp \
+            imgp/LookupTable.cpp \
+            imgp/ResultCache.cpp \
+            imgp/RankFilter.cpp \
+            imgp/SummedAreaTable.cpp \
+            imgp/RecursiveGaussian.cpp \
+            imgp/ThresholdMap.cpp \
+            imgp/PreciseImage.cpp \
+            imgp/Profiler.cpp \
+            imgp/RawImage.cpp \
+            imgp/ThreadPool.cpp
+
+HEADERS +=  imgp/BatchProcessor.h \
+            imgp/StreamingPipeline.h \
+            imgp/StripIO.h \
+            imgp/ImagePipeline.h \
+            imgp/Convolution.h \
+            imgp/FftConvolution.h \
+            imgp/FourierTransform.h \
+            imgp/KernelRegistry.h \
+            imgp/Simd.h \
+            imgp/LookupTable.h \
+            imgp/ResultCache.h \
+            imgp/RankFilter.h \
+            imgp/SummedAreaTable.h \
+            imgp/RecursiveGaussian.h \
+            imgp/ThresholdMap.h \
+            imgp/PreciseImage.h \
+            imgp/Profiler.h \
+            imgp/RawImage.h \
+            imgp/FilterKernels.h \
+            imgp/ThreadPool.h \
+            imgp/Utils.h
+
+CONFIG += qt console
+CONFIG -= app_bundle
+QT = core gui
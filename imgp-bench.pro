@@ -0,0 +1,39 @@
+
+TARGET = imgp-bench
+
+SOURCES +=  imgp/BenchMain.cpp \
+            imgp/ImagePipeline.cpp \
+            imgp/Convolution.cpp \
+            imgp/FftConvolution.cpp \
+            imgp/FourierTransform.cpp \
+            imgp/Simd.cpp \
+            imgp/LookupTable.cpp \
+            imgp/ResultCache.cpp \
+            imgp/RankFilter.cpp \
+            imgp/SummedAreaTable.cpp \
+            imgp/RecursiveGaussian.cpp \
+            imgp/ThresholdMap.cpp \
+            imgp/PreciseImage.cpp \
+            imgp/Profiler.cpp \
+            imgp/ThreadPool.cpp
+
+HEADERS +=  imgp/ImagePipeline.h \
+            imgp/Convolution.h \
+            imgp/FftConvolution.h \
+            imgp/FourierTransform.h \
+            imgp/Simd.h \
+            imgp/LookupTable.h \
+            imgp/ResultCache.h \
+            imgp/RankFilter.h \
+            imgp/SummedAreaTable.h \
+            imgp/RecursiveGaussian.h \
+            imgp/ThresholdMap.h \
+            imgp/PreciseImage.h \
+            imgp/Profiler.h \
+            imgp/FilterKernels.h \
+            imgp/ThreadPool.h \
+            imgp/Utils.h
+
+CONFIG += qt console release
+CONFIG -= app_bundle
+QT = core gui
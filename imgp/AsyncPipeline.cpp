@@ -0,0 +1,206 @@
+/*
+	Asynchronous image processing pipeline
+*/
+
+#include "AsyncPipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+AsyncPipeline::AsyncPipeline(QObject* parent) :
+	QObject(parent),
+	m_sourceId(0),
+	m_jobId(0),
+	m_hasJob(false),
+	m_quit(false),
+	m_cancelled(false),
+	m_peakMemory(0),
+	m_profiler(nullptr)
+{
+	qRegisterMetaType<QImage>();
+	connect(this, &AsyncPipeline::jobFinished, this, &AsyncPipeline::finishJob, Qt::QueuedConnection);
+
+	m_worker = std::thread(&AsyncPipeline::workerLoop, this);
+}
+
+AsyncPipeline::~AsyncPipeline()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_quit = true;
+		m_cancelled = true;
+	}
+
+	m_wake.notify_all();
+	m_worker.join();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AsyncPipeline::load(const QImage& img)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_source = img;
+		m_sourceId++;
+		m_job = nullptr;
+		m_hasJob = false;
+		m_cancelled = true;
+	}
+
+	//The unprocessed image needs no work, show it straight away
+	m_image = img;
+	m_sourceSize = img.size();
+	imageUpdated(m_image);
+}
+
+void AsyncPipeline::submit(const Job& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_job = job;
+		m_jobId++;
+		m_hasJob = true;
+		m_cancelled = true;
+	}
+
+	m_wake.notify_all();
+}
+
+void AsyncPipeline::setPreviewSize(const QSize& size)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_previewSize = size;
+}
+
+void AsyncPipeline::resetImage()
+{
+	submit(nullptr);
+}
+
+void AsyncPipeline::finishJob(const QImage& img, bool preview, quint64 sourceId, quint64 jobId)
+{
+	//Results queued before an image was loaded or a job submitted would replace newer ones
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		if (sourceId != m_sourceId || jobId != m_jobId)
+			return;
+	}
+
+	if (preview)
+	{
+		previewUpdated(img, m_sourceSize);
+	}
+	else
+	{
+		m_image = img;
+		imageUpdated(m_image);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AsyncPipeline::workerLoop()
+{
+	//The worker's own pipelines, only the final result of a job is reported
+	ImagePipeline pipeline;
+	ImagePipeline proxy;
+
+	for (ImagePipeline* p : { &pipeline, &proxy })
+	{
+		p->blockSignals(true);
+		p->setCancellation(&m_cancelled);
+	}
+
+	quint64 loadedId = 0;
+	quint64 proxyId = 0;
+	QSize proxySize;
+
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	for (;;)
+	{
+		m_wake.wait(lock, [this]() { return m_quit || m_hasJob; });
+
+		if (m_quit)
+			return;
+
+		//Nothing loaded yet
+		if (m_sourceId == 0)
+		{
+			m_hasJob = false;
+			continue;
+		}
+
+		Job job = std::move(m_job);
+		const quint64 sourceId = m_sourceId;
+		const quint64 jobId = m_jobId;
+		m_job = nullptr;
+		m_hasJob = false;
+		m_cancelled = false;
+
+		QImage source;
+		const bool reload = (loadedId != m_sourceId);
+
+		if (reload)
+		{
+			source = m_source;
+			loadedId = m_sourceId;
+		}
+
+		//A proxy only pays off when it is much smaller than the image, and restoring the image needs no preview
+		const QSize fullSize = m_source.size();
+		const QSize previewSize = m_previewSize.isEmpty() ? fullSize : fullSize.scaled(m_previewSize, Qt::KeepAspectRatio);
+		const bool usePreview = job && (previewSize.width() * 2 <= fullSize.width());
+		const bool rescale = usePreview && (proxyId != loadedId || previewSize != proxySize);
+
+		if (rescale)
+			source = m_source;
+
+		lock.unlock();
+
+		for (ImagePipeline* p : { &pipeline, &proxy })
+			p->setProfiler(m_profiler);
+
+		if (reload)
+			pipeline.load(source);
+
+		if (rescale)
+		{
+			proxy.load(source.scaled(previewSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+			proxyId = loadedId;
+			proxySize = previewSize;
+		}
+
+		//The full resolution pass is skipped if the job was superseded during the preview
+		if (!usePreview || runJob(proxy, job, true, sourceId, jobId))
+			runJob(pipeline, job, false, sourceId, jobId);
+
+		//Both pipelines hold their buffers at the same time
+		m_peakMemory = pipeline.peakMemory() + proxy.peakMemory();
+
+		lock.lock();
+	}
+}
+
+bool AsyncPipeline::runJob(ImagePipeline& pipeline, const Job& job, bool preview, quint64 sourceId, quint64 jobId)
+{
+	//Jobs are recorded and run as one fused chain
+	pipeline.reset().defer();
+
+	if (job)
+		job(pipeline);
+
+	pipeline.execute();
+
+	//A newer job or image has arrived in the meantime, the result is stale or incomplete
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	if (m_cancelled)
+		return false;
+
+	jobFinished(pipeline.image(), preview, sourceId, jobId);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,104 @@
+/*
+	Asynchronous image processing pipeline
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "ImagePipeline.h"
+
+/*
+	Runs chains of ImagePipeline operations on a worker thread.
+
+	Only the newest submitted job is kept: submitting a job replaces one which has not started yet,
+	and cancels a running one, which stops at its next row band. Finished jobs are reported through
+	imageUpdated on the thread which owns this object.
+
+	With a preview size set, a job first runs on a proxy of the image downscaled to that size, which is
+	reported through previewUpdated, and is then refined at full resolution unless it is superseded.
+*/
+class AsyncPipeline : public QObject
+{
+	Q_OBJECT
+
+public:
+
+	//A chain of operations, run on the loaded image
+	using Job = std::function<void(ImagePipeline&)>;
+
+	explicit AsyncPipeline(QObject* parent = nullptr);
+	~AsyncPipeline();
+
+	//Load the given image, cancelling any job
+	void load(const QImage& img);
+
+	//Return the full resolution result of the last finished job
+	const QImage& image() const { return m_image; }
+
+	//Size of the loaded image
+	QSize sourceSize() const { return m_sourceSize; }
+
+	//Size of the preview proxy, an empty size (the default) disables previews
+	void setPreviewSize(const QSize& size);
+
+	//Run a job on the loaded image, replacing the pending job and cancelling the running one
+	void submit(const Job& job);
+
+	//Peak memory of the worker's pipelines, see ImagePipeline::peakMemory
+	qint64 peakMemory() const { return m_peakMemory; }
+
+	//Profiler of the worker's pipelines from the next job on, see ImagePipeline::setProfiler
+	void setProfiler(Profiler* profiler) { m_profiler = profiler; }
+
+public slots:
+
+	void resetImage();
+
+signals:
+
+	void imageUpdated(const QImage& img);
+
+	//A preview result, to be shown stretched to the size of the full resolution image
+	void previewUpdated(const QImage& img, const QSize& imageSize);
+
+	//Internal, carries results from the worker thread with the image and job they were made for
+	void jobFinished(const QImage& img, bool preview, quint64 sourceId, quint64 jobId);
+
+private slots:
+
+	void finishJob(const QImage& img, bool preview, quint64 sourceId, quint64 jobId);
+
+private:
+
+	void workerLoop();
+
+	//Run the job on the pipeline and report it as made for the given image and job, returns false if it was cancelled
+	bool runJob(ImagePipeline& pipeline, const Job& job, bool preview, quint64 sourceId, quint64 jobId);
+
+	QImage m_image;
+	QSize m_sourceSize;
+
+	//Shared with the worker thread, guarded by m_lock
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	QImage m_source;
+	quint64 m_sourceId;
+	quint64 m_jobId;
+	QSize m_previewSize;
+	Job m_job;
+	bool m_hasJob;
+	bool m_quit;
+
+	//Set when the running job is superseded, polled by the pipeline between row bands
+	std::atomic<bool> m_cancelled;
+
+	std::atomic<qint64> m_peakMemory;
+	std::atomic<Profiler*> m_profiler;
+
+	std::thread m_worker;
+};
@@ -0,0 +1,355 @@
+/*
+	Entry point of the headless batch processor
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImageReader>
+
+#include "BatchProcessor.h"
+#include "KernelRegistry.h"
+#include "RawImage.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const std::map<QString, KernelView>& filterKernels()
+{
+	static const std::map<QString, KernelView> filters = {
+		{ "box",       kernels::box },
+		{ "gaussian3", kernels::gaussian3 },
+		{ "gaussian5", kernels::gaussian5 },
+		{ "sobelh",    kernels::edgesH },
+		{ "sobelv",    kernels::edgesV },
+		{ "edges2",    kernels::edges2 },
+		{ "edges3",    kernels::edges3 },
+		{ "sharpen",   kernels::sharpen },
+		{ "emboss",    kernels::emboss },
+	};
+
+	return filters;
+}
+
+static const std::map<QString, Dithering>& ditheringModes()
+{
+	static const std::map<QString, Dithering> modes = {
+		{ "error",    Dithering::ERROR_DIFFUSION },
+		{ "floyd",    Dithering::FLOYD_STEINBERG },
+		{ "ordered",  Dithering::ORDERED },
+		{ "pattern",  Dithering::PATTERN },
+	};
+
+	return modes;
+}
+
+/*
+	Parse a pipeline spec, a comma separated list of steps run in order:
+	grayscale, gamma=<value>, filter=<kernel>, median[=<radius>], min=<radius>, max=<radius>, threshold, dither=<mode>[<size>],
+	blur=<radius>, deviation=<radius>, adaptive=<radius>[/<offset>], gaussian=<sigma>
+
+	Ordered and pattern dithering take the size of their Bayer matrix after the mode, ordered8 for example.
+	Filters are the built-in kernels or the ones of the registry.
+	halo is set to the rows of context the steps read around each output row, or -1 if they read the whole image.
+*/
+static bool parsePipeline(const QString& spec, const KernelRegistry& registry, BatchProcessor::Job& job, int& halo, QString& error)
+{
+	std::vector<BatchProcessor::Job> steps;
+	halo = 0;
+
+	//Halos of chained steps add up
+	auto grow = [&halo](int rows) { halo = (halo < 0 || rows < 0) ? -1 : halo + rows; };
+
+	for (const QString& step : spec.split(',', QString::SkipEmptyParts))
+	{
+		const QString name = step.section('=', 0, 0).trimmed();
+		const QString value = step.section('=', 1).trimmed();
+
+		if (name == "grayscale")
+		{
+			steps.push_back([](ImagePipeline& p) { p.makeGrayscale(); });
+		}
+		else if (name == "gamma")
+		{
+			bool ok = false;
+			const float gamma = value.toFloat(&ok);
+
+			if (!ok || gamma <= 0.0f)
+			{
+				error = "invalid gamma: " + value;
+				return false;
+			}
+
+			steps.push_back([gamma](ImagePipeline& p) { p.setGamma(gamma); });
+		}
+		else if (name == "filter")
+		{
+			auto it = filterKernels().find(value);
+			const KernelView kernel = (it != filterKernels().end()) ? it->second : registry.find(value);
+
+			if (!kernel.v)
+			{
+				error = "unknown filter: " + value;
+				return false;
+			}
+
+			//Kernels wrapping around the image read its opposite borders
+			steps.push_back([kernel](ImagePipeline& p) { p.applyFilter(kernel); });
+			grow((kernel.border == Border::WRAP) ? -1 : (int)std::max(kernel.n, kernel.m) / 2);
+		}
+		else if (name == "median" || name == "min" || name == "max")
+		{
+			bool ok = value.isEmpty();
+			const int radius = ok ? 1 : value.toInt(&ok);
+
+			if (!ok || radius < 1 || radius > RankFilter::MaxRadius)
+			{
+				error = "invalid radius: " + value;
+				return false;
+			}
+
+			const RankFilter filter = name == "min" ? RankFilter::minimum(radius) : name == "max" ? RankFilter::maximum(radius) : RankFilter::median(radius);
+			steps.push_back([filter](ImagePipeline& p) { p.applyRankFilter(filter); });
+			grow(radius);
+		}
+		else if (name == "threshold")
+		{
+			steps.push_back([](ImagePipeline& p) { p.applyThresholding(); });
+		}
+		else if (name == "blur" || name == "deviation" || name == "adaptive")
+		{
+			//Adaptive thresholding takes the offset from the window mean after the radius
+			bool ok = false;
+			const int radius = value.section('/', 0, 0).toInt(&ok);
+			const int maxRadius = (name == "deviation") ? SummedAreaTable::MaxSquaresRadius : SummedAreaTable::MaxRadius;
+
+			if (!ok || radius < 1 || radius > maxRadius)
+			{
+				error = "invalid radius: " + value;
+				return false;
+			}
+
+			const bool hasOffset = value.contains('/');
+			const int offset = hasOffset ? value.section('/', 1).toInt(&ok) : 8;
+
+			if (!ok || (hasOffset && name != "adaptive"))
+			{
+				error = "invalid offset: " + value;
+				return false;
+			}
+
+			if (name == "blur")
+				steps.push_back([radius](ImagePipeline& p) { p.applyBoxBlur(radius); });
+			else if (name == "deviation")
+				steps.push_back([radius](ImagePipeline& p) { p.applyLocalDeviation(radius); });
+			else
+				steps.push_back([radius, offset](ImagePipeline& p) { p.applyAdaptiveThresholding(radius, offset); });
+
+			grow(radius);
+		}
+		else if (name == "gaussian")
+		{
+			bool ok = false;
+			const float sigma = value.toFloat(&ok);
+
+			if (!ok || sigma < RecursiveGaussian::MinSigma || sigma > RecursiveGaussian::MaxSigma)
+			{
+				error = "invalid sigma: " + value;
+				return false;
+			}
+
+			steps.push_back([sigma](ImagePipeline& p) { p.applyGaussianBlur(sigma); });
+			grow(RecursiveGaussian(sigma).radius());
+		}
+		else if (name == "dither")
+		{
+			//Trailing digits are the size of the threshold map
+			int digits = 0;
+
+			while (digits < value.size() && value[value.size() - digits - 1].isDigit())
+				digits++;
+
+			auto it = ditheringModes().find(value.left(value.size() - digits));
+
+			if (it == ditheringModes().end())
+			{
+				error = "unknown dithering mode: " + value;
+				return false;
+			}
+
+			const Dithering mode = it->second;
+			const int size = digits ? value.right(digits).toInt() : 4;
+
+			if (digits && mode != Dithering::ORDERED && mode != Dithering::PATTERN)
+			{
+				error = "only ordered and pattern dithering take a size: " + value;
+				return false;
+			}
+
+			if (size != 2 && size != 4 && size != 8 && size != 16)
+			{
+				error = "threshold map size must be 2, 4, 8 or 16: " + value;
+				return false;
+			}
+
+			const ThresholdMap map = ThresholdMap::bayer(size);
+			steps.push_back([mode, map](ImagePipeline& p) { p.applyDithering(mode, map); });
+
+			//Error diffusion carries error across the whole image
+			grow((mode == Dithering::ERROR_DIFFUSION || mode == Dithering::FLOYD_STEINBERG) ? -1 : 0);
+		}
+		else
+		{
+			error = "unknown step: " + name;
+			return false;
+		}
+	}
+
+	job = [steps](ImagePipeline& p) {
+		for (const BatchProcessor::Job& step : steps)
+			step(p);
+	};
+
+	return true;
+}
+
+/*
+	Expand directories into the image files they contain. Results are named after the files given, and
+	after the paths of the files found relative to the directory they were found in, so files of
+	subdirectories keep their own results.
+*/
+static std::vector<BatchProcessor::Input> collectFiles(const QStringList& paths, bool recursive)
+{
+	QStringList filters;
+
+	for (const QByteArray& format : QImageReader::supportedImageFormats())
+		filters << "*." + QString::fromLatin1(format);
+
+	filters << QString("*.") + RawImage::Suffix;
+
+	std::vector<BatchProcessor::Input> files;
+
+	for (const QString& path : paths)
+	{
+		if (!QFileInfo(path).isDir())
+		{
+			files.push_back({ path, QFileInfo(path).completeBaseName() });
+			continue;
+		}
+
+		const QDir root(path);
+		QDirIterator it(path, filters, QDir::Files, recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+
+		while (it.hasNext())
+		{
+			const QString file = it.next();
+			const QFileInfo relative(root.relativeFilePath(file));
+
+			files.push_back({ file, QDir(relative.path()).filePath(relative.completeBaseName()) });
+		}
+	}
+
+	return files;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imgp-batch");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Process image files without a display.\n\n"
+		"Pipeline steps, run in order: grayscale, gamma=<value>, filter=<kernel>, median[=<radius>], min=<radius>, max=<radius>, threshold, dither=<mode>[<size>],\n"
+		"blur=<radius>, deviation=<radius>, adaptive=<radius>[/<offset>], gaussian=<sigma>\n"
+		"Rank filter radius: 1 to 50\n"
+		"Gaussian sigma: 0.5 to 200 pixels\n"
+		"Kernels: box, gaussian3, gaussian5, sobelh, sobelv, edges2, edges3, sharpen, emboss, and those loaded with --kernels\n"
+		"Dithering modes: error, floyd, ordered, pattern\n"
+		"Bayer matrix sizes of ordered and pattern dithering: 2, 4 (default), 8, 16\n"
+		"Raw images (.imgp) are memory mapped, write them with --format imgp"
+	);
+	parser.addHelpOption();
+	parser.addPositionalArgument("inputs", "Image files or directories to process.", "<inputs...>");
+
+	const QCommandLineOption pipelineOption({ "p", "pipeline" }, "Comma separated pipeline steps.", "steps");
+	const QCommandLineOption outputOption({ "o", "output" }, "Directory to write results to.", "dir", "output");
+	const QCommandLineOption formatOption({ "f", "format" }, "Format of the results, the input format by default.", "format");
+	const QCommandLineOption threadsOption({ "j", "threads" }, "Decoding and encoding threads each.", "count", "0");
+	const QCommandLineOption queueOption("queue", "Images held between processing stages.", "count", "4");
+	const QCommandLineOption recursiveOption({ "r", "recursive" }, "Process directories recursively, results keep their subdirectories.");
+	const QCommandLineOption quietOption({ "q", "quiet" }, "Only print the totals.");
+	const QCommandLineOption precisionOption("precision", "Working precision of gray scale conversion, gamma and filters: byte (default), word or float. Results are only rounded to 8 bits at the end.", "precision", "byte");
+	const QCommandLineOption kernelsOption("kernels", "JSON file of filter kernels to add to the built-in ones, can be repeated.", "file");
+	const QCommandLineOption streamOption("stream", "Process images in strips of rows, for images larger than memory. Results are written as netpbm (ppm, or pgm with --format pgm).", "rows");
+
+	parser.addOptions({ pipelineOption, outputOption, formatOption, threadsOption, queueOption, recursiveOption, quietOption, precisionOption, kernelsOption, streamOption });
+	parser.process(app);
+
+	BatchProcessor::Job job;
+	int halo = 0;
+	QString error;
+
+	KernelRegistry registry;
+
+	for (const QString& path : parser.values(kernelsOption))
+	{
+		if (!registry.load(path, error))
+		{
+			std::fprintf(stderr, "%s\n", qPrintable(error));
+			return 1;
+		}
+	}
+
+	if (!parsePipeline(parser.value(pipelineOption), registry, job, halo, error))
+	{
+		std::fprintf(stderr, "%s\n", qPrintable(error));
+		return 1;
+	}
+
+	const QString precisionName = parser.value(precisionOption);
+
+	if (precisionName != "byte")
+	{
+		if (precisionName != "word" && precisionName != "float")
+		{
+			std::fprintf(stderr, "unknown precision: %s\n", qPrintable(precisionName));
+			return 1;
+		}
+
+		//Set before the steps are recorded, so their tables are not composed in 8 bits
+		const Precision precision = (precisionName == "word") ? Precision::WORD : Precision::FLOAT;
+		const BatchProcessor::Job steps = job;
+
+		job = [precision, steps](ImagePipeline& p) {
+			p.setPrecision(precision);
+			steps(p);
+		};
+	}
+
+	const std::vector<BatchProcessor::Input> files = collectFiles(parser.positionalArguments(), parser.isSet(recursiveOption));
+
+	if (files.empty())
+		parser.showHelp(1);
+
+	BatchProcessor::Options options;
+	options.outputDir = parser.value(outputOption);
+	options.format = parser.value(formatOption);
+	options.ioThreads = parser.value(threadsOption).toInt();
+	options.queueSize = parser.value(queueOption).toInt();
+	options.verbose = !parser.isSet(quietOption);
+	options.stripRows = parser.isSet(streamOption) ? std::max(1, parser.value(streamOption).toInt()) : 0;
+	options.halo = halo;
+
+	const BatchProcessor::Stats stats = BatchProcessor(job, options).run(files);
+
+	return stats.failed ? 2 : 0;
+}
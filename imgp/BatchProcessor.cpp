@@ -0,0 +1,377 @@
+/*
+	Headless batch processing of image files
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QImageWriter>
+
+#include "BatchProcessor.h"
+#include "RawImage.h"
+#include "StreamingPipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double megabytes(qint64 bytes)
+{
+	return (double)bytes / (1024.0 * 1024.0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BatchProcessor::Queue::addProducers(int count)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_producers += count;
+}
+
+void BatchProcessor::Queue::producerDone()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_producers--;
+	}
+
+	m_changed.notify_all();
+}
+
+void BatchProcessor::Queue::push(Item item)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_changed.wait(lock, [this]() { return (int)m_items.size() < m_capacity; });
+		m_items.push_back(std::move(item));
+	}
+
+	m_changed.notify_all();
+}
+
+bool BatchProcessor::Queue::pop(Item& item)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_changed.wait(lock, [this]() { return !m_items.empty() || m_producers == 0; });
+
+		if (m_items.empty())
+			return false;
+
+		item = std::move(m_items.front());
+		m_items.pop_front();
+	}
+
+	m_changed.notify_all();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BatchProcessor::BatchProcessor(const Job& job, const Options& options) :
+	m_job(job),
+	m_options(options)
+{
+	m_options.queueSize = std::max(1, m_options.queueSize);
+
+	if (m_options.ioThreads <= 0)
+		m_options.ioThreads = std::max(1, (int)std::thread::hardware_concurrency() / 2);
+}
+
+BatchProcessor::Stats BatchProcessor::run(const std::vector<Input>& inputs)
+{
+	Stats stats;
+
+	QElapsedTimer timer;
+	timer.start();
+
+	const std::vector<Task> tasks = plan(inputs, stats);
+
+	if (m_options.stripRows > 0)
+	{
+		runStreaming(tasks, stats);
+	}
+	else
+	{
+		runPipelined(tasks, stats);
+	}
+
+	stats.seconds = (double)timer.nsecsElapsed() / 1e9;
+
+	const double seconds = std::max(stats.seconds, 1e-9);
+
+	std::printf("%d images (%d failed), %.1f MB in %.2f s: %.2f images/s, %.2f MB/s\n",
+		stats.processed, stats.failed, megabytes(stats.bytesRead), stats.seconds,
+		stats.processed / seconds, megabytes(stats.bytesRead) / seconds);
+
+	return stats;
+}
+
+std::vector<BatchProcessor::Task> BatchProcessor::plan(const std::vector<Input>& inputs, Stats& stats) const
+{
+	const QDir outputDir(m_options.outputDir);
+
+	//Only netpbm can be written a strip at a time
+	const QString streamSuffix = m_options.format == "pgm" ? "pgm" : "ppm";
+
+	std::vector<Task> tasks;
+	QHash<QString, QString> written;
+
+	for (const Input& input : inputs)
+	{
+		Task task;
+		task.path = input.path;
+
+		//Results keep the format of their input unless one is given, its header tells which
+		if (m_options.stripRows > 0)
+			task.format = streamSuffix.toLatin1();
+		else if (!m_options.format.isEmpty())
+			task.format = m_options.format.toLatin1();
+		else if (RawImage::isRawImage(input.path))
+			task.format = RawImage::Suffix;
+		else
+			task.format = QImageReader::imageFormat(input.path);
+
+		//Files which cannot be read fail later, until then their name stays their own
+		if (task.format.isEmpty())
+			task.format = QFileInfo(input.path).suffix().toLatin1();
+
+		task.target = QDir::cleanPath(outputDir.filePath(input.name + "." + QString::fromLatin1(task.format)));
+
+		auto it = written.constFind(task.target);
+
+		if (it != written.constEnd())
+		{
+			std::fprintf(stderr, "%s: %s is already the result of %s\n", qPrintable(input.path), qPrintable(task.target), qPrintable(it.value()));
+			stats.failed++;
+			continue;
+		}
+
+		written.insert(task.target, input.path);
+		QDir().mkpath(QFileInfo(task.target).path());
+
+		tasks.push_back(task);
+	}
+
+	return tasks;
+}
+
+void BatchProcessor::runPipelined(const std::vector<Task>& tasks, Stats& stats)
+{
+	Queue decoded(m_options.queueSize);
+	Queue processed(m_options.queueSize);
+
+	decoded.addProducers(m_options.ioThreads);
+	processed.addProducers(1);
+
+	std::mutex statsLock;
+	std::atomic<int> next(0);
+
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < m_options.ioThreads; i++)
+		threads.emplace_back(&BatchProcessor::decodeLoop, this, std::cref(tasks), std::ref(next), std::ref(decoded));
+
+	threads.emplace_back(&BatchProcessor::processLoop, this, std::ref(decoded), std::ref(processed));
+
+	for (int i = 0; i < m_options.ioThreads; i++)
+		threads.emplace_back(&BatchProcessor::encodeLoop, this, std::ref(processed), std::ref(stats), std::ref(statsLock));
+
+	for (std::thread& t : threads)
+		t.join();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BatchProcessor::decodeLoop(const std::vector<Task>& tasks, std::atomic<int>& next, Queue& decoded)
+{
+	for (int i = next++; i < (int)tasks.size(); i = next++)
+	{
+		QElapsedTimer timer;
+		timer.start();
+
+		Item item;
+		item.path = tasks[i].path;
+		item.target = tasks[i].target;
+		item.format = tasks[i].format;
+		item.bytes = QFileInfo(item.path).size();
+		item.processMs = 0.0;
+
+		QString error;
+
+		//Raw images are mapped, their pages are only read once processing touches them
+		if (RawImage::isRawImage(item.path))
+		{
+			item.image = RawImage::load(item.path, error);
+		}
+		else
+		{
+			QImageReader reader(item.path);
+			item.image = reader.read();
+			error = reader.errorString();
+		}
+
+		item.decodeMs = (double)timer.nsecsElapsed() / 1e6;
+
+		if (item.image.isNull())
+			std::fprintf(stderr, "%s: %s\n", qPrintable(item.path), qPrintable(error));
+
+		//Failed files are still passed on so they are counted
+		decoded.push(std::move(item));
+	}
+
+	decoded.producerDone();
+}
+
+void BatchProcessor::processLoop(Queue& decoded, Queue& processed)
+{
+	//Every file is a new image, so nothing would ever be found in the result cache
+	ImagePipeline pipeline;
+	pipeline.blockSignals(true);
+	pipeline.resultCache().setBudget(0);
+
+	Item item;
+
+	while (decoded.pop(item))
+	{
+		if (!item.image.isNull())
+		{
+			QElapsedTimer timer;
+			timer.start();
+
+			pipeline.load(item.image);
+			pipeline.defer();
+
+			if (m_job)
+				m_job(pipeline);
+
+			pipeline.execute();
+
+			item.image = pipeline.image();
+			item.processMs = (double)timer.nsecsElapsed() / 1e6;
+		}
+
+		processed.push(std::move(item));
+	}
+
+	processed.producerDone();
+}
+
+void BatchProcessor::encodeLoop(Queue& processed, Stats& stats, std::mutex& statsLock)
+{
+	Item item;
+
+	while (processed.pop(item))
+	{
+		bool ok = !item.image.isNull();
+		double encodeMs = 0.0;
+
+		if (ok)
+		{
+			QElapsedTimer timer;
+			timer.start();
+
+			QString error;
+
+			if (item.format == RawImage::Suffix)
+			{
+				ok = RawImage::save(item.target, item.image, error);
+			}
+			else
+			{
+				QImageWriter writer(item.target, item.format);
+				ok = writer.write(item.image);
+				error = writer.errorString();
+			}
+
+			if (!ok)
+				std::fprintf(stderr, "%s: %s\n", qPrintable(item.target), qPrintable(error));
+
+			encodeMs = (double)timer.nsecsElapsed() / 1e6;
+		}
+
+		std::lock_guard<std::mutex> lock(statsLock);
+
+		if (!ok)
+		{
+			stats.failed++;
+			continue;
+		}
+
+		stats.processed++;
+		stats.bytesRead += item.bytes;
+
+		if (m_options.verbose)
+		{
+			const double totalMs = std::max(item.decodeMs + item.processMs + encodeMs, 1e-6);
+
+			std::printf("%s: %dx%d, decode %.1f ms, process %.1f ms, encode %.1f ms, %.2f MB/s\n",
+				qPrintable(item.path), item.image.width(), item.image.height(),
+				item.decodeMs, item.processMs, encodeMs, megabytes(item.bytes) / (totalMs / 1000.0));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BatchProcessor::runStreaming(const std::vector<Task>& tasks, Stats& stats)
+{
+	StreamingPipeline pipeline(m_job, m_options.halo, m_options.stripRows);
+
+	for (const Task& task : tasks)
+	{
+		QElapsedTimer timer;
+		timer.start();
+
+		const QString& path = task.path;
+		const QString& name = task.target;
+
+		StripReader reader;
+		StripWriter writer;
+
+		bool ok = reader.open(path);
+
+		if (!ok)
+		{
+			std::fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(reader.errorString()));
+		}
+		else if (!(ok = writer.open(name, reader.size())))
+		{
+			std::fprintf(stderr, "%s: %s\n", qPrintable(name), qPrintable(writer.errorString()));
+		}
+		else if (!(ok = pipeline.run(reader, writer)))
+		{
+			std::fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(pipeline.errorString()));
+		}
+		else if (!(ok = writer.close()))
+		{
+			std::fprintf(stderr, "%s: %s\n", qPrintable(name), qPrintable(writer.errorString()));
+		}
+
+		if (!ok)
+		{
+			stats.failed++;
+			continue;
+		}
+
+		const qint64 bytes = QFileInfo(path).size();
+
+		stats.processed++;
+		stats.bytesRead += bytes;
+
+		if (m_options.verbose)
+		{
+			const double totalMs = std::max((double)timer.nsecsElapsed() / 1e6, 1e-6);
+
+			std::printf("%s: %dx%d, streamed in %.1f ms, peak memory %.1f MB, %.2f MB/s\n",
+				qPrintable(path), reader.size().width(), reader.size().height(),
+				totalMs, megabytes(pipeline.peakMemory()), megabytes(bytes) / (totalMs / 1000.0));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
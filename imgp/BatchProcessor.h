@@ -0,0 +1,147 @@
+/*
+	Headless batch processing of image files
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+#include "ImagePipeline.h"
+
+/*
+	Runs a pipeline job over a list of image files and writes the results.
+
+	Files go through three overlapping stages: decoding on several reader threads, processing on one
+	thread which splits each image across the thread pool, and encoding on several writer threads.
+	Stages hand images over through bounded queues, so at most readers + 2 * queueSize + 1 + writers
+	images are in memory at once, however many files there are.
+
+	In streaming mode files are instead processed one at a time, a strip of rows at a time, for images
+	too large to hold in memory. Results are then written as netpbm files.
+
+	The path of every result is worked out before any file is read. A file whose result would overwrite
+	the result of an earlier file fails.
+*/
+class BatchProcessor
+{
+public:
+
+	using Job = std::function<void(ImagePipeline&)>;
+
+	struct Options
+	{
+		//Directory results are written to
+		QString outputDir;
+
+		//Format of the results, empty keeps the format of each input file
+		QString format;
+
+		//Reader and writer threads each, 0 uses half of the available cores
+		int ioThreads = 0;
+
+		//Images waiting between two stages
+		int queueSize = 4;
+
+		//Print a line for every file
+		bool verbose = true;
+
+		//Rows processed at a time in streaming mode, 0 processes whole images
+		int stripRows = 0;
+
+		//Rows of context the job reads around each output row, negative if it reads the whole image
+		int halo = 0;
+	};
+
+	//Totals of a run
+	struct Stats
+	{
+		int processed = 0;
+		int failed = 0;
+		qint64 bytesRead = 0;
+		double seconds = 0.0;
+	};
+
+	//File to process, and the path of its result relative to the output directory, without a suffix
+	struct Input
+	{
+		QString path;
+		QString name;
+	};
+
+	BatchProcessor(const Job& job, const Options& options);
+
+	//Process the files, blocking until every file is written
+	Stats run(const std::vector<Input>& inputs);
+
+private:
+
+	//File to process, with the path and format of its result
+	struct Task
+	{
+		QString path;
+		QString target;
+		QByteArray format;
+	};
+
+	struct Item
+	{
+		QString path;
+		QString target;
+		QByteArray format;
+		QImage image;
+		qint64 bytes;
+
+		//Stage timings in milliseconds
+		double decodeMs;
+		double processMs;
+	};
+
+	//Queue between two stages, push blocks while it is full
+	class Queue
+	{
+	public:
+
+		explicit Queue(int capacity) : m_capacity(capacity), m_producers(0) {}
+
+		void addProducers(int count);
+		void producerDone();
+
+		void push(Item item);
+
+		//Returns false once every producer is done and the queue is empty
+		bool pop(Item& item);
+
+	private:
+
+		std::mutex m_lock;
+		std::condition_variable m_changed;
+		std::deque<Item> m_items;
+		int m_capacity;
+		int m_producers;
+	};
+
+	//Work out the result of every input, inputs whose result is taken by an earlier one are counted as failed and left out
+	std::vector<Task> plan(const std::vector<Input>& inputs, Stats& stats) const;
+
+	//Decode, process and encode whole images in overlapping stages
+	void runPipelined(const std::vector<Task>& tasks, Stats& stats);
+
+	void decodeLoop(const std::vector<Task>& tasks, std::atomic<int>& next, Queue& decoded);
+	void processLoop(Queue& decoded, Queue& processed);
+	void encodeLoop(Queue& processed, Stats& stats, std::mutex& statsLock);
+
+	//Process files in strips of rows, one after the other
+	void runStreaming(const std::vector<Task>& tasks, Stats& stats);
+
+	Job m_job;
+	Options m_options;
+};
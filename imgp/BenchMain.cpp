@@ -0,0 +1,344 @@
+/*
+	Benchmarks of the image pipeline operations
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+
+#include "ImagePipeline.h"
+#include "Simd.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Operation
+{
+	QString name;
+	std::function<void(ImagePipeline&)> run;
+
+	//Time loading the input instead, which the other operations start from untimed
+	bool load;
+};
+
+struct Format
+{
+	QString name;
+	QImage::Format format;
+};
+
+//Disc of the given radius with a raised centre, a large kernel which does not factorise
+static std::vector<int> discKernel(int radius)
+{
+	const int size = 2 * radius + 1;
+	std::vector<int> weights(size * size);
+
+	for (int y = -radius; y <= radius; y++)
+	{
+		for (int x = -radius; x <= radius; x++)
+			weights[(y + radius) * size + x + radius] = (x * x + y * y <= radius * radius) ? 1 : 0;
+	}
+
+	weights[radius * size + radius] += size;
+	return weights;
+}
+
+static std::vector<Operation> operations()
+{
+	std::vector<Operation> ops = {
+		{ "load",            nullptr, true },
+		{ "grayscale",       [](ImagePipeline& p) { p.makeGrayscale(); } },
+		{ "gamma",           [](ImagePipeline& p) { p.setGamma(0.8f); } },
+		{ "median",          [](ImagePipeline& p) { p.applyNonLinearFilter(); } },
+		{ "median/r5",       [](ImagePipeline& p) { p.applyRankFilter(RankFilter::median(5)); } },
+		{ "median/r25",      [](ImagePipeline& p) { p.applyRankFilter(RankFilter::median(25)); } },
+		{ "minimum/r5",      [](ImagePipeline& p) { p.applyRankFilter(RankFilter::minimum(5)); } },
+		{ "threshold",       [](ImagePipeline& p) { p.applyThresholding(); } },
+		{ "blur/r1",         [](ImagePipeline& p) { p.applyBoxBlur(1); } },
+		{ "blur/r25",        [](ImagePipeline& p) { p.applyBoxBlur(25); } },
+		{ "blur/r200",       [](ImagePipeline& p) { p.applyBoxBlur(200); } },
+		{ "deviation/r8",    [](ImagePipeline& p) { p.applyLocalDeviation(8); } },
+		{ "adaptive/r15",    [](ImagePipeline& p) { p.applyAdaptiveThresholding(15); } },
+		{ "gaussian/s1",     [](ImagePipeline& p) { p.applyGaussianBlur(1.0f); } },
+		{ "gaussian/s10",    [](ImagePipeline& p) { p.applyGaussianBlur(10.0f); } },
+		{ "gaussian/s100",   [](ImagePipeline& p) { p.applyGaussianBlur(100.0f); } },
+		{ "dither/error",    [](ImagePipeline& p) { p.applyDithering(Dithering::ERROR_DIFFUSION); } },
+		{ "dither/floyd",    [](ImagePipeline& p) { p.applyDithering(Dithering::FLOYD_STEINBERG); } },
+		{ "dither/ordered",  [](ImagePipeline& p) { p.applyDithering(Dithering::ORDERED); } },
+		{ "dither/pattern",  [](ImagePipeline& p) { p.applyDithering(Dithering::PATTERN); } },
+		{ "dither/ordered16", [](ImagePipeline& p) { p.applyDithering(Dithering::ORDERED, ThresholdMap::bayer(16)); } },
+		{ "dither/pattern8", [](ImagePipeline& p) { p.applyDithering(Dithering::PATTERN, ThresholdMap::bayer(8)); } },
+		{ "chain",           [](ImagePipeline& p) { p.defer().setGamma(0.8f).applyFilter(kernels::gaussian3).setGamma(1.25f).execute(); } },
+	};
+
+	const std::vector<std::pair<QString, KernelView>> filters = {
+		{ "box",       kernels::box },
+		{ "edgesV",    kernels::edgesV },
+		{ "edgesH",    kernels::edgesH },
+		{ "edges2",    kernels::edges2 },
+		{ "edges3",    kernels::edges3 },
+		{ "gaussian3", kernels::gaussian3 },
+		{ "gaussian5", kernels::gaussian5 },
+		{ "sharpen",   kernels::sharpen },
+		{ "emboss",    kernels::emboss },
+	};
+
+	for (const auto& filter : filters)
+	{
+		const KernelView kernel = filter.second;
+		ops.push_back({ "filter/" + filter.first, [kernel](ImagePipeline& p) { p.applyFilter(kernel); } });
+	}
+
+	//Direct below 11x11, through transforms above
+	for (int radius : { 4, 7, 15 })
+	{
+		const std::vector<int> weights = discKernel(radius);
+		const uint size = 2 * radius + 1;
+
+		ops.push_back({ QString("filter/disc%1").arg(size), [weights, size](ImagePipeline& p) {
+			KernelView kernel;
+			kernel.v = weights.data();
+			kernel.n = size;
+			kernel.m = size;
+			p.applyFilter(kernel);
+		} });
+	}
+
+	return ops;
+}
+
+static const std::vector<Format>& formats()
+{
+	static const std::vector<Format> f = {
+		{ "argb32",  QImage::Format_ARGB32 },
+		{ "rgb32",   QImage::Format_RGB32 },
+		{ "rgb888",  QImage::Format_RGB888 },
+		{ "gray8",   QImage::Format_Grayscale8 },
+	};
+
+	return f;
+}
+
+//Noise over a gradient, so thresholds and dithering see every intensity
+static QImage syntheticImage(int size, QImage::Format format)
+{
+	QImage img(size, size, QImage::Format_ARGB32);
+	quint32 seed = 12345;
+
+	for (int y = 0; y < size; y++)
+	{
+		QRgb* line = reinterpret_cast<QRgb*>(img.scanLine(y));
+
+		for (int x = 0; x < size; x++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			const int base = (x + y) * 255 / (2 * size);
+			const int noise = (int)(seed >> 26) - 32;
+
+			line[x] = qRgb(std::max(0, std::min(255, base + noise)), (seed >> 8) & 0xff, std::max(0, std::min(255, 255 - base + noise)));
+		}
+	}
+
+	return img.convertToFormat(format);
+}
+
+static QList<int> parseList(const QString& list)
+{
+	QList<int> values;
+
+	for (const QString& v : list.split(',', QString::SkipEmptyParts))
+		values << v.toInt();
+
+	return values;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("imgp-bench");
+
+	const int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+
+	QString defaultThreads;
+
+	for (int t = 1; t < cores; t *= 2)
+		defaultThreads += QString::number(t) + ",";
+
+	defaultThreads += QString::number(cores);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Time every image pipeline operation and write the results as JSON.");
+	parser.addHelpOption();
+
+	const QCommandLineOption sizesOption("sizes", "Comma separated image sizes, images are square.", "sizes", "256,1024,4096,8192");
+	const QCommandLineOption formatsOption("formats", "Comma separated input formats: argb32, rgb32, rgb888, gray8.", "formats", "argb32,rgb888");
+	const QCommandLineOption threadsOption("threads", "Comma separated thread counts.", "threads", defaultThreads);
+	const QCommandLineOption filterOption("filter", "Only run operations matching a regular expression.", "regex", ".*");
+	const QCommandLineOption isaOption("isa", "Instruction set of the kernels: scalar, sse2, avx2.", "isa");
+	const QCommandLineOption precisionOption("precision", "Working precision of point operations and filters: byte, word, float.", "precision", "byte");
+	const QCommandLineOption timeOption("min-time", "Minimum time spent on each benchmark in seconds.", "seconds", "0.5");
+	const QCommandLineOption outputOption({ "o", "output" }, "File to write the JSON results to, standard output by default.", "file");
+	const QCommandLineOption traceOption("trace", "File to write a Chrome trace of every operation run to, timing adds a little overhead.", "file");
+
+	parser.addOptions({ sizesOption, formatsOption, threadsOption, filterOption, isaOption, precisionOption, timeOption, outputOption, traceOption });
+	parser.process(app);
+
+	const QString precisionName = parser.value(precisionOption);
+
+	if (precisionName != "byte" && precisionName != "word" && precisionName != "float")
+	{
+		std::fprintf(stderr, "unknown precision: %s\n", qPrintable(precisionName));
+		return 1;
+	}
+
+	const Precision precision = (precisionName == "float") ? Precision::FLOAT : (precisionName == "word") ? Precision::WORD : Precision::BYTE;
+
+	if (parser.isSet(isaOption))
+	{
+		const QString isa = parser.value(isaOption);
+		simd::setIsa(isa == "avx2" ? simd::Isa::AVX2 : isa == "sse2" ? simd::Isa::SSE2 : simd::Isa::Scalar);
+	}
+
+	const QRegularExpression filter("^(" + parser.value(filterOption) + ")$");
+	const QStringList formatNames = parser.value(formatsOption).split(',', QString::SkipEmptyParts);
+	const double minTime = parser.value(timeOption).toDouble();
+
+	const int minIterations = 3;
+	const int maxIterations = 100;
+
+	const char* isaNames[] = { "scalar", "sse2", "avx2" };
+
+	Profiler profiler;
+	profiler.setEnabled(parser.isSet(traceOption));
+
+	QJsonArray results;
+
+	for (int size : parseList(parser.value(sizesOption)))
+	{
+		for (const Format& format : formats())
+		{
+			if (!formatNames.contains(format.name))
+				continue;
+
+			const QImage img = syntheticImage(size, format.format);
+
+			for (int threads : parseList(parser.value(threadsOption)))
+			{
+				ThreadPool pool(threads);
+
+				//Every iteration must compute its result
+				ImagePipeline pipeline;
+				pipeline.blockSignals(true);
+				pipeline.resultCache().setBudget(0);
+				pipeline.setThreadPool(&pool);
+				pipeline.setPrecision(precision);
+				pipeline.setProfiler(&profiler);
+
+				for (const Operation& op : operations())
+				{
+					if (!filter.match(op.name).hasMatch())
+						continue;
+
+					std::vector<double> times;
+					QElapsedTimer total;
+					total.start();
+
+					//Loading converts the input format, only the load operation times it
+					pipeline.load(img);
+
+					while ((int)times.size() < maxIterations && ((int)times.size() < minIterations || total.nsecsElapsed() < minTime * 1e9))
+					{
+						pipeline.reset();
+
+						QElapsedTimer timer;
+						timer.start();
+
+						if (op.load)
+							pipeline.load(img);
+						else
+							op.run(pipeline);
+
+						times.push_back((double)timer.nsecsElapsed() / 1e6);
+					}
+
+					std::sort(times.begin(), times.end());
+
+					double mean = 0.0;
+
+					for (double t : times)
+						mean += t;
+
+					mean /= times.size();
+
+					const double megapixels = (double)size * size / 1e6;
+
+					QJsonObject result;
+					result["operation"] = op.name;
+					result["width"] = size;
+					result["height"] = size;
+					result["format"] = format.name;
+					result["threads"] = pool.threadCount();
+					result["iterations"] = (int)times.size();
+					result["min_ms"] = times.front();
+					result["median_ms"] = times[times.size() / 2];
+					result["mean_ms"] = mean;
+					result["mpix_per_s"] = megapixels / (times[times.size() / 2] / 1000.0);
+					results.append(result);
+
+					std::fprintf(stderr, "%-18s %5dx%-5d %-7s %2d threads  %9.2f ms\n",
+						qPrintable(op.name), size, size, qPrintable(format.name), pool.threadCount(), times[times.size() / 2]);
+				}
+			}
+		}
+	}
+
+	QJsonObject context;
+	context["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+	context["cores"] = cores;
+	context["isa"] = isaNames[(int)simd::isa()];
+	context["precision"] = precisionName;
+	context["qt"] = qVersion();
+
+	QJsonObject root;
+	root["context"] = context;
+	root["benchmarks"] = results;
+
+	const QByteArray json = QJsonDocument(root).toJson();
+
+	QString error;
+
+	if (parser.isSet(traceOption) && !profiler.writeChromeTrace(parser.value(traceOption), error))
+	{
+		std::fprintf(stderr, "Unable to write %s: %s\n", qPrintable(parser.value(traceOption)), qPrintable(error));
+		return 1;
+	}
+
+	if (!parser.isSet(outputOption))
+	{
+		std::fwrite(json.constData(), 1, json.size(), stdout);
+		return 0;
+	}
+
+	QFile file(parser.value(outputOption));
+
+	if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+	{
+		std::fprintf(stderr, "Unable to write %s\n", qPrintable(file.fileName()));
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,413 @@
+/*
+	Convolution engine
+*/
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "Convolution.h"
+#include "Simd.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int gcd(int a, int b)
+{
+	while (b != 0)
+	{
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Convolution::Convolution(const KernelView& kernel) :
+	m_rows((int)kernel.n),
+	m_cols((int)kernel.m),
+	m_weights(kernel.v, kernel.v + kernel.n * kernel.m),
+	m_factor(0),
+	m_reciprocal(0),
+	m_offset(0),
+	m_border(kernel.border)
+{
+	int magnitude = 0;
+
+	for (int w : m_weights)
+	{
+		m_factor += w;
+		magnitude += std::abs(w);
+	}
+
+	m_factor = (kernel.divisor > 0) ? kernel.divisor : std::max(m_factor, 1);
+	m_offset = kernel.bias * m_factor;
+
+	//Division by the reciprocal is exact as long as accum * factor < 2^32, see normalise()
+	const uint64_t maxAccum = (uint64_t)magnitude * 255 + (uint64_t)std::abs(m_offset);
+
+	if (m_factor > 1 && maxAccum * (uint64_t)m_factor < (1ull << 32))
+		m_reciprocal = ((1ull << 32) / (uint64_t)m_factor) + 1;
+
+	factorise();
+
+	//Vectorized kernels take 16 bit weights and can only divide through the reciprocal
+	const int maxTaps = 7 * 7;
+	const bool fitsInt16 = std::all_of(m_weights.begin(), m_weights.end(), [](int w) { return w >= INT16_MIN && w <= INT16_MAX; });
+
+	if (simd::isa() != simd::Isa::Scalar && (int)m_weights.size() <= maxTaps && fitsInt16 && (m_factor == 1 || m_reciprocal))
+		m_weights16.assign(m_weights.begin(), m_weights.end());
+}
+
+bool Convolution::factorise()
+{
+	m_column.clear();
+	m_row.clear();
+
+	//The row and column of the first non zero weight span the kernel if it has rank 1
+	auto pivot = std::find_if(m_weights.begin(), m_weights.end(), [](int w) { return w != 0; });
+
+	if (pivot == m_weights.end())
+		return false;
+
+	const int pr = (int)(pivot - m_weights.begin()) / m_cols;
+	const int pc = (int)(pivot - m_weights.begin()) % m_cols;
+
+	//Reduce the pivot row by the gcd of its weights, the column factors are then integers
+	std::vector<int> row(m_weights.begin() + pr * m_cols, m_weights.begin() + (pr + 1) * m_cols);
+	int divisor = 0;
+
+	for (int w : row)
+		divisor = gcd(divisor, std::abs(w));
+
+	for (int& w : row)
+		w /= divisor;
+
+	std::vector<int> column(m_rows);
+
+	for (int y = 0; y < m_rows; y++)
+	{
+		const int w = m_weights[y * m_cols + pc];
+
+		if (w % row[pc] != 0)
+			return false;
+
+		column[y] = w / row[pc];
+
+		for (int x = 0; x < m_cols; x++)
+		{
+			if (m_weights[y * m_cols + x] != column[y] * row[x])
+				return false;
+		}
+	}
+
+	m_column.swap(column);
+	m_row.swap(row);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int Convolution::borderIndex(int i, int n) const
+{
+	if (i >= 0 && i < n)
+		return i;
+
+	switch (m_border)
+	{
+		case Border::MIRROR:
+		{
+			//Reflections repeat every 2 * (n - 1) values, kernels can be wider than the image
+			const int period = 2 * (n - 1);
+
+			if (period == 0)
+				return 0;
+
+			i = ((i % period) + period) % period;
+			return (i < n) ? i : period - i;
+		}
+
+		case Border::WRAP:
+			return ((i % n) + n) % n;
+
+		default:
+			return std::max(0, std::min(n - 1, i));
+	}
+}
+
+int Convolution::normalise(int accum) const
+{
+	accum += m_offset;
+
+	//The divisor is always positive, so negative sums truncate to zero or below and clamp to 0
+	if (accum <= 0)
+		return 0;
+
+	const int value = m_reciprocal ? (int)(((uint64_t)accum * m_reciprocal) >> 32) : accum / m_factor;
+
+	return std::min(value, 255);
+}
+
+QRgb Convolution::normalise(int r, int g, int b) const
+{
+	return qRgb(normalise(r), normalise(g), normalise(b));
+}
+
+void Convolution::convolveSpan(const QImage& img, int y, int x0, int x1, QRgb* out) const
+{
+	if (isSeparable() && !isVectorised())
+		convolveSeparable(img, y, x0, x1, out);
+	else
+		convolveDirect(img, y, x0, x1, out);
+}
+
+void Convolution::convolveSpan(const QImage& img, int y, int x0, int x1, uchar* out) const
+{
+	const int width = img.width();
+
+	const int left = m_cols >> 1;
+	const int top = m_rows >> 1;
+
+	//Columns read by the span, the ones outside the image repeat its edge columns
+	const int begin = x0 - left;
+	const int end = x1 + (m_cols - 1 - left);
+	const int count = x1 - x0;
+
+	thread_local std::vector<int> columns;
+	thread_local std::vector<int> accum;
+	columns.resize(end - begin);
+	accum.assign(count, 0);
+
+	auto borderLine = [&](int ky) { return img.constScanLine(borderIndex(y + ky - top, img.height())); };
+
+	//Every tap adds a shifted row of weighted values, which vectorizes across the whole span
+	auto addRow = [&](const int* values, const int* weights) {
+		for (int kx = 0; kx < m_cols; kx++)
+		{
+			const int w = weights[kx];
+
+			if (w == 0)
+				continue;
+
+			const int* v = values + kx;
+
+			for (int i = 0; i < count; i++)
+				accum[i] += v[i] * w;
+		}
+	};
+
+	//A separable kernel sums its columns first, then runs its row over the sums
+	if (isSeparable())
+	{
+		std::fill(columns.begin(), columns.end(), 0);
+
+		for (int ky = 0; ky < m_rows; ky++)
+		{
+			const int w = m_column[ky];
+
+			if (w == 0)
+				continue;
+
+			const uchar* line = borderLine(ky);
+
+			for (int x = begin; x < end; x++)
+				columns[x - begin] += line[borderIndex(x, width)] * w;
+		}
+
+		addRow(columns.data(), m_row.data());
+	}
+	else
+	{
+		for (int ky = 0; ky < m_rows; ky++)
+		{
+			const uchar* line = borderLine(ky);
+
+			for (int x = begin; x < end; x++)
+				columns[x - begin] = line[borderIndex(x, width)];
+
+			addRow(columns.data(), m_weights.data() + ky * m_cols);
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+		out[i] = (uchar)normalise(accum[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Convolution::convolveSeparable(const QImage& img, int y, int x0, int x1, QRgb* out) const
+{
+	const int width = img.width();
+
+	//Kernel extent left of and above the centre tap
+	const int left = m_cols >> 1;
+	const int top = m_rows >> 1;
+
+	//Columns read by the horizontal pass, and the part of them inside the image
+	const int begin = x0 - left;
+	const int end = x1 + (m_cols - 1 - left);
+	const int first = std::max(begin, 0);
+	const int last = std::min(end, width);
+
+	//Vertical pass, channel sums for every column read by the horizontal pass
+	thread_local std::vector<int> sums;
+	sums.assign((size_t)(end - begin) * 3, 0);
+
+	int* const interior = sums.data() + (first - begin) * 3;
+
+	for (int ky = 0; ky < m_rows; ky++)
+	{
+		const int w = m_column[ky];
+
+		if (w == 0)
+			continue;
+
+		const QRgb* line = reinterpret_cast<const QRgb*>(img.constScanLine(borderIndex(y + ky - top, img.height())));
+		int* s = interior;
+
+		for (int x = first; x < last; x++, s += 3)
+		{
+			const QRgb p = line[x];
+			s[0] += qRed(p) * w;
+			s[1] += qGreen(p) * w;
+			s[2] += qBlue(p) * w;
+		}
+	}
+
+	//Columns past the image borders copy the columns the border mode reads, so the horizontal pass never maps them
+	auto copyColumn = [&](int x) {
+		const int source = borderIndex(x, width);
+
+		//Columns of the image outside the span read by a wide kernel are summed on their own
+		if (source < first || source >= last)
+		{
+			int* s = sums.data() + (x - begin) * 3;
+
+			for (int ky = 0; ky < m_rows; ky++)
+			{
+				const QRgb p = reinterpret_cast<const QRgb*>(img.constScanLine(borderIndex(y + ky - top, img.height())))[source];
+				s[0] += qRed(p) * m_column[ky];
+				s[1] += qGreen(p) * m_column[ky];
+				s[2] += qBlue(p) * m_column[ky];
+			}
+
+			return;
+		}
+
+		std::copy(interior + (source - first) * 3, interior + (source - first + 1) * 3, sums.data() + (x - begin) * 3);
+	};
+
+	for (int x = begin; x < first; x++)
+		copyColumn(x);
+
+	for (int x = last; x < end; x++)
+		copyColumn(x);
+
+	//Horizontal pass
+	for (int x = x0; x < x1; x++)
+	{
+		const int* s = sums.data() + (x - x0) * 3;
+		int r = 0, g = 0, b = 0;
+
+		for (int kx = 0; kx < m_cols; kx++, s += 3)
+		{
+			const int w = m_row[kx];
+			r += s[0] * w;
+			g += s[1] * w;
+			b += s[2] * w;
+		}
+
+		out[x - x0] = normalise(r, g, b);
+	}
+}
+
+void Convolution::convolveDirect(const QImage& img, int y, int x0, int x1, QRgb* out) const
+{
+	const int width = img.width();
+
+	const int left = m_cols >> 1;
+	const int right = m_cols - 1 - left;
+	const int top = m_rows >> 1;
+
+	thread_local std::vector<const QRgb*> lines;
+	lines.resize(m_rows);
+
+	for (int ky = 0; ky < m_rows; ky++)
+		lines[ky] = reinterpret_cast<const QRgb*>(img.constScanLine(borderIndex(y + ky - top, img.height())));
+
+	//Pixels whose taps stay inside the image
+	const int interiorBegin = std::max(x0, std::min(x1, left));
+	const int interiorEnd = std::max(interiorBegin, std::min(x1, width - right));
+
+	//Border pixels map every tap into the image
+	auto border = [&](int x) {
+		int r = 0, g = 0, b = 0;
+
+		for (int ky = 0; ky < m_rows; ky++)
+		{
+			const int* weights = m_weights.data() + ky * m_cols;
+
+			for (int kx = 0; kx < m_cols; kx++)
+			{
+				const QRgb p = lines[ky][borderIndex(x + kx - left, width)];
+				r += qRed(p) * weights[kx];
+				g += qGreen(p) * weights[kx];
+				b += qBlue(p) * weights[kx];
+			}
+		}
+
+		out[x - x0] = normalise(r, g, b);
+	};
+
+	for (int x = x0; x < interiorBegin; x++)
+		border(x);
+
+	convolveInterior(lines.data(), interiorBegin, interiorEnd, left, out + (interiorBegin - x0));
+
+	for (int x = interiorEnd; x < x1; x++)
+		border(x);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Convolution::convolveInterior(const QRgb* const* lines, int x0, int x1, int left, QRgb* out) const
+{
+	int x = x0;
+
+	if (isVectorised() && x1 > x0)
+	{
+		thread_local std::vector<const QRgb*> taps;
+		taps.resize(m_rows);
+
+		for (int ky = 0; ky < m_rows; ky++)
+			taps[ky] = lines[ky] + (x0 - left);
+
+		const simd::Divisor divisor = { m_factor, (uint32_t)m_reciprocal, m_offset };
+		x += simd::convolve(taps.data(), m_rows, m_cols, m_weights16.data(), divisor, out, x1 - x0);
+	}
+
+	//Scalar path, and the pixels left over by the vectorized one
+	for (; x < x1; x++)
+	{
+		int r = 0, g = 0, b = 0;
+
+		for (int ky = 0; ky < m_rows; ky++)
+		{
+			const QRgb* p = lines[ky] + (x - left);
+			const int* weights = m_weights.data() + ky * m_cols;
+
+			for (int kx = 0; kx < m_cols; kx++)
+			{
+				r += qRed(p[kx]) * weights[kx];
+				g += qGreen(p[kx]) * weights[kx];
+				b += qBlue(p[kx]) * weights[kx];
+			}
+		}
+
+		out[x - x0] = normalise(r, g, b);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,94 @@
+/*
+	Convolution engine
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <QImage>
+
+#include "FilterKernels.h"
+
+/*
+	A filter kernel prepared for convolving working format images.
+
+	A Kernel<n,m> has n rows of m columns. Kernels which factorise into a column vector times a row vector
+	(rank 1, e.g. box, gaussian3 and the sobel operators) are run as a vertical and a horizontal 1D pass,
+	any other kernel as a direct 2D pass. Both paths accumulate every colour channel in one sweep, keep
+	integer arithmetic exact and give the same result as a naive n*m loop, which reads past the image
+	borders as the kernel's border mode says.
+
+	Small kernels (up to 7x7) are run as a direct pass with vectorized interior pixels when the CPU allows it.
+	Gray scale images have a single channel pass of their own, with the same result as their working format.
+*/
+class Convolution
+{
+public:
+
+	explicit Convolution(const KernelView& kernel);
+
+	//Returns true if the kernel factorises into two 1D passes
+	bool isSeparable() const { return !m_column.empty(); }
+
+	//Returns true if interior pixels are convolved with SIMD instructions
+	bool isVectorised() const { return !m_weights16.empty(); }
+
+	//Convolve the pixels [x0, x1) of row y of the input image into out
+	void convolveSpan(const QImage& img, int y, int x0, int x1, QRgb* out) const;
+
+	//Convolve the pixels [x0, x1) of row y of an 8-bit gray scale image into out
+	void convolveSpan(const QImage& img, int y, int x0, int x1, uchar* out) const;
+
+	//Kernel size, weights, divisor and bias times the divisor, for convolving images of other pixel types
+	int rows() const { return m_rows; }
+	int cols() const { return m_cols; }
+	const std::vector<int>& weights() const { return m_weights; }
+	int factor() const { return m_factor; }
+	int offset() const { return m_offset; }
+
+	//Column and row factors of a separable kernel, empty otherwise
+	const std::vector<int>& columnFactors() const { return m_column; }
+	const std::vector<int>& rowFactors() const { return m_row; }
+
+	//Divide an accumulated channel by the kernel divisor, offset it by the bias and clamp it to [0, 255]
+	int normalise(int accum) const;
+
+	//Index of the value read at position i of a line of n values, i may be past either end
+	Border border() const { return m_border; }
+	int borderIndex(int i, int n) const;
+
+private:
+
+	//Factorise the kernel into m_column * m_row, returns false if it has rank > 1
+	bool factorise();
+
+	void convolveSeparable(const QImage& img, int y, int x0, int x1, QRgb* out) const;
+	void convolveDirect(const QImage& img, int y, int x0, int x1, QRgb* out) const;
+
+	//Convolve interior pixels [x0, x1), where no tap needs clamping
+	void convolveInterior(const QRgb* const* lines, int x0, int x1, int left, QRgb* out) const;
+
+	//Divide accumulated channels by the kernel weight sum and clamp them into a pixel
+	QRgb normalise(int r, int g, int b) const;
+
+	int m_rows;
+	int m_cols;
+	std::vector<int> m_weights;
+
+	//1D factors of a separable kernel, empty otherwise
+	std::vector<int> m_column;
+	std::vector<int> m_row;
+
+	//Weight sum or divisor, divided through a fixed point reciprocal where it is exact
+	int m_factor;
+	uint64_t m_reciprocal;
+
+	//The bias times the factor, added to sums before they are divided
+	int m_offset;
+	Border m_border;
+
+	//Weights for the vectorized direct pass, empty if it is not used
+	std::vector<int16_t> m_weights16;
+};
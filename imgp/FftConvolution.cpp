@@ -0,0 +1,211 @@
+/*
+	Convolution through the fast Fourier transform
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "FftConvolution.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Largest transform along either axis, a block of 512 * 512 complex values is 4 MB
+static const int MaxTransform = 512;
+
+//Transform size along an axis for a kernel of taps weights, the least work per output pixel up to a size covering the image
+static int transformSize(int taps, int length)
+{
+	const int limit = std::max(FourierTransform::size(taps), std::min(MaxTransform, FourierTransform::size(length + taps - 1)));
+
+	int best = FourierTransform::size(taps);
+	double bestCost = 0.0;
+
+	for (int n = best; n <= limit; n *= 2)
+	{
+		//Transform cost per value grows with log n, only n - taps + 1 of the n values are output
+		const double cost = (double)n * std::log2((double)n) / (n - taps + 1);
+
+		if (n == best || cost < bestCost)
+		{
+			best = n;
+			bestCost = cost;
+		}
+	}
+
+	return best;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool FftConvolution::isPreferred(const Convolution& convolution)
+{
+	//Separable kernels cost rows + cols per pixel, which transforms never beat
+	return !convolution.isSeparable() && convolution.rows() * convolution.cols() >= MinTaps;
+}
+
+FftConvolution::FftConvolution(const Convolution& convolution, int width, int height) :
+	m_convolution(convolution),
+	m_transform(transformSize(convolution.rows(), height), transformSize(convolution.cols(), width))
+{
+	const int rows = m_transform.rows();
+	const int cols = m_transform.cols();
+
+	m_tileWidth = cols - convolution.cols() + 1;
+	m_tileHeight = rows - convolution.rows() + 1;
+
+	//Weight (ky, kx) goes to (-ky, -kx), so the circular convolution of a block correlates it with the kernel
+	m_spectrum.assign((size_t)rows * cols, 0.0);
+
+	const double scale = 1.0 / ((double)rows * cols);
+	const std::vector<int>& weights = convolution.weights();
+
+	for (int ky = 0; ky < convolution.rows(); ky++)
+	{
+		for (int kx = 0; kx < convolution.cols(); kx++)
+		{
+			const int y = (rows - ky) % rows;
+			const int x = (cols - kx) % cols;
+
+			m_spectrum[(size_t)y * cols + x] = weights[ky * convolution.cols() + kx] * scale;
+		}
+	}
+
+	m_transform.forward(m_spectrum.data());
+}
+
+void FftConvolution::load(const QImage& img, const Plane& plane, FourierTransform::Complex* data, bool imaginary) const
+{
+	const int rows = m_transform.rows();
+	const int cols = m_transform.cols();
+	const int width = img.width();
+	const int height = img.height();
+
+	//The block read by the tile starts at the kernel's top left tap of its first pixel
+	const int left = plane.x0 - (m_convolution.cols() >> 1);
+	const int top = plane.y0 - (m_convolution.rows() >> 1);
+
+	//Columns of the block mapped into the image, the same for every row
+	thread_local std::vector<int> columns;
+	columns.resize(cols);
+
+	for (int u = 0; u < cols; u++)
+		columns[u] = m_convolution.borderIndex(left + u, width);
+
+	double* values = reinterpret_cast<double*>(data) + (imaginary ? 1 : 0);
+	const int shift = 16 - 8 * std::max(0, plane.channel);
+
+	for (int v = 0; v < rows; v++, values += 2 * cols)
+	{
+		const uchar* line = img.constScanLine(m_convolution.borderIndex(top + v, height));
+
+		if (plane.channel < 0)
+		{
+			for (int u = 0; u < cols; u++)
+				values[2 * u] = line[columns[u]];
+		}
+		else
+		{
+			const QRgb* pixels = reinterpret_cast<const QRgb*>(line);
+
+			for (int u = 0; u < cols; u++)
+				values[2 * u] = (double)((pixels[columns[u]] >> shift) & 0xff);
+		}
+	}
+}
+
+void FftConvolution::store(const FourierTransform::Complex* data, const Plane& plane, bool imaginary, uchar* bits, int bytesPerLine) const
+{
+	const int cols = m_transform.cols();
+
+	const double* values = reinterpret_cast<const double*>(data) + (imaginary ? 1 : 0);
+	const int shift = 16 - 8 * std::max(0, plane.channel);
+
+	for (int j = 0; j < plane.height; j++)
+	{
+		const double* v = values + (size_t)j * cols * 2;
+		uchar* line = bits + (size_t)(plane.y0 + j) * bytesPerLine;
+
+		for (int i = 0; i < plane.width; i++)
+		{
+			//The exact sum is an integer, rounding removes the error of the transforms
+			const int value = m_convolution.normalise((int)std::floor(v[2 * i] + 0.5));
+
+			if (plane.channel < 0)
+				line[plane.x0 + i] = (uchar)value;
+			else if (plane.channel == 0)
+				reinterpret_cast<QRgb*>(line)[plane.x0 + i] = 0xff000000u | ((QRgb)value << shift);
+			else
+				reinterpret_cast<QRgb*>(line)[plane.x0 + i] |= (QRgb)value << shift;
+		}
+	}
+}
+
+void FftConvolution::convolveRows(const QImage& img, int y0, int y1, uchar* bits, int bytesPerLine) const
+{
+	const int width = img.width();
+	const bool gray = (img.format() == QImage::Format_Grayscale8);
+
+	thread_local std::vector<FourierTransform::Complex> block;
+	block.resize(m_spectrum.size());
+
+	//Planes are paired in order, red before green and blue, so the red plane of a pixel is always stored first
+	Plane pending = { 0, 0, 0, 0, 0 };
+	bool hasPending = false;
+
+	auto convolve = [&](const Plane* second) {
+		if (!second)
+		{
+			for (size_t i = 0; i < block.size(); i++)
+				block[i].imag(0.0);
+		}
+
+		m_transform.forward(block.data());
+
+		for (size_t i = 0; i < block.size(); i++)
+		{
+			const double ar = block[i].real();
+			const double ai = block[i].imag();
+			const double br = m_spectrum[i].real();
+			const double bi = m_spectrum[i].imag();
+
+			block[i] = FourierTransform::Complex(ar * br - ai * bi, ar * bi + ai * br);
+		}
+
+		m_transform.inverse(block.data());
+
+		store(block.data(), pending, false, bits, bytesPerLine);
+
+		if (second)
+			store(block.data(), *second, true, bits, bytesPerLine);
+	};
+
+	//Tiles start at y0, the range need not be a whole number of tiles
+	for (int y = y0; y < y1; y += m_tileHeight)
+	{
+		for (int x = 0; x < width; x += m_tileWidth)
+		{
+			for (int c = 0; c < (gray ? 1 : 3); c++)
+			{
+				const Plane plane = { x, y, std::min(m_tileWidth, width - x), std::min(m_tileHeight, y1 - y), gray ? -1 : c };
+
+				if (!hasPending)
+				{
+					load(img, plane, block.data(), false);
+					pending = plane;
+					hasPending = true;
+				}
+				else
+				{
+					load(img, plane, block.data(), true);
+					convolve(&plane);
+					hasPending = false;
+				}
+			}
+		}
+	}
+
+	if (hasPending)
+		convolve(nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,69 @@
+/*
+	Convolution through the fast Fourier transform
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <QImage>
+
+#include "Convolution.h"
+#include "FourierTransform.h"
+
+/*
+	Convolution of working format or gray scale images with a large kernel, as products of Fourier transforms.
+
+	The image is cut into tiles which are convolved independently (overlap-save): every tile transforms the
+	block of input it reads, kernel size - 1 pixels larger than the tile, so memory stays at a few blocks per
+	thread whatever the image size. Tile sizes are picked for the least work per pixel.
+
+	Transforms are computed in double precision and every channel sum is rounded back to the integer the
+	direct pass accumulates, so the result is exactly that of Convolution, borders included. Two channel
+	planes share a complex transform, one as its real and one as its imaginary part.
+*/
+class FftConvolution
+{
+public:
+
+	//Kernels with at least this many weights are convolved faster through transforms, unless they factorise
+	static const int MinTaps = 11 * 11;
+
+	//Returns true if a kernel is faster to convolve through transforms than directly
+	static bool isPreferred(const Convolution& convolution);
+
+	//Prepare the kernel of a convolution, which must outlive this one, for images up to width * height
+	FftConvolution(const Convolution& convolution, int width, int height);
+
+	//Largest output tile, ranges of rows are convolved a row of tiles at a time
+	int tileWidth() const { return m_tileWidth; }
+	int tileHeight() const { return m_tileHeight; }
+
+	//Convolve the rows [y0, y1) of img into the image of the same size and format whose pixels are at bits
+	void convolveRows(const QImage& img, int y0, int y1, uchar* bits, int bytesPerLine) const;
+
+private:
+
+	//Channel plane of a tile, loaded into one half of a transform, channel -1 for gray scale images
+	struct Plane
+	{
+		int x0;
+		int y0;
+		int width;
+		int height;
+		int channel;
+	};
+
+	void load(const QImage& img, const Plane& plane, FourierTransform::Complex* data, bool imaginary) const;
+	void store(const FourierTransform::Complex* data, const Plane& plane, bool imaginary, uchar* bits, int bytesPerLine) const;
+
+	const Convolution& m_convolution;
+
+	int m_tileWidth;
+	int m_tileHeight;
+
+	FourierTransform m_transform;
+
+	//Transform of the mirrored kernel, divided by the size of the transform
+	std::vector<FourierTransform::Complex> m_spectrum;
+};
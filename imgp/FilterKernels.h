@@ -5,7 +5,8 @@
 #pragma once
 
 /*
-	A filter kernel is represented by an n*m matrix
+	A filter kernel is represented by an n*m matrix,
+	stored as n rows of m columns
 */
 template<uint n, uint m>
 struct Kernel
@@ -16,14 +17,30 @@ struct Kernel
 	int* operator[](size_t idx) { return v + (m * idx); }
 };
 
+//Values a kernel reads past the image borders
+enum class Border
+{
+	CLAMP,		//The edge value repeated
+	MIRROR,		//Reflected about the edge value, which is not repeated
+	WRAP,		//From the opposite border, the image tiling the plane
+};
+
+/*
+	A kernel's weights, with how its weighted sums become pixels: divided by the divisor, or by the
+	sum of the weights if it is 0, offset by bias and clamped to [0, 255].
+*/
 struct KernelView
 {
 	const int* v;
 	uint n;
 	uint m;
 
+	int divisor;
+	int bias;
+	Border border;
+
 	KernelView() :
-		v(nullptr), n(0), m(0)
+		v(nullptr), n(0), m(0), divisor(0), bias(0), border(Border::CLAMP)
 	{}
 
 	template<uint n, uint m>
@@ -32,12 +49,18 @@ struct KernelView
 		this->v = k.v;
 		this->n = n;
 		this->m = m;
+		this->divisor = 0;
+		this->bias = 0;
+		this->border = Border::CLAMP;
 	}
 
 	KernelView(const KernelView& other) :
 		v(other.v),
 		n(other.n),
-		m(other.m)
+		m(other.m),
+		divisor(other.divisor),
+		bias(other.bias),
+		border(other.border)
 	{}
 
 	const int* operator[](size_t idx) const { return v + (m * idx); }
@@ -0,0 +1,115 @@
+/*
+	Fast Fourier transforms
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "FourierTransform.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FourierTransform::size(int n)
+{
+	int s = 1;
+
+	while (s < n)
+		s *= 2;
+
+	return s;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::vector<FourierTransform::Complex> twiddles(int n)
+{
+	std::vector<FourierTransform::Complex> w(std::max(1, n / 2));
+
+	for (int k = 0; k < n / 2; k++)
+		w[k] = std::polar(1.0, -2.0 * 3.14159265358979323846 * k / n);
+
+	return w;
+}
+
+/*
+	Radix 2 transform of count sequences of n values side by side, value i of sequence k is data[i * stride + k].
+	Each butterfly runs across all the sequences, so the columns of an image transform a row at a time.
+*/
+static void transformLines(FourierTransform::Complex* data, int n, std::ptrdiff_t stride, int count, const FourierTransform::Complex* twiddles, bool inverse)
+{
+	//Bit reversed order first
+	for (int i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+
+		j ^= bit;
+
+		if (i < j)
+			std::swap_ranges(data + i * stride, data + i * stride + count, data + j * stride);
+	}
+
+	//Real arithmetic, complex products would check for infinities
+	double* const values = reinterpret_cast<double*>(data);
+	const double sign = inverse ? -1.0 : 1.0;
+
+	for (int half = 1; half < n; half *= 2)
+	{
+		const int step = n / (2 * half);
+
+		for (int start = 0; start < n; start += 2 * half)
+		{
+			for (int k = 0; k < half; k++)
+			{
+				const double wr = twiddles[k * step].real();
+				const double wi = twiddles[k * step].imag() * sign;
+
+				double* a = values + 2 * (start + k) * stride;
+				double* b = a + 2 * half * stride;
+
+				for (int l = 0; l < 2 * count; l += 2)
+				{
+					const double tr = b[l] * wr - b[l + 1] * wi;
+					const double ti = b[l] * wi + b[l + 1] * wr;
+
+					b[l] = a[l] - tr;
+					b[l + 1] = a[l + 1] - ti;
+					a[l] += tr;
+					a[l + 1] += ti;
+				}
+			}
+		}
+	}
+}
+
+FourierTransform::FourierTransform(int rows, int cols) :
+	m_rows(rows),
+	m_cols(cols),
+	m_rowTwiddles(twiddles(cols)),
+	m_colTwiddles(twiddles(rows))
+{
+}
+
+void FourierTransform::transform(Complex* data, bool inverse) const
+{
+	for (int y = 0; y < m_rows; y++)
+		transformLines(data + (size_t)y * m_cols, m_cols, 1, 1, m_rowTwiddles.data(), inverse);
+
+	transformLines(data, m_rows, m_cols, m_cols, m_colTwiddles.data(), inverse);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FourierTransform::forward(Complex* data) const
+{
+	transform(data, false);
+}
+
+void FourierTransform::inverse(Complex* data) const
+{
+	transform(data, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,46 @@
+/*
+	Fast Fourier transforms
+*/
+
+#pragma once
+
+#include <complex>
+#include <vector>
+
+/*
+	Two dimensional discrete Fourier transform of a fixed size, in place on rows * cols complex values stored row by row.
+
+	Both sizes are powers of two. The inverse is not scaled, a forward and an inverse transform multiply the values
+	by rows * cols. Transforms can run on several threads at once.
+*/
+class FourierTransform
+{
+public:
+
+	using Complex = std::complex<double>;
+
+	FourierTransform(int rows, int cols);
+
+	FourierTransform(const FourierTransform&) = delete;
+	FourierTransform& operator=(const FourierTransform&) = delete;
+
+	int rows() const { return m_rows; }
+	int cols() const { return m_cols; }
+
+	void forward(Complex* data) const;
+	void inverse(Complex* data) const;
+
+	//Smallest power of two of at least n
+	static int size(int n);
+
+private:
+
+	void transform(Complex* data, bool inverse) const;
+
+	int m_rows;
+	int m_cols;
+
+	//exp(-2 pi i k / n) for k < n / 2 of either size
+	std::vector<Complex> m_rowTwiddles;
+	std::vector<Complex> m_colTwiddles;
+};
@@ -3,186 +3,1417 @@
 */
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
 
 #include "ImagePipeline.h"
+#include "Convolution.h"
+#include "FftConvolution.h"
+#include "Simd.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ImagePipeline::OperationScope
+{
+public:
+
+	//Operations recorded for execute() are timed as part of the chain, the input is the current image by default
+	OperationScope(ImagePipeline& pipeline, const char* name, const QImage* input = nullptr) :
+		m_pipeline(pipeline),
+		m_scope(pipeline.m_deferred ? nullptr : pipeline.m_profiler, name)
+	{
+		if (!m_scope.isActive())
+			return;
+
+		OperationStats& stats = m_scope.stats();
+		stats.pixels = input ? (qint64)input->width() * input->height() : (qint64)pipeline.image().width() * pipeline.image().height();
+		stats.bytes = input ? input->sizeInBytes() : pipeline.imageBytes();
+		stats.allocations = pipeline.m_allocations;
+		stats.depth = pipeline.m_depth++;
+	}
+
+	~OperationScope()
+	{
+		if (!m_scope.isActive())
+			return;
+
+		//Recorded by m_scope once the counters are complete
+		OperationStats& stats = m_scope.stats();
+		stats.bytes += m_pipeline.imageBytes();
+		stats.allocations = m_pipeline.m_allocations - stats.allocations;
+		m_pipeline.m_depth--;
+	}
+
+private:
+
+	ImagePipeline& m_pipeline;
+	ProfileScope m_scope;
+};
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void ImagePipeline::load(const QImage& img)
 {
-	m_src = img;
-	m_a = m_src;
-	m_b = QImage(m_a.width(), m_a.height(), m_a.format());
+	OperationScope scope(*this, "load", &img);
+
+	//Shares img if it is already in the working or gray scale format, buffers are allocated by the first operation
+	m_src = (img.format() == GrayFormat) ? img : img.convertToFormat(WorkingFormat);
+	m_current = -1;
+	m_precise = -1;
+	m_stale = false;
+
+	updatePeakMemory();
+	notify();
+}
+
+ImagePipeline& ImagePipeline::reset()
+{
+	//Both buffers are kept for the next chain
+	m_current = -1;
+	m_precise = -1;
+	m_stale = false;
+	m_graph.clear();
+	return *this;
+}
+
+void ImagePipeline::resetImage()
+{
+	reset();
+	notify();
+}
+
+QImage& ImagePipeline::backBuffer(QImage::Format format)
+{
+	QImage& back = m_buffers[backIndex()];
+	const QImage& front = image();
+
+	//A buffer still shared with a result handed out or cached would be deep copied on the first write, so allocate a fresh one instead
+	if (!back.isDetached() || back.size() != front.size() || back.format() != format)
+	{
+		back = QImage();
+		back = QImage(front.width(), front.height(), format);
+
+		if (format == BinaryFormat)
+			back.setColorTable({ qRgb(0, 0, 0), qRgb(255, 255, 255) });
+
+		m_allocations++;
+		updatePeakMemory();
+	}
+
+	return back;
+}
+
+void ImagePipeline::swapBuffers()
+{
+	m_current = backIndex();
+	m_precise = -1;
+}
+
+void ImagePipeline::updatePeakMemory()
+{
+	//Buffers may share their pixels with each other, only count them once
+	qint64 bytes = m_src.sizeInBytes();
+
+	for (int i = 0; i < 2; i++)
+	{
+		const QImage& b = m_buffers[i];
+
+		if (b.isNull() || b.cacheKey() == m_src.cacheKey() || (i == 1 && b.cacheKey() == m_buffers[0].cacheKey()))
+			continue;
+
+		bytes += b.sizeInBytes();
+	}
+
+	for (int i = 0; i < 2; i++)
+		bytes += m_wordBuffers[i].sizeInBytes() + m_floatBuffers[i].sizeInBytes();
+
+	bytes += m_table.sizeInBytes() + m_planes.sizeInBytes();
+
+	m_peakMemory = std::max(m_peakMemory, bytes);
+}
+
+qint64 ImagePipeline::imageBytes() const
+{
+	qint64 bytes = image().sizeInBytes();
+
+	if (m_precise >= 0)
+		bytes += (m_precision == Precision::WORD) ? m_wordBuffers[m_precise].sizeInBytes() : m_floatBuffers[m_precise].sizeInBytes();
+
+	return bytes;
+}
+
+void ImagePipeline::forEachRowBand(int height, const ThreadPool::RangeFunction& func, int minRows) const
+{
+	//Aim for several bands per thread so work stealing can balance them, but keep bands large enough to be worth scheduling
+	const int minPixels = 16 * 1024;
+	const int grain = std::max({ minRows, minPixels / std::max(1, image().width()), height / (m_pool->threadCount() * 4) });
+
+	m_pool->parallelFor(0, height, grain, [this, &func](int y0, int y1) {
+		//Skip the remaining bands of a cancelled operation
+		if (!isCancelled())
+			func(y0, y1);
+	});
+}
+
+ResultCache::Key ImagePipeline::resultKey(Operation operation, quint64 params) const
+{
+	return { image().cacheKey(), (int)operation, params };
+}
+
+bool ImagePipeline::restoreResult(const ResultCache::Key& key)
+{
+	//Keys are made from the 8-bit image, which does not hold all of a higher precision result
+	if (m_precision != Precision::BYTE)
+		return false;
+
+	const QImage result = m_cache.find(key);
+
+	if (result.isNull())
+		return false;
+
+	//Restored into the output buffer, the buffer it held is released
+	m_buffers[backIndex()] = result;
+	swapBuffers();
+	updatePeakMemory();
+	notify();
+
+	return true;
+}
+
+void ImagePipeline::storeResult(const ResultCache::Key& key)
+{
+	if (!isCancelled() && m_precision == Precision::BYTE)
+		m_cache.insert(key, image());
+}
+
+void ImagePipeline::notify()
+{
+	if (m_notify && !signalsBlocked())
+		imageUpdated(image());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ImagePipeline& ImagePipeline::apply(const PixelFunction& func)
+{
+	return applySpans([&func](const QImage& img, int y, int x0, int x1, QRgb* out) {
+		for (int i = x0; i < x1; i++)
+			out[i - x0] = func(img, QPoint(i, y));
+	});
+}
+
+ImagePipeline& ImagePipeline::applySpans(const SpanFunction& func)
+{
+	//The function cannot be recorded, so bring the image up to date and run it now
+	if (m_deferred)
+	{
+		m_deferred = false;
+		runGraph();
+		m_deferred = true;
+	}
+
+	OperationScope scope(*this, "applySpans");
+
+	if (format() != WorkingFormat)
+		convertTo(WorkingFormat);
+
+	QImage& out = backBuffer();
+	const QImage& in = image();
+
+	//Row pointers are computed from bits() up front, scanLine() may try to detach and is not safe to call concurrently
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+
+	//Every output row depends only on the input image, so the bands match the serial result exactly
+	forEachRowBand(in.height(), [&](int y0, int y1) {
+		for (int j = y0; j < y1; j++)
+		{
+			func(in, j, 0, in.width(), reinterpret_cast<QRgb*>(bits + (size_t)j * stride));
+		}
+	});
+
+	swapBuffers();
+	notify();
+
+	return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+	Helpers for span functions
+*/
+
+//Return a row of a working format image
+static const QRgb* row(const QImage& img, int y)
+{
+	return reinterpret_cast<const QRgb*>(img.constScanLine(y));
+}
+
+//Return row y of an image as working format pixels, expanding gray scale and binary rows into buffer
+static const QRgb* loadRow(const QImage& img, int y, QRgb* buffer)
+{
+	switch (img.format())
+	{
+		case ImagePipeline::GrayFormat:
+			simd::grayToRgb(img.constScanLine(y), buffer, img.width());
+			return buffer;
+
+		case ImagePipeline::BinaryFormat:
+			simd::bitsToRgb(img.constScanLine(y), buffer, img.width());
+			return buffer;
+
+		default:
+			return row(img, y);
+	}
+}
+
+//Thresholds at 128 for packing black and white pixels into bits
+static const uint8_t* midThresholds(int width)
+{
+	thread_local std::vector<uint8_t> thresholds;
+
+	if ((int)thresholds.size() < width)
+		thresholds.assign(width, 128);
+
+	return thresholds.data();
+}
+
+//Store working format pixels into a row of the given format, gray scale and binary pixels lose nothing
+static void storeRow(const QRgb* in, QImage::Format format, uchar* out, int width)
+{
+	switch (format)
+	{
+		case ImagePipeline::GrayFormat:
+			simd::grayscale8(in, out, width);
+			break;
+
+		case ImagePipeline::BinaryFormat:
+			simd::ditherBits(in, out, width, midThresholds(width));
+			break;
+
+		default:
+			if (reinterpret_cast<const uchar*>(in) != out)
+				std::memcpy(out, in, (size_t)width * sizeof(QRgb));
+	}
+}
+
+//Parameters of a filter kernel for result keys
+static quint64 kernelHash(const KernelView& kernel)
+{
+	quint64 params = ResultCache::hash(&kernel.n, sizeof(kernel.n));
+	params = ResultCache::hash(&kernel.m, sizeof(kernel.m), params);
+	params = ResultCache::hash(&kernel.divisor, sizeof(kernel.divisor), params);
+	params = ResultCache::hash(&kernel.bias, sizeof(kernel.bias), params);
+	params = ResultCache::hash(&kernel.border, sizeof(kernel.border), params);
+	return ResultCache::hash(kernel.v, sizeof(int) * kernel.n * kernel.m, params);
+}
+
+//Parameters of a lookup table for result keys, the table entries are its only state
+static quint64 tableHash(const LookupTable& table)
+{
+	return ResultCache::hash(&table, sizeof(table));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ImagePipeline::applyRows(QImage::Format format, const RowFunction& func)
+{
+	QImage& out = backBuffer(format);
+	const QImage& in = image();
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+
+	forEachRowBand(in.height(), [&](int y0, int y1) {
+		for (int j = y0; j < y1; j++)
+			func(in, j, bits + (size_t)j * stride);
+	});
+
+	swapBuffers();
+}
+
+void ImagePipeline::convertTo(QImage::Format format)
+{
+	OperationScope scope(*this, "convertTo");
+
+	applyRows(format, [format](const QImage& img, int y, uchar* out) {
+		thread_local std::vector<QRgb> buffer;
+		buffer.resize(img.width());
+		storeRow(loadRow(img, y, buffer.data()), format, out, img.width());
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Higher precision
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+	Kernels of the high precision path for runPrecise(), callable with the images of every pixel type and with 8-bit ones
+*/
+
+struct GrayscaleKernel
+{
+	template<typename Image, typename T>
+	void operator()(const Image& in, PreciseImage<T>& out, int y0, int y1) const
+	{
+		precise::grayscale(in, out, y0, y1);
+	}
+};
+
+struct CurveKernel
+{
+	explicit CurveKernel(const PreciseCurve& curve) :
+		segments(curve.segments())
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			words[c] = curve.samples(c, ChannelTraits<uint16_t>::max());
+			floats[c] = curve.samples(c, ChannelTraits<float>::max());
+			wordTables[c] = curve.table(c, ChannelTraits<uint16_t>::max());
+			floatTables[c] = curve.table(c, ChannelTraits<float>::max());
+		}
+	}
+
+	//Plain 8-bit images only have 256 values to map
+	void operator()(const ByteImage<uint16_t>& in, PreciseImage<uint16_t>& out, int y0, int y1) const
+	{
+		if (in.isPlain())
+			precise::lookup(in, out, wordTables, y0, y1);
+		else
+			precise::lookup(in, out, words, segments, y0, y1);
+	}
+
+	void operator()(const ByteImage<float>& in, PreciseImage<float>& out, int y0, int y1) const
+	{
+		if (in.isPlain())
+			precise::lookup(in, out, floatTables, y0, y1);
+		else
+			precise::lookup(in, out, floats, segments, y0, y1);
+	}
+
+	void operator()(const PreciseImage<uint16_t>& in, PreciseImage<uint16_t>& out, int y0, int y1) const
+	{
+		precise::lookup(in, out, words, segments, y0, y1);
+	}
+
+	void operator()(const PreciseImage<float>& in, PreciseImage<float>& out, int y0, int y1) const
+	{
+		precise::lookup(in, out, floats, segments, y0, y1);
+	}
+
+	int segments;
+	std::vector<float> words[3];
+	std::vector<float> floats[3];
+	std::vector<float> wordTables[3];
+	std::vector<float> floatTables[3];
+};
+
+struct ConvolutionKernel
+{
+	template<typename Image, typename T>
+	void operator()(const Image& in, PreciseImage<T>& out, int y0, int y1) const
+	{
+		precise::convolve(in, out, convolution, y0, y1);
+	}
+
+	const Convolution& convolution;
+};
+
+void ImagePipeline::setPrecision(Precision precision)
+{
+	if (precision == m_precision)
+		return;
+
+	//The current image is kept in 8 bits, and the buffers of the previous precision released
+	quantise();
+	m_precise = -1;
+
+	for (int i = 0; i < 2; i++)
+	{
+		m_wordBuffers[i] = PreciseImage<uint16_t>();
+		m_floatBuffers[i] = PreciseImage<float>();
+	}
+
+	m_precision = precision;
+}
+
+bool ImagePipeline::isGray() const
+{
+	if (m_precise == Mapped)
+		return m_mappedGray || m_tableChannels == 1;
+
+	if (m_precise < 0)
+		return format() != WorkingFormat;
+
+	return (m_precision == Precision::WORD ? m_wordBuffers[m_precise].channels() : m_floatBuffers[m_precise].channels()) == 1;
+}
+
+template<typename Kernel>
+void ImagePipeline::runPrecise(int channels, const Kernel& kernel)
+{
+	if (m_precision == Precision::WORD)
+		runPrecise(m_wordBuffers, channels, kernel);
+	else
+		runPrecise(m_floatBuffers, channels, kernel);
+}
+
+template<typename T, typename Kernel>
+void ImagePipeline::runPrecise(PreciseImage<T>* buffers, int channels, const Kernel& kernel)
+{
+	//The first operation reads the 8-bit image as it goes, the following ones pass on their precise results
+	const int precise = (m_precise < 0) ? 0 : 1 - m_precise;
+
+	if (m_precise == Mapped)
+		runPrecise(mappedImage<T>(), buffers[precise], channels, kernel);
+	else if (m_precise < 0)
+		runPrecise(ByteImage<T>(image()), buffers[precise], channels, kernel);
+	else
+		runPrecise(buffers[m_precise], buffers[precise], channels, kernel);
+
+	if (!m_stale)
+		swapBuffers();
+
+	m_precise = precise;
+	updatePeakMemory();
+}
+
+template<typename Image, typename T, typename Kernel>
+void ImagePipeline::runPrecise(const Image& in, PreciseImage<T>& out, int channels, const Kernel& kernel)
+{
+	if (out.reset(in.width(), in.height(), channels ? channels : in.channels()))
+		m_allocations++;
+
+	//Rows are made and rounded in cache, then stored past it as the next operation only reads them after this one
+	uchar* bits = nullptr;
+	int stride = 0;
+
+	if (m_quantise)
+	{
+		QImage& rounded = backBuffer(out.channels() == 1 ? GrayFormat : WorkingFormat);
+		bits = rounded.bits();
+		stride = rounded.bytesPerLine();
+	}
+
+	forEachRowBand(in.height(), [&](int y0, int y1) {
+		thread_local PreciseImage<T> row;
+		row.reset(out.width(), 1, out.channels());
+
+		for (int y = y0; y < y1; y++)
+		{
+			kernel(in, row, y, y + 1);
+
+			if (bits)
+				row.writeRows(bits + (size_t)y * stride, stride, 0, 1);
+
+			out.storeRows(row, y);
+		}
+
+		simd::streamFence();
+	});
+
+	m_stale = !bits;
+}
+
+void ImagePipeline::quantise()
+{
+	if (!m_stale)
+		return;
+
+	OperationScope scope(*this, "quantise");
+
+	if (m_precise == Mapped)
+		quantiseMapped();
+	else if (m_precision == Precision::WORD)
+		quantise(m_wordBuffers[m_precise]);
+	else
+		quantise(m_floatBuffers[m_precise]);
+}
+
+template<typename Image>
+void ImagePipeline::quantise(const Image& img)
+{
+	QImage& out = backBuffer(img.channels() == 1 ? GrayFormat : WorkingFormat);
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+
+	forEachRowBand(img.height(), [&](int y0, int y1) {
+		img.writeRows(bits, stride, y0, y1);
+	});
+
+	//Both images hold the same result, the precise one stays current for the next operation
+	const int precise = m_precise;
+	swapBuffers();
+	m_precise = precise;
+	m_stale = false;
+}
+
+void ImagePipeline::quantiseMapped()
+{
+	//Gray values are computed from the channels, tables are only rounded
+	if (m_mappedGray)
+	{
+		if (m_precision == Precision::WORD)
+			quantise(mappedImage<uint16_t>());
+		else
+			quantise(mappedImage<float>());
+
+		return;
+	}
+
+	const float scale = 255 / ((m_precision == Precision::WORD) ? ChannelTraits<uint16_t>::max() : ChannelTraits<float>::max());
+
+	//Rounded like the rows they stand for, the 8-bit image is then only looked up
+	uchar values[3][256];
+
+	for (int c = 0; c < m_tableChannels; c++)
+		simd::packGray(m_tables[c].data(), values[c], 256, scale);
+
+	QImage& out = backBuffer(m_tableChannels == 1 ? GrayFormat : WorkingFormat);
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+	const int width = m_src.width();
+
+	if (m_tableChannels == 1)
+	{
+		forEachRowBand(m_src.height(), [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++)
+				simd::lookup(m_src.constScanLine(y), bits + (size_t)y * stride, width, values[0]);
+		});
+	}
+	else
+	{
+		simd::ChannelTable table;
+
+		for (int v = 0; v < 256; v++)
+		{
+			table.r[v] = (uint32_t)values[0][v] << 16;
+			table.g[v] = (uint32_t)values[1][v] << 8;
+			table.b[v] = values[2][v];
+		}
+
+		forEachRowBand(m_src.height(), [&](int y0, int y1) {
+			thread_local std::vector<QRgb> buffer;
+			buffer.resize(width);
+
+			for (int y = y0; y < y1; y++)
+				simd::lookup(loadRow(m_src, y, buffer.data()), reinterpret_cast<QRgb*>(bits + (size_t)y * stride), width, table);
+		});
+	}
+
+	swapBuffers();
+	m_precise = Mapped;
+	m_stale = false;
+}
+
+void ImagePipeline::applyCurve(const PreciseCurve& curve)
+{
+	//Gray values stay gray if every channel maps them the same way
+	const int channels = (curve.isGray() && isGray()) ? 1 : 3;
+
+	//The loaded image only has 256 values per channel, which the curve maps instead of its pixels
+	if (m_precise == Mapped ? !m_mappedGray : (m_precise < 0 && m_current < 0))
+		mapTables(channels, curve);
+	else
+		runPrecise(channels, CurveKernel(curve));
+
+	notify();
+}
+
+template<typename T>
+ByteImage<T> ImagePipeline::mappedImage() const
+{
+	return ByteImage<T>(m_src, m_tableChannels ? m_tables : nullptr, m_tableChannels, m_mappedGray);
+}
+
+void ImagePipeline::mapTables(int channels, const PreciseCurve& curve)
+{
+	const bool words = (m_precision == Precision::WORD);
+	const float max = words ? ChannelTraits<uint16_t>::max() : ChannelTraits<float>::max();
+
+	std::vector<float> tables[3];
+
+	for (int c = 0; c < channels; c++)
+	{
+		//The values of earlier curves are mapped on, as the image they stand for would be
+		if (m_precise == Mapped)
+			tables[c] = curve.map(c, m_tables[std::min(c, m_tableChannels - 1)], max);
+		else
+			tables[c] = curve.table(c, max);
+
+		//16-bit images hold rounded values
+		if (words)
+		{
+			uint16_t rounded[256];
+			simd::floatToWords(tables[c].data(), rounded, 256);
+			simd::wordsToFloat(rounded, tables[c].data(), 256);
+		}
+	}
+
+	for (int c = 0; c < 3; c++)
+		m_tables[c].swap(tables[c]);
+
+	m_tableChannels = channels;
+	m_mappedGray = false;
+
+	setMapped();
+}
+
+void ImagePipeline::mapGray()
+{
+	//Only tables of earlier curves are kept
+	if (m_precise != Mapped)
+		m_tableChannels = 0;
+
+	m_mappedGray = true;
+
+	setMapped();
+}
+
+void ImagePipeline::setMapped()
+{
+	m_precise = Mapped;
+	m_stale = true;
+
+	if (m_quantise)
+		quantiseMapped();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ImagePipeline& ImagePipeline::makeGrayscale()
+{
+	if (m_deferred)
+	{
+		Node node = { Operation::GRAYSCALE, 0, [](ImagePipeline& p) { p.makeGrayscale(); } };
+		node.point = [](const QRgb* in, QRgb* out, int count) { simd::grayscale(in, out, count); };
+		return record(std::move(node));
+	}
+
+	OperationScope scope(*this, "makeGrayscale");
+
+	//Gray scale and binary images are gray already
+	if (isGray())
+	{
+		notify();
+		return *this;
+	}
+
+	if (m_precision != Precision::BYTE)
+	{
+		//The gray values of the loaded image are computed again wherever they are read, instead of being stored
+		if (m_precise == Mapped || (m_precise < 0 && m_current < 0))
+			mapGray();
+		else
+			runPrecise(1, GrayscaleKernel());
+
+		notify();
+		return *this;
+	}
+
+	const ResultCache::Key key = resultKey(Operation::GRAYSCALE);
+
+	if (restoreResult(key))
+		return *this;
+
+	applyRows(GrayFormat, [](const QImage& img, int y, uchar* out) {
+		simd::grayscale8(row(img, y), out, img.width());
+	});
+
+	notify();
+
+	storeResult(key);
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::setGamma(float gamma)
+{
+	OperationScope scope(*this, "setGamma");
+
+	if (gamma != m_gamma)
+	{
+		m_gammaTable = LookupTable::gamma(gamma);
+		m_gammaCurve.reset();
+		m_gamma = gamma;
+	}
+
+	if (m_precision == Precision::BYTE)
+		return applyLookup(m_gammaTable);
+
+	//At a higher precision the power function is sampled between the 8-bit steps, instead of through the table
+	if (m_deferred)
+	{
+		Node node = { Operation::LOOKUP, tableHash(m_gammaTable), [gamma](ImagePipeline& p) { p.setGamma(gamma); } };
+		node.table = m_gammaTable;
+		return record(std::move(node));
+	}
+
+	if (!m_gammaCurve)
+		m_gammaCurve.reset(new PreciseCurve(PreciseCurve::gamma(gamma)));
+
+	applyCurve(*m_gammaCurve);
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::applyLookup(const LookupTable& table)
+{
+	if (m_deferred)
+	{
+		Node node = { Operation::LOOKUP, tableHash(table), [table](ImagePipeline& p) { p.applyLookup(table); } };
+		node.table = table;
+		return record(std::move(node));
+	}
+
+	OperationScope scope(*this, "applyLookup");
+
+	if (m_precision != Precision::BYTE)
+	{
+		applyCurve(PreciseCurve(table));
+		return *this;
+	}
+
+	const ResultCache::Key key = resultKey(Operation::LOOKUP, tableHash(table));
+
+	if (restoreResult(key))
+		return *this;
+
+	//Gray values stay gray if every channel maps them the same way
+	if (format() != WorkingFormat && table.isGray())
+	{
+		if (format() == BinaryFormat)
+			convertTo(GrayFormat);
+
+		applyRows(GrayFormat, [&table](const QImage& img, int y, uchar* out) {
+			simd::lookup(img.constScanLine(y), out, img.width(), table.grayTable());
+		});
+
+		notify();
+	}
+	else
+	{
+		const simd::ChannelTable channels = table.channelTable();
+
+		applySpans([&channels](const QImage& img, int y, int x0, int x1, QRgb* out) {
+			simd::lookup(row(img, y) + x0, out, x1 - x0, channels);
+		});
+	}
+
+	storeResult(key);
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::applyFilter(const KernelView& kernel)
+{
+	if (m_deferred)
+	{
+		//The kernel only has to outlive this call, the node keeps its own weights
+		const std::vector<int> weights(kernel.v, kernel.v + kernel.n * kernel.m);
+		const KernelView view = kernel;
+
+		Node node = { Operation::FILTER, kernelHash(kernel), [weights, view](ImagePipeline& p) {
+			KernelView k = view;
+			k.v = weights.data();
+			p.applyFilter(k);
+		} };
+
+		//Kernels convolved through transforms run on whole images, not spans, and bands only clamp their borders like images
+		auto convolution = std::make_shared<const Convolution>(kernel);
+
+		if (!FftConvolution::isPreferred(*convolution) && kernel.border == Border::CLAMP)
+			node.span = [convolution](const QImage& img, int y, int x0, int x1, QRgb* out) { convolution->convolveSpan(img, y, x0, x1, out); };
+
+		node.halo = (int)kernel.n / 2;
+		return record(std::move(node));
+	}
+
+	OperationScope scope(*this, "applyFilter");
+
+	//Binary images are read in as gray scale ones
+	if (m_precision != Precision::BYTE)
+	{
+		const Convolution convolution(kernel);
+		runPrecise(0, ConvolutionKernel{ convolution });
+		notify();
+		return *this;
+	}
+
+	const ResultCache::Key key = resultKey(Operation::FILTER, kernelHash(kernel));
+
+	if (restoreResult(key))
+		return *this;
+
+	const Convolution convolution(kernel);
+
+	if (FftConvolution::isPreferred(convolution))
+	{
+		//Binary images are filtered as gray scale ones
+		if (format() == BinaryFormat)
+			convertTo(GrayFormat);
+
+		const QImage& in = image();
+		const FftConvolution transform(convolution, in.width(), in.height());
+
+		QImage& out = backBuffer(format());
+		uchar* const bits = out.bits();
+		const int bytesPerLine = out.bytesPerLine();
+
+		//Bands of at least a tile, a shorter band would transform a whole block for a few rows
+		forEachRowBand(in.height(), [&](int y0, int y1) {
+			transform.convolveRows(in, y0, y1, bits, bytesPerLine);
+		}, transform.tileHeight());
+
+		swapBuffers();
+		notify();
+	}
+	else if (format() == WorkingFormat)
+	{
+		//Apply filter kernel to each pixel
+		applySpans([&convolution](const QImage& img, int y, int x0, int x1, QRgb* out) {
+			convolution.convolveSpan(img, y, x0, x1, out);
+		});
+	}
+	else
+	{
+		//Binary images are filtered as gray scale ones
+		if (format() == BinaryFormat)
+			convertTo(GrayFormat);
+
+		applyRows(GrayFormat, [&convolution](const QImage& img, int y, uchar* out) {
+			convolution.convolveSpan(img, y, 0, img.width(), out);
+		});
+
+		notify();
+	}
+
+	storeResult(key);
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::applyGaussianBlur(float sigma)
+{
+	const RecursiveGaussian gaussian(sigma);
+	sigma = gaussian.sigma();
+
+	const quint64 params = ResultCache::hash(&sigma, sizeof(sigma));
+
+	if (m_deferred)
+		return record({ Operation::GAUSSIAN_BLUR, params, [sigma](ImagePipeline& p) { p.applyGaussianBlur(sigma); } });
+
+	OperationScope scope(*this, "applyGaussianBlur");
+
+	const ResultCache::Key key = resultKey(Operation::GAUSSIAN_BLUR, params);
+
+	if (restoreResult(key))
+		return *this;
+
+	//Binary images are blurred as gray scale ones
+	if (format() == BinaryFormat)
+		convertTo(GrayFormat);
+
+	const QImage& in = image();
+	const int width = in.width();
+	const int height = in.height();
+
+	if (m_planes.reset(width, height, format() == WorkingFormat ? 3 : 1))
+		m_allocations++;
+
+	//Rows are read in and blurred while they are in cache, then strips of columns are blurred in parallel
+	forEachRowBand(height, [&](int y0, int y1) {
+		m_planes.readRows(in, y0, y1);
+
+		for (int c = 0; c < m_planes.channels(); c++)
+			gaussian.blurRows(m_planes.line(c, 0), width, width, y0, y1);
+	});
+
+	forEachRowBand(width, [&](int x0, int x1) {
+		for (int c = 0; c < m_planes.channels(); c++)
+			gaussian.blurColumns(m_planes.line(c, 0), height, width, x0, x1);
+	}, 64);
+
+	QImage& out = backBuffer(format());
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+
+	forEachRowBand(height, [&](int y0, int y1) {
+		m_planes.writeRows(bits, stride, y0, y1);
+	});
+
+	swapBuffers();
+	updatePeakMemory();
+	notify();
+
+	storeResult(key);
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::applyNonLinearFilter()
+{
+	return applyRankFilter(RankFilter::median(1));
+}
+
+ImagePipeline& ImagePipeline::applyRankFilter(const RankFilter& filter)
+{
+	quint64 params = ResultCache::hash(&filter, sizeof(filter));
+
+	if (m_deferred)
+		return record({ Operation::RANK_FILTER, params, [filter](ImagePipeline& p) { p.applyRankFilter(filter); } });
+
+	OperationScope scope(*this, "applyRankFilter");
+
+	const ResultCache::Key key = resultKey(Operation::RANK_FILTER, params);
+
+	if (restoreResult(key))
+		return *this;
+
+	//Binary images are ranked as gray scale ones
+	if (format() == BinaryFormat)
+		convertTo(GrayFormat);
+
+	QImage& out = backBuffer(format());
+	const QImage& in = image();
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+
+	//Each band sets up its histograms from the rows around it, tall bands keep that overhead small
+	forEachRowBand(in.height(), [&](int y0, int y1) {
+		filter.filterRows(in, y0, y1, bits + (size_t)y0 * stride, stride);
+	}, 8 * filter.radius());
+
+	swapBuffers();
+	notify();
+
+	storeResult(key);
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::applyThresholding()
+{
+	if (m_deferred)
+	{
+		Node node = { Operation::THRESHOLD, 0, [](ImagePipeline& p) { p.applyThresholding(); } };
+		node.point = [](const QRgb* in, QRgb* out, int count) { simd::threshold(in, out, count); };
+		return record(std::move(node));
+	}
+
+	OperationScope scope(*this, "applyThresholding");
+
+	//Binary images are thresholded already
+	if (format() == BinaryFormat)
+	{
+		notify();
+		return *this;
+	}
+
+	const ResultCache::Key key = resultKey(Operation::THRESHOLD);
+
+	if (restoreResult(key))
+		return *this;
+
+	//Colour images are thresholded on their blue channel, like the working format kernel
+	if (format() == GrayFormat)
+	{
+		applyRows(BinaryFormat, [](const QImage& img, int y, uchar* out) {
+			simd::ditherBits(img.constScanLine(y), out, img.width(), midThresholds(img.width()));
+		});
+	}
+	else
+	{
+		applyRows(BinaryFormat, [](const QImage& img, int y, uchar* out) {
+			simd::ditherBits(row(img, y), out, img.width(), midThresholds(img.width()));
+		});
+	}
+
+	notify();
+
+	storeResult(key);
+	return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Windowed operations
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ImagePipeline::buildTable(const QImage& img, int c, int radius, bool squares)
+{
+	if (m_table.reset(img, c, radius, squares))
+		m_allocations++;
+
+	//Rows are summed in parallel, then columns in parallel strips
+	forEachRowBand(m_table.rows(), [&](int j0, int j1) {
+		m_table.sumRows(img, j0, j1);
+	});
+
+	forEachRowBand(m_table.columns(), [&](int i0, int i1) {
+		m_table.sumColumns(i0, i1);
+	}, 256);
+
+	updatePeakMemory();
+}
+
+void ImagePipeline::applyWindowed(int radius, bool deviation)
+{
+	//Binary images are averaged as gray scale ones
+	if (format() == BinaryFormat)
+		convertTo(GrayFormat);
+
+	QImage& out = backBuffer(format());
+	const QImage& in = image();
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+	const int width = in.width();
+
+	//One channel at a time, so only one table is held
+	const int channels = (in.format() == WorkingFormat) ? 3 : 1;
+
+	auto windowRow = [this, deviation](int y, uchar* out) {
+		if (deviation)
+			m_table.deviationRow(y, out);
+		else
+			m_table.meanRow(y, out);
+	};
+
+	for (int c = 0; c < channels; c++)
+	{
+		buildTable(in, c, radius, deviation);
+
+		forEachRowBand(in.height(), [&](int y0, int y1) {
+			thread_local std::vector<uchar> values;
+			values.resize(width);
+
+			for (int y = y0; y < y1; y++)
+			{
+				uchar* line = bits + (size_t)y * stride;
+
+				if (channels == 1)
+				{
+					windowRow(y, line);
+					continue;
+				}
+
+				windowRow(y, values.data());
+
+				//Channels are merged into the opaque output pixels, red first
+				QRgb* pixels = reinterpret_cast<QRgb*>(line);
+				const int shift = 16 - 8 * c;
+
+				if (c == 0)
+				{
+					for (int x = 0; x < width; x++)
+						pixels[x] = 0xff000000u | ((QRgb)values[x] << shift);
+				}
+				else
+				{
+					for (int x = 0; x < width; x++)
+						pixels[x] |= (QRgb)values[x] << shift;
+				}
+			}
+		});
+	}
 
-	imageUpdated(QPixmap::fromImage(m_a));
+	swapBuffers();
+	notify();
 }
 
-void ImagePipeline::resetImage()
+ImagePipeline& ImagePipeline::applyBoxBlur(int radius)
 {
-	m_a = m_src;
-	imageUpdated(QPixmap::fromImage(m_a));
-}
+	radius = std::max(1, std::min(SummedAreaTable::MaxRadius, radius));
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
+	if (m_deferred)
+		return record({ Operation::BOX_BLUR, (quint64)radius, [radius](ImagePipeline& p) { p.applyBoxBlur(radius); } });
 
-ImagePipeline& ImagePipeline::apply(const PixelFunction& func)
+	OperationScope scope(*this, "applyBoxBlur");
+
+	const ResultCache::Key key = resultKey(Operation::BOX_BLUR, (quint64)radius);
+
+	if (restoreResult(key))
+		return *this;
+
+	applyWindowed(radius, false);
+
+	storeResult(key);
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::applyLocalDeviation(int radius)
 {
-	for (int j = 0; j < m_a.height(); j++)
-	{
-		for (int i = 0; i < m_a.width(); i++)
-		{
-			QPoint coord(i, j);
+	radius = std::max(1, std::min(SummedAreaTable::MaxSquaresRadius, radius));
 
-			m_b.setPixel(coord, func((const QImage&)m_a, coord));
-		}
-	}
+	if (m_deferred)
+		return record({ Operation::LOCAL_DEVIATION, (quint64)radius, [radius](ImagePipeline& p) { p.applyLocalDeviation(radius); } });
+
+	OperationScope scope(*this, "applyLocalDeviation");
+
+	const ResultCache::Key key = resultKey(Operation::LOCAL_DEVIATION, (quint64)radius);
 
-	//Swap image buffers
-	m_a.swap(m_b);
+	if (restoreResult(key))
+		return *this;
 
-	imageUpdated(QPixmap::fromImage(m_a));
+	applyWindowed(radius, true);
 
+	storeResult(key);
 	return *this;
 }
 
-ImagePipeline& ImagePipeline::makeGrayscale()
+ImagePipeline& ImagePipeline::applyAdaptiveThresholding(int radius, int offset)
 {
-	return apply([](auto img, auto coord) {
-		QColor c = qGray(img.pixel(coord));
-		return qRgb(c.blue(), c.blue(), c.blue());
+	radius = std::max(1, std::min(SummedAreaTable::MaxRadius, radius));
+
+	const quint64 params = ((quint64)radius << 32) | (quint32)offset;
+
+	if (m_deferred)
+		return record({ Operation::ADAPTIVE_THRESHOLD, params, [radius, offset](ImagePipeline& p) { p.applyAdaptiveThresholding(radius, offset); } });
+
+	OperationScope scope(*this, "applyAdaptiveThresholding");
+
+	//Binary images are thresholded already
+	if (format() == BinaryFormat)
+	{
+		notify();
+		return *this;
+	}
+
+	const ResultCache::Key key = resultKey(Operation::ADAPTIVE_THRESHOLD, params);
+
+	if (restoreResult(key))
+		return *this;
+
+	//The gray scale image is only an intermediate stage
+	const bool notifying = m_notify;
+	m_notify = false;
+	makeGrayscale();
+	quantise();
+	m_notify = notifying;
+
+	buildTable(image(), 0, radius, false);
+
+	QImage& out = backBuffer(BinaryFormat);
+	const QImage& in = image();
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+	const int width = in.width();
+
+	//Every row is compared against the means of its windows, less the offset
+	forEachRowBand(in.height(), [&](int y0, int y1) {
+		thread_local std::vector<uint8_t> thresholds;
+		thresholds.resize(width);
+
+		for (int y = y0; y < y1; y++)
+		{
+			m_table.meanRow(y, thresholds.data());
+
+			for (int x = 0; x < width; x++)
+				thresholds[x] = (uint8_t)std::max(0, std::min(255, thresholds[x] - offset));
+
+			simd::ditherBits(in.constScanLine(y), bits + (size_t)y * stride, width, thresholds.data());
+		}
 	});
+
+	swapBuffers();
+	notify();
+
+	storeResult(key);
+	return *this;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int setgamma(int value, float gamma)
+//Add the gray values of a row to per column sums
+static void addColumns(const uchar* in, int width, int* sums)
 {
-	return 255 * powf((float)value / 255, 1.0f / gamma);
+	for (int i = 0; i < width; i++)
+		sums[i] += in[i];
 }
 
-ImagePipeline& ImagePipeline::setGamma(float gamma)
+//Average gray value of every n*h region from column sums, repeated over the region's columns
+static void regionAverages(const int* sums, int width, int n, int h, uchar* out)
 {
-	return apply([gamma](auto img, auto coord) {
-		QColor c(img.pixel(coord));
-		c.setRed(setgamma(c.red(), gamma));
-		c.setBlue(setgamma(c.blue(), gamma));
-		c.setGreen(setgamma(c.green(), gamma));
-		return c.rgb();
-	});
+	for (int i = 0; i < width; i += n)
+	{
+		//Regions on the right edge may be clipped
+		const int w = std::min(n, width - i);
+
+		int total = 0;
+
+		for (int x = 0; x < w; x++)
+			total += sums[i + x];
+
+		const int average = total / (w * h);
+
+		for (int x = 0; x < w; x++)
+			out[i + x] = (uchar)average;
+	}
 }
 
-ImagePipeline& ImagePipeline::applyFilter(const KernelView& kernel)
+/*
+	Floyd-Steinberg error diffusion of rows [0, height) of a gray scale image into binary rows, split across a pool.
+
+	Pixel (x, y) only receives error from (x - 1, y) and from x - 1 to x + 1 on row y - 1, so rows run in a
+	staggered wavefront: each row follows the row above it at least two pixels behind. Rows are claimed in
+	order by as many workers as the pool has threads, a worker only ever waits on a row claimed before its
+	own, which is being processed by a running worker.
+
+	Error to the next row goes to a ring of int16 rows instead of the image. Diffused values wrap around
+	modulo 256, with the same edge rules as before (no error on row 0 or into column 0), so the result is
+	bit-identical to the serial version.
+*/
+static void floydSteinberg(const QImage& img, uchar* bits, int stride, ThreadPool& pool, const std::atomic<bool>* cancelled)
 {
-	//Apply 3x3 filter kernel to each pixel
-	return apply([&kernel](auto img, auto coord) {
+	const int width = img.width();
+	const int height = img.height();
 
-		int newchannels[] = { 0, 0, 0 };
+	//Pixels processed between progress updates, a whole number of bytes of the binary rows
+	const int block = 64;
 
-		//For each colour channel of the input image
-		for (int c = 0; c < 3; c++)
+	const int workers = std::max(1, std::min(pool.threadCount(), height));
+
+	//A row writes the error row of the next one, which the row ring rows above last read
+	const int ring = workers + 2;
+	std::vector<qint16> errors((size_t)ring * width);
+
+	//Pixels of each row done so far
+	std::unique_ptr<std::atomic<int>[]> progress(new std::atomic<int>[height]);
+
+	for (int j = 0; j < height; j++)
+		progress[j].store(0, std::memory_order_relaxed);
+
+	std::atomic<int> nextRow(0);
+
+	//Wait until row j has processed count pixels
+	auto waitFor = [&](int j, int count) {
+		for (int spins = 0; progress[j].load(std::memory_order_acquire) < count; spins++)
 		{
-			int accum = 0;
-			int factor = 0;
+			if (spins > 64)
+				std::this_thread::yield();
+		}
+	};
 
-			//Apply kernel
-			for (uint y = 0; y < kernel.m; y++)
+	pool.parallelFor(0, workers, 1, [&](int, int) {
+		for (int j = nextRow++; j < height; j = nextRow++)
+		{
+			//A cancelled row still reports progress, so the rows below it do not wait forever
+			if (cancelled && cancelled->load(std::memory_order_relaxed))
 			{
-				for (uint x = 0; x < kernel.n; x++)
-				{
-					QPoint newcoord = coord + QPoint(x - (kernel.n >> 1), y - (kernel.m >> 1));
+				progress[j].store(width, std::memory_order_release);
+				continue;
+			}
 
-					newcoord.setX(std::max(0, std::min(img.size().width() - 1, newcoord.x())));
-					newcoord.setY(std::max(0, std::min(img.size().height() - 1, newcoord.y())));
+			const uchar* in = img.constScanLine(j);
+			uchar* dst = bits + (size_t)j * stride;
 
-					//Read input image
-					const QColor colour = img.pixel(newcoord);
-					const int channels[] = { colour.red(), colour.green(), colour.blue() };
+			std::fill(dst, dst + (width + 7) / 8, 0);
 
-					const int weight = kernel[y][x];
+			const qint16* incoming = errors.data() + (size_t)(j % ring) * width;
+			qint16* outgoing = errors.data() + (size_t)((j + 1) % ring) * width;
 
-					accum += channels[c] * weight;
-					factor += weight;
-				}
+			//The outgoing row was last read by row j + 1 - ring
+			const bool last = (j + 1 == height);
+
+			if (!last)
+			{
+				if (j + 1 - ring >= 0)
+					waitFor(j + 1 - ring, width);
+
+				std::fill(outgoing, outgoing + width, 0);
 			}
 
-			accum /= std::max(factor, 1);
-			newchannels[c] = std::min(std::max(accum, 0), 255);
-		}
+			//Error passed along the row, row 0 receives none
+			int carry = 0;
 
-		return QColor(newchannels[0], newchannels[1], newchannels[2]).rgb();
-	});
-}
+			for (int x0 = 0; x0 < width; x0 += block)
+			{
+				const int x1 = std::min(width, x0 + block);
 
-ImagePipeline& ImagePipeline::applyNonLinearFilter()
-{
-	return apply([](auto img, auto coord) {
+				//Errors into this block come from up to one pixel past it on the row above
+				if (j > 0)
+					waitFor(j - 1, std::min(width, x1 + 1));
 
-		Kernel<3, 3> k;
+				for (int i = x0; i < x1; i++)
+				{
+					const int curp = (in[i] + (j > 0 ? incoming[i] + carry : 0)) & 0xff;
+					const int newp = (curp < 128) ? 0 : 255;
+					const int error = curp - newp;
 
-		for (uint y = 0; y < 3; y++)
-		{
-			for (uint x = 0; x < 3; x++)
-			{
-				QPoint newcoord = coord + QPoint(x - 1, y - 1);
+					if (newp)
+						dst[i / 8] |= 1 << (i % 8);
+
+					/*
+						---|x|a|--
+						-|b|g|d|--
+						----------
 
-				newcoord.setX(std::max(0, std::min(img.size().width() - 1, newcoord.x())));
-				newcoord.setY(std::max(0, std::min(img.size().height() - 1, newcoord.y())));
+						Pass error of current pixel onto neighbouring pixels
+					*/
+					carry = error * 7 / 16; //alpha
+
+					if (!last)
+					{
+						if (i >= 2)
+							outgoing[i - 1] += (qint16)(error * 3 / 16); //beta
+						if (i >= 1)
+							outgoing[i] += (qint16)(error * 5 / 16); //gamma
+						if (i + 1 < width)
+							outgoing[i + 1] += (qint16)(error * 1 / 16); //delta
+					}
+				}
 
-				//Read input image
-				k[y][x] = img.pixel(newcoord);
+				progress[j].store(x1, std::memory_order_release);
 			}
 		}
-
-		std::sort(std::begin(k.v), std::end(k.v));
-		return k.v[5];
 	});
 }
 
-ImagePipeline& ImagePipeline::applyThresholding()
+ImagePipeline& ImagePipeline::applyDithering(Dithering mode)
 {
-	return apply([](auto img, auto coord) {
+	return applyDithering(mode, ThresholdMap::bayer(4));
+}
 
-		//Make grey
-		uint8_t c = img.pixel(coord);
-		
-		c = (c < 128) ? 0 : 255;
+ImagePipeline& ImagePipeline::applyDithering(Dithering mode, const ThresholdMap& map)
+{
+	//Only ordered and pattern dithering depend on the map
+	const bool thresholded = (mode == Dithering::ORDERED || mode == Dithering::PATTERN);
+	const quint64 params = thresholded ? ResultCache::hash(&mode, sizeof(mode), map.hash()) : (quint64)mode;
 
-		return qRgb(c, c, c);
-	});
-}
+	if (m_deferred)
+		return record({ Operation::DITHERING, params, [mode, map](ImagePipeline& p) { p.applyDithering(mode, map); } });
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
+	OperationScope scope(*this, "applyDithering");
 
-void addError(QImage& img, const QPoint& coords, int error)
-{
-	//Check if pixel is inside the image bounds
-	if (coords.x() >= img.size().width() || coords.x() <= 0)
-		return;
-	if (coords.y() >= img.size().height() || coords.y() <= 0)
-		return;
+	const ResultCache::Key key = resultKey(Operation::DITHERING, params);
 
-	int c = QColor(img.pixel(coords)).blue();
-	c += error;
-	img.setPixel(coords, c);
-}
+	if (restoreResult(key))
+		return *this;
 
-ImagePipeline& ImagePipeline::applyDithering(Dithering mode)
-{
-	QImage& img = m_a;
-	QImage& out = m_b;
-	
+	//The gray scale image is only an intermediate stage, binary images are dithered as gray scale ones
+	const bool notifying = m_notify;
+	m_notify = false;
 	makeGrayscale();
+	quantise();
+	m_notify = notifying;
+
+	if (format() == BinaryFormat)
+		convertTo(GrayFormat);
+
+	//Error diffusion is inherently serial, Floyd-Steinberg runs in a wavefront, ordered and pattern modes are split into row bands
+	QImage& out = backBuffer(BinaryFormat);
+	const QImage& img = image();
+
+	const int width = img.width();
+	const int height = img.height();
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
 
 	const int threshold = 128;
 	const int maxIntensity = 255;
 
-	//dithering template pattern matrix
-	const Kernel<4, 4> pattern = {
-		1,  9,  3,  11,
-		13, 5,  15, 7,
-		4,  12, 2,  10,
-		16, 8,  14, 6
-	};
-
 	switch (mode)
 	{
 		case Dithering::ERROR_DIFFUSION:
@@ -190,22 +1421,25 @@ ImagePipeline& ImagePipeline::applyDithering(Dithering mode)
 			//intensity error
 			int error = 0;
 
-			for (int j = 0; j < m_a.height(); j++)
+			for (int j = 0; j < height && !isCancelled(); j++)
 			{
-				for (int i = 0; i < m_a.width(); i++)
+				const uchar* in = img.constScanLine(j);
+				uchar* dst = bits + (size_t)j * stride;
+
+				std::fill(dst, dst + (width + 7) / 8, 0);
+
+				for (int i = 0; i < width; i++)
 				{
 					//If row is even move left -> right, otherwise right -> left.
-					const int pos = (j % 2 == 0) ? i : m_a.width() - (i + 1);
-
-					QPoint coords(pos, j);
-					//QPoint coords(i, j);
+					const int pos = (j % 2 == 0) ? i : width - (i + 1);
 
-					int curp = QColor(img.pixel(coords)).blue(); //current pixel value
+					int curp = in[pos]; //current pixel value
 					curp += error;
 					int newp = (curp < threshold) ? 0 : maxIntensity; //thresholded pixel value
 					error = curp - newp; //pass error onto next pixel
-				
-					out.setPixel(coords, qRgb(newp, newp, newp));
+
+					if (newp)
+						dst[pos / 8] |= 1 << (pos % 8);
 				}
 			}
 
@@ -214,106 +1448,343 @@ ImagePipeline& ImagePipeline::applyDithering(Dithering mode)
 
 		case Dithering::FLOYD_STEINBERG:
 		{
-			for (int j = 0; j < m_a.height(); j++)
-			{
-				for (int i = 0; i < m_a.width(); i++)
-				{
-					//QPoint coords(pos, j);
-					QPoint coords(i, j);
-
-					int curp = QColor(img.pixel(coords)).blue();       //current pixel value
-					int newp = (curp < threshold) ? 0 : maxIntensity;  //thresholded pixel value
-					int error = curp - newp;
-
-					/*
-						---|x|a|--
-						-|b|g|d|--
-						----------
+			floydSteinberg(img, bits, stride, *m_pool, m_cancelled);
+			break;
+		}
 
-						Pass error of current pixel onto neighbouring pixels
-					*/
-					addError(img, coords + QPoint(+1, 0), (int)(error * 7.0f / 16)); //alpha
-					addError(img, coords + QPoint(-1, 1), (int)(error * 3.0f / 16)); //beta
-					addError(img, coords + QPoint(+0, 1), (int)(error * 5.0f / 16)); //gamma
-					addError(img, coords + QPoint(+1, 1), (int)(error * 1.0f / 16)); //delta
+		case Dithering::ORDERED:
+		{
+			const int n = map.size();
+			const std::vector<uint8_t> thresholds = map.tiledRows(width);
 
-					out.setPixel(coords, qRgb(newp, newp, newp));
-				}
-			}
+			//A row is compared against the thresholds of its row of the map
+			forEachRowBand(height, [&](int y0, int y1) {
+				for (int j = y0; j < y1; j++)
+					simd::ditherBits(img.constScanLine(j), bits + (size_t)j * stride, width, thresholds.data() + (size_t)(j % n) * width);
+			});
 
 			break;
 		}
 
-		case Dithering::ORDERED:
+		case Dithering::PATTERN:
 		{
-			const int n = 4;
+			const int n = map.size();
+			const std::vector<uint8_t> thresholds = map.tiledRows(width);
 
-			for (int j = 0; j < m_a.height(); j++)
-			{
-				for (int i = 0; i < m_a.width(); i++)
+			//Bands are whole rows of n*n regions
+			forEachRowBand((height + n - 1) / n, [&](int b0, int b1) {
+				std::vector<int> sums(width);
+				std::vector<uchar> averages(width);
+
+				for (int j = b0 * n; j < std::min(height, b1 * n); j += n)
 				{
-					QPoint coords(i, j);
+					//Regions on the bottom edge may be clipped
+					const int h = std::min(n, height - j);
 
-					int curp = QColor(img.pixel(coords)).blue();       //current pixel value
+					std::fill(sums.begin(), sums.end(), 0);
 
-					//Normalized intensity of pixel 
-					float intensity = (float)curp / 255;
-					//Compute pattern number
-					int p = std::min((int)(intensity * (n*n + 1)), n*n);
+					for (int y = 0; y < h; y++)
+						addColumns(img.constScanLine(j + y), width, sums.data());
 
-					//Compare pattern number against corresponding number in template
-					int newp = (p < pattern[j % n][i % n]) ? 0 : maxIntensity;
+					regionAverages(sums.data(), width, n, h, averages.data());
 
-					out.setPixel(coords, qRgb(newp, newp, newp));
+					//Every row of the regions compares their averages against its row of the map
+					for (int y = 0; y < h; y++)
+						simd::ditherBits(averages.data(), bits + (size_t)(j + y) * stride, width, thresholds.data() + (size_t)y * width);
 				}
-			}
+			});
+		}
+	}
 
-			break;
+	swapBuffers();
+	notify();
+
+	storeResult(key);
+	return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Deferred execution
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ImagePipeline& ImagePipeline::defer()
+{
+	m_deferred = true;
+	return *this;
+}
+
+ImagePipeline& ImagePipeline::execute()
+{
+	m_deferred = false;
+	runGraph();
+	return *this;
+}
+
+QImage::Format ImagePipeline::resultFormat(const Node& node, QImage::Format format)
+{
+	switch (node.operation)
+	{
+		case Operation::GRAYSCALE:
+			return (format == WorkingFormat) ? GrayFormat : format;
+
+		case Operation::LOOKUP:
+			return (format == WorkingFormat || !node.table.isGray()) ? WorkingFormat : GrayFormat;
+
+		case Operation::FILTER:
+		case Operation::RANK_FILTER:
+		case Operation::BOX_BLUR:
+		case Operation::LOCAL_DEVIATION:
+		case Operation::GAUSSIAN_BLUR:
+			return (format == BinaryFormat) ? GrayFormat : format;
+
+		case Operation::THRESHOLD:
+		case Operation::DITHERING:
+		case Operation::ADAPTIVE_THRESHOLD:
+			return BinaryFormat;
+
+		default:
+			return format;
+	}
+}
+
+ImagePipeline& ImagePipeline::record(Node node)
+{
+	//Composed tables are rounded to 8 bits, at a higher precision every table is applied on its own
+	if (node.operation == Operation::LOOKUP && m_precision == Precision::BYTE && !m_graph.empty() && m_graph.back().operation == Operation::LOOKUP)
+	{
+		Node& last = m_graph.back();
+		const LookupTable composed = last.table.then(node.table);
+
+		last.params = tableHash(composed);
+		last.run = [composed](ImagePipeline& p) { p.applyLookup(composed); };
+		last.table = composed;
+	}
+	else
+	{
+		m_graph.push_back(std::move(node));
+	}
+
+	//Tables are only turned into pixel functions once composed
+	Node& last = m_graph.back();
+
+	if (last.operation == Operation::LOOKUP)
+	{
+		auto channels = std::make_shared<const simd::ChannelTable>(last.table.channelTable());
+		last.point = [channels](const QRgb* in, QRgb* out, int count) { simd::lookup(in, out, count, *channels); };
+	}
+
+	return *this;
+}
+
+void ImagePipeline::runGraph()
+{
+	std::vector<Node> graph;
+	graph.swap(m_graph);
+
+	if (graph.empty())
+		return;
+
+	OperationScope scope(*this, "execute");
+
+	//A single operation runs as usual
+	if (graph.size() == 1)
+	{
+		graph.front().run(*this);
+		return;
+	}
+
+	//At a higher precision operations run one by one, passing on their precise results, and only the result of the chain is rounded
+	if (m_precision != Precision::BYTE)
+	{
+		const bool notifying = m_notify;
+		m_notify = false;
+		m_quantise = false;
+
+		for (size_t i = 0; i < graph.size() && !isCancelled(); i++)
+		{
+			//Operations other than these read the 8-bit image
+			const Operation operation = graph[i].operation;
+
+			if (operation != Operation::GRAYSCALE && operation != Operation::LOOKUP && operation != Operation::FILTER)
+				quantise();
+
+			graph[i].run(*this);
 		}
 
-		case Dithering::PATTERN:
+		m_quantise = true;
+		quantise();
+
+		m_notify = notifying;
+		notify();
+		return;
+	}
+
+	quint64 params = 0;
+
+	for (const Node& node : graph)
+	{
+		params = ResultCache::hash(&node.operation, sizeof(node.operation), params);
+		params = ResultCache::hash(&node.params, sizeof(node.params), params);
+	}
+
+	const ResultCache::Key key = resultKey(Operation::GRAPH, params);
+
+	if (restoreResult(key))
+		return;
+
+	//Stages are not reported, only the result of the whole chain
+	const bool notifying = m_notify;
+	m_notify = false;
+
+	for (size_t i = 0; i < graph.size() && !isCancelled();)
+	{
+		if (!graph[i].point && !graph[i].span)
+		{
+			graph[i++].run(*this);
+			continue;
+		}
+
+		//Point operations, then at most one neighbourhood operation, then point operations
+		std::vector<const Node*> prefix;
+		std::vector<const Node*> suffix;
+		const Node* neighbourhood = nullptr;
+
+		for (; i < graph.size() && graph[i].point; i++)
+			prefix.push_back(&graph[i]);
+
+		if (i < graph.size() && graph[i].span)
+		{
+			neighbourhood = &graph[i++];
+
+			for (; i < graph.size() && graph[i].point; i++)
+				suffix.push_back(&graph[i]);
+		}
+
+		runFused(prefix, neighbourhood, suffix);
+	}
+
+	m_notify = notifying;
+
+	storeResult(key);
+	notify();
+}
+
+void ImagePipeline::runFused(const std::vector<const Node*>& prefix, const Node* neighbourhood, const std::vector<const Node*>& suffix)
+{
+	OperationScope scope(*this, "fused");
+
+	//Rows are processed as working format pixels, gray scale and binary images are converted as they are read and written
+	QImage::Format format = image().format();
+
+	for (const Node* node : prefix)
+		format = resultFormat(*node, format);
+
+	if (neighbourhood)
+		format = resultFormat(*neighbourhood, format);
+
+	for (const Node* node : suffix)
+		format = resultFormat(*node, format);
+
+	QImage& out = backBuffer(format);
+	const QImage& in = image();
+
+	const int width = in.width();
+	const int height = in.height();
+
+	uchar* const bits = out.bits();
+	const int stride = out.bytesPerLine();
+
+	const bool direct = (format == WorkingFormat);
+
+	//Run point operations over a row, the first one reads src and the rest work in place
+	auto points = [width](const std::vector<const Node*>& nodes, const QRgb* src, QRgb* dst) {
+		if (nodes.empty() && src != dst)
+			std::memcpy(dst, src, (size_t)width * sizeof(QRgb));
+
+		for (const Node* node : nodes)
 		{
-			const int n = 4;
-			const int area = n * n;
+			node->point(src, dst, width);
+			src = dst;
+		}
+	};
+
+	//Row j of the result, written in place unless it has to be converted into the output format
+	auto outputRow = [&](int j, std::vector<QRgb>& scratch) {
+		scratch.resize(width);
+		return direct ? reinterpret_cast<QRgb*>(bits + (size_t)j * stride) : scratch.data();
+	};
+
+	auto storeOutput = [&](int j, const QRgb* pixels) {
+		if (!direct)
+			storeRow(pixels, format, bits + (size_t)j * stride, width);
+	};
+
+	if (!neighbourhood)
+	{
+		forEachRowBand(height, [&](int y0, int y1) {
+			std::vector<QRgb> input(width);
+			std::vector<QRgb> scratch;
 
-			//Foreach n*n region of pixels
-			for (int j = 0; j < m_a.height(); j += n)
+			for (int j = y0; j < y1; j++)
 			{
-				for (int i = 0; i < m_a.width(); i += n)
-				{
-					int totalIntensity = 0;
+				QRgb* dst = outputRow(j, scratch);
+				points(prefix, loadRow(in, j, input.data()), dst);
+				storeOutput(j, dst);
+			}
+		});
+	}
+	else if (prefix.empty() && in.format() == WorkingFormat)
+	{
+		forEachRowBand(height, [&](int y0, int y1) {
+			std::vector<QRgb> scratch;
+
+			for (int j = y0; j < y1; j++)
+			{
+				QRgb* dst = outputRow(j, scratch);
+				neighbourhood->span(in, j, 0, width, dst);
+				points(suffix, dst, dst);
+				storeOutput(j, dst);
+			}
+		});
+	}
+	else
+	{
+		//Rows per band, small enough for a band and its halo to stay in cache
+		const int halo = neighbourhood->halo;
+		const int bandRows = std::max(8, (256 * 1024) / std::max(1, width * 4));
+
+		forEachRowBand(height, [&](int y0, int y1) {
 
-					//Get total intensity
-					for (int y = 0; y < n; y++)
-						for (int x = 0; x < n; x++)
-							totalIntensity += QColor(img.pixel(QPoint(i + x, j + y))).blue();
+			thread_local std::vector<QRgb> storage;
+			std::vector<QRgb> input(width);
+			std::vector<QRgb> scratch;
+
+			for (int b0 = y0; b0 < y1; b0 += bandRows)
+			{
+				const int b1 = std::min(y1, b0 + bandRows);
 
-					//Normalized average intensity of pixel region 
-					float normIntensity = (float)(totalIntensity / area) / 255.0f;
-					//Compute pattern number
-					int p = std::min((int)(normIntensity * (area + 1)), area);
+				//Rows read by the neighbourhood operation, clipped to the image so clamping at its edges is unchanged
+				const int r0 = std::max(0, b0 - halo);
+				const int r1 = std::min(height, b1 + halo);
 
-					//Fill in pixel region
-					for (int y = 0; y < n; y++)
-						for (int x = 0; x < n; x++)
-						{
-							QPoint coords(i + x, j + y);
+				storage.resize((size_t)width * (r1 - r0));
+				const QImage band(reinterpret_cast<uchar*>(storage.data()), width, r1 - r0, width * 4, WorkingFormat);
 
-							//Threshold each pixel based on pattern matrix
-							int newp = (p < pattern[y][x]) ? 0 : maxIntensity;
+				for (int r = r0; r < r1; r++)
+					points(prefix, loadRow(in, r, input.data()), storage.data() + (size_t)(r - r0) * width);
 
-							out.setPixel(coords, qRgb(newp, newp, newp));
-						}
+				for (int j = b0; j < b1; j++)
+				{
+					QRgb* dst = outputRow(j, scratch);
+					neighbourhood->span(band, j - r0, 0, width, dst);
+					points(suffix, dst, dst);
+					storeOutput(j, dst);
 				}
 			}
-		}
+		});
 	}
 
-	//Swap image buffers
-	img.swap(out);
-	imageUpdated(QPixmap::fromImage(img));
-
-	return *this;
+	swapBuffers();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -4,11 +4,24 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include <QImage>
-#include <QPixmap>
 
 #include "Utils.h"
 #include "FilterKernels.h"
+#include "ThreadPool.h"
+#include "LookupTable.h"
+#include "ResultCache.h"
+#include "RankFilter.h"
+#include "ThresholdMap.h"
+#include "SummedAreaTable.h"
+#include "RecursiveGaussian.h"
+#include "PreciseImage.h"
+#include "Profiler.h"
 
 class ImageAccessor;
 
@@ -20,55 +33,396 @@ enum class Dithering
 	ORDERED         = 4,
 };
 
+//Channel type of the operations which can run at a higher precision
+enum class Precision
+{
+	BYTE,
+	WORD,
+	FLOAT,
+};
+
 class ImagePipeline : public QObject
 {
 	Q_OBJECT
 
 public:
 
-	explicit ImagePipeline(QObject* parent = nullptr) : QObject(parent) {}
+	explicit ImagePipeline(QObject* parent = nullptr) :
+		QObject(parent),
+		m_current(-1),
+		m_notify(true),
+		m_deferred(false),
+		m_peakMemory(0),
+		m_pool(ThreadPool::globalInstance()),
+		m_cancelled(nullptr),
+		m_precision(Precision::BYTE),
+		m_precise(-1),
+		m_tableChannels(0),
+		m_mappedGray(false),
+		m_quantise(true),
+		m_stale(false),
+		m_gamma(1.0f),
+		m_profiler(nullptr),
+		m_depth(0),
+		m_allocations(0)
+	{}
 
-	//Load the given image
+	//Load the given image, gray scale images are kept in the gray scale format
 	void load(const QImage& img);
 
-	//Return the current image
-	const QImage& image() const { return m_a; }
+	//Restore the loaded image without notifying, to start a new chain of operations, recorded operations are dropped
+	ImagePipeline& reset();
+
+	/*
+		Record the following operations instead of running them, until execute().
+
+		execute() runs the recorded chain in as few sweeps over the image as it can: runs of point operations
+		(gray scale, lookup tables, thresholding) are fused into one pass, adjacent lookup tables into one table,
+		and a neighbourhood filter is fused with the point operations around it by processing the image in
+		small row bands, whose intermediate rows stay in cache. Dithering runs on its own.
+		The result is the same as running the operations one by one, and is cached as a whole.
+
+		apply() and applySpans() take function references which cannot be recorded,
+		they run the recorded operations first and then run immediately.
+	*/
+	ImagePipeline& defer();
+	ImagePipeline& execute();
+	bool isDeferred() const { return m_deferred; }
+
+	//Return the current image, in the working, gray scale or binary format
+	const QImage& image() const { return m_current < 0 ? m_src : m_buffers[m_current]; }
+
+	//Format of the current image
+	QImage::Format format() const { return image().format(); }
+
+	//Largest number of bytes held by the loaded image and the pipeline's buffers at once, cached results excluded
+	qint64 peakMemory() const { return m_peakMemory; }
+	void resetPeakMemory() { m_peakMemory = 0; updatePeakMemory(); }
+
+	//Thread pool operations are split across, the global pool by default
+	ThreadPool* threadPool() const { return m_pool; }
+	void setThreadPool(ThreadPool* pool) { m_pool = pool ? pool : ThreadPool::globalInstance(); }
+
+	/*
+		Flag polled between row bands, once it is set the remaining bands of every operation are skipped.
+		The image of a cancelled operation is incomplete and should be discarded.
+	*/
+	void setCancellation(const std::atomic<bool>* cancelled) { m_cancelled = cancelled; }
+	bool isCancelled() const { return m_cancelled && m_cancelled->load(std::memory_order_relaxed); }
+
+	/*
+		Profiler operations are timed with while it is enabled, none by default.
+		Every operation that runs is recorded, including the stages of another one at a greater depth:
+		execute() records the chain as a whole, with its operations and fused passes inside it.
+		Recording operations for execute() is not timed.
+	*/
+	void setProfiler(Profiler* profiler) { m_profiler = profiler; }
+	Profiler* profiler() const { return m_profiler; }
+
+	/*
+		Results of the built in operations, an operation repeated on the same image is not recomputed.
+		Operations run through apply() and applySpans() are not cached.
+	*/
+	ResultCache& resultCache() { return m_cache; }
+	const ResultCache& resultCache() const { return m_cache; }
+
+	/*
+		Precision of gray scale conversion, lookup tables, gamma correction and filter kernels, 8-bit by default.
+
+		At WORD or FLOAT precision these operations pass their results on to each other in 16-bit or float
+		channels, so a chain of them is not rounded to 8 bits after every step. image() is still rounded after
+		every operation, except in the middle of a deferred chain, which runs its operations one by one and
+		only rounds its result. The other operations work on the rounded image.
+		Results are not cached at a higher precision, and lookup tables recorded for execute() are only
+		composed at 8-bit precision, so set the precision before recording operations.
+	*/
+	void setPrecision(Precision precision);
+	Precision precision() const { return m_precision; }
+
+	//Working format of colour images in the pipeline
+	static const QImage::Format WorkingFormat = QImage::Format_ARGB32;
+
+	/*
+		Formats of gray scale and binary images, a quarter and a thirty-second of the size of the working format.
+
+		Gray scale conversion makes a gray scale image, thresholding and dithering make a binary one,
+		whose colour table is black and white. Operations keep the format of their input where they can
+		and convert it up where they cannot, e.g. filtering a binary image gives a gray scale one and
+		a lookup table which maps channels differently gives a working format one.
+		Images are only converted to a display format where they are shown.
+	*/
+	static const QImage::Format GrayFormat = QImage::Format_Grayscale8;
+	static const QImage::Format BinaryFormat = QImage::Format_MonoLSB;
 
 	//Pixel function signature
 	using PixelFunction = FunctionRef<QRgb(const QImage&, const QPoint&)>;
 
+	/*
+		Span function signature:
+		writes the output pixels [x0, x1) of row y to out,
+		where the input image is always in the working format, gray scale and binary images are converted to it first.
+
+		Spans are processed concurrently so span and pixel functions must be thread safe.
+		The whole input image is readable from every span, so neighbourhood operations need no extra halo.
+	*/
+	using SpanFunction = FunctionRef<void(const QImage&, int y, int x0, int x1, QRgb* out)>;
+
 	//Apply a function to every pixel of an image:
 	ImagePipeline& apply(const PixelFunction& func);
 
+	//Apply a function to every span of an image:
+	ImagePipeline& applySpans(const SpanFunction& func);
+
 	//Apply a gray scale filter
 	ImagePipeline& makeGrayscale();
 
 	//Apply gamma correction
 	ImagePipeline& setGamma(float gamma);
 
-	//Apply a filter kernel to the image
+	//Apply a lookup table to every colour channel
+	ImagePipeline& applyLookup(const LookupTable& table);
+
+	//Apply a filter kernel to the image, large kernels are convolved through transforms, see FftConvolution
 	ImagePipeline& applyFilter(const KernelView& kernel);
 
-	//Apply a non linear filter operation to the image
+	//Apply a Gaussian blur of the given standard deviation in pixels, which takes the same time at any sigma, see RecursiveGaussian
+	ImagePipeline& applyGaussianBlur(float sigma);
+
+	//Apply a 3x3 median filter to the image
 	ImagePipeline& applyNonLinearFilter();
 
-	//Apply thresholding
+	//Apply a median, minimum, maximum or percentile filter to every colour channel
+	ImagePipeline& applyRankFilter(const RankFilter& filter);
+
+	//Apply thresholding, the result is binary
 	ImagePipeline& applyThresholding();
 
-	//Apply error diffusion dithering
+	/*
+		Operations over the square window of the given radius around each pixel, which take the same time at any radius.
+		They sum windows through summed-area tables of the image and clamp its borders like the filter kernels.
+	*/
+
+	//Apply a box blur, the mean of each colour channel over the window, up to SummedAreaTable::MaxRadius
+	ImagePipeline& applyBoxBlur(int radius);
+
+	//Replace each colour channel with its standard deviation over the window, up to SummedAreaTable::MaxSquaresRadius
+	ImagePipeline& applyLocalDeviation(int radius);
+
+	/*
+		Apply adaptive thresholding, the result is binary: a pixel is white where its gray value reaches the mean of
+		the window less offset, so unevenly lit images are thresholded against their local brightness
+	*/
+	ImagePipeline& applyAdaptiveThresholding(int radius, int offset = 8);
+
+	//Apply dithering to a binary result, ordered and pattern modes use the 4x4 Bayer matrix
 	ImagePipeline& applyDithering(Dithering mode);
 
+	//Apply dithering, ordered and pattern modes compare against the given threshold map
+	ImagePipeline& applyDithering(Dithering mode, const ThresholdMap& map);
+
 public slots:
 
 	void resetImage();
 
 signals:
 
-	void imageUpdated(const QPixmap& img);
+	//The result of an operation, converting it for display is up to the receiver
+	void imageUpdated(const QImage& img);
 
 private:
 
+	//Times an operation for the profiler, with the input image's counters
+	class OperationScope;
+
+	enum class Operation
+	{
+		GRAYSCALE,
+		LOOKUP,
+		FILTER,
+		RANK_FILTER,
+		THRESHOLD,
+		DITHERING,
+		BOX_BLUR,
+		LOCAL_DEVIATION,
+		ADAPTIVE_THRESHOLD,
+		GAUSSIAN_BLUR,
+		GRAPH,
+	};
+
+	//Row functions of operations with their own output format, writing row y of the input image to out
+	using RowFunction = FunctionRef<void(const QImage& in, int y, uchar* out)>;
+
+	//Pixel functions of point operations, in and out may be the same span
+	using PointFunction = std::function<void(const QRgb* in, QRgb* out, int count)>;
+
+	//A recorded operation
+	struct Node
+	{
+		Operation operation;
+		quint64 params;
+
+		//Run the operation on its own
+		std::function<void(ImagePipeline&)> run;
+
+		//Point operations only
+		PointFunction point;
+
+		//Neighbourhood operations only, reading up to halo rows above and below the output row
+		std::function<void(const QImage&, int y, int x0, int x1, QRgb* out)> span;
+		int halo;
+
+		//Lookup operations only, so adjacent tables can be composed
+		LookupTable table;
+	};
+
+	//Format of the result of a node on an image of the given format, the same as running the node on its own
+	static QImage::Format resultFormat(const Node& node, QImage::Format format);
+
+	//Record a node, composing it with the last one if both are lookup tables
+	ImagePipeline& record(Node node);
+
+	//Run and clear the recorded nodes
+	void runGraph();
+
+	//Run point operations and at most one neighbourhood operation in one sweep over the image
+	void runFused(const std::vector<const Node*>& prefix, const Node* neighbourhood, const std::vector<const Node*>& suffix);
+
+	//Key of an operation on the current image
+	ResultCache::Key resultKey(Operation operation, quint64 params = 0) const;
+
+	//Replace the current image with a cached result, returns false if there is none
+	bool restoreResult(const ResultCache::Key& key);
+
+	//Cache the current image as the result of an operation, unless the operation was cancelled
+	void storeResult(const ResultCache::Key& key);
+
+	int backIndex() const { return m_current == 0 ? 1 : 0; }
+
+	//Return the output buffer in the given format, reallocating it if it is shared or mismatched
+	QImage& backBuffer(QImage::Format format = WorkingFormat);
+
+	//Make the output buffer the current image, which is 8-bit from here
+	void swapBuffers();
+
+	void updatePeakMemory();
+
+	//Bytes of the current image, and of its copy at the working precision if there is one
+	qint64 imageBytes() const;
+
+	//Run func over every row of the current image into an output buffer of the given format, and make that the current image
+	void applyRows(QImage::Format format, const RowFunction& func);
+
+	//Convert the current image to another format, without notifying
+	void convertTo(QImage::Format format);
+
+	//Run func over row bands [y0, y1) of the current image in parallel, bands have at least minRows rows where possible
+	void forEachRowBand(int height, const ThreadPool::RangeFunction& func, int minRows = 1) const;
+
+	//Emit imageUpdated, unless signals are blocked or the operation is a stage of another one
+	void notify();
+
+	//Returns true if the current image has a single gray channel, at the working precision if it is held at it
+	bool isGray() const;
+
+	/*
+		Run kernel(in, out, y0, y1) over the current image at the working precision, reading it through a ByteImage if it is
+		only held in 8 bits or in tables. The output has the given number of channels, or as many as the input for 0, and is
+		rounded into an 8-bit image as it is made, unless m_quantise is false.
+	*/
+	template<typename Kernel>
+	void runPrecise(int channels, const Kernel& kernel);
+
+	template<typename T, typename Kernel>
+	void runPrecise(PreciseImage<T>* buffers, int channels, const Kernel& kernel);
+
+	template<typename Image, typename T, typename Kernel>
+	void runPrecise(const Image& in, PreciseImage<T>& out, int channels, const Kernel& kernel);
+
+	//Round the current image at the working precision into an 8-bit one, if it is ahead of it
+	void quantise();
+
+	template<typename Image>
+	void quantise(const Image& img);
+
+	//Round the current image into an 8-bit one when it is mapped from the loaded image
+	void quantiseMapped();
+
+	//Apply a curve at the working precision
+	void applyCurve(const PreciseCurve& curve);
+
+	//The loaded image as the current image at the working precision is mapped from it
+	template<typename T>
+	ByteImage<T> mappedImage() const;
+
+	//Map the tables of the loaded image through a curve, with the given number of channels, or convert it to gray
+	void mapTables(int channels, const PreciseCurve& curve);
+	void mapGray();
+
+	//Make the mapping of the loaded image the current image at the working precision, rounded unless m_quantise is false
+	void setMapped();
+
+	//Build the summed-area table of channel c of an image, for windows of the given radius
+	void buildTable(const QImage& img, int c, int radius, bool squares);
+
+	//Replace each channel of the current image with its window means, or deviations
+	void applyWindowed(int radius, bool deviation);
+
+	//Loaded image, never written to
 	QImage m_src;
-	QImage m_a;
-	QImage m_b;
+
+	//Ping pong buffers, operations read the current image and write the other buffer
+	QImage m_buffers[2];
+
+	//Buffer holding the current image, or -1 if it is the loaded image
+	int m_current;
+
+	bool m_notify;
+
+	bool m_deferred;
+	std::vector<Node> m_graph;
+
+	qint64 m_peakMemory;
+
+	ThreadPool* m_pool;
+	const std::atomic<bool>* m_cancelled;
+
+	Precision m_precision;
+
+	//Ping pong buffers of the working precision, only those of the current precision are allocated
+	PreciseImage<uint16_t> m_wordBuffers[2];
+	PreciseImage<float> m_floatBuffers[2];
+
+	//Buffer holding the current image at the working precision, -1 if it is only held in 8 bits, or Mapped
+	int m_precise;
+
+	//The current image at the working precision is the loaded one read through m_tables, and converted to gray if m_mappedGray
+	static const int Mapped = -2;
+
+	//Tables of the 256 8-bit values per channel in the range of the working precision, the result of point operations on the loaded image
+	std::vector<float> m_tables[3];
+	int m_tableChannels;
+	bool m_mappedGray;
+
+	//Round precise results as they are made, and whether the 8-bit image is behind the precise one
+	bool m_quantise;
+	bool m_stale;
+
+	//Table and curve of the last gamma value, dragging the gamma slider repeats values often
+	float m_gamma;
+	LookupTable m_gammaTable;
+	std::unique_ptr<const PreciseCurve> m_gammaCurve;
+
+	ResultCache m_cache;
+
+	//Table of the windowed operations, kept for the next one like the buffers
+	SummedAreaTable m_table;
+
+	//Float planes the Gaussian blur filters the image in
+	PreciseImage<float> m_planes;
+
+	Profiler* m_profiler;
+
+	//Operations running, and image buffers allocated so far, for the profiler
+	int m_depth;
+	int m_allocations;
 };
@@ -4,10 +4,15 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include <QGraphicsView>
 #include <QGraphicsPixmapItem>
 #include <QWheelEvent>
 
+#include "TiledImageItem.h"
+#include "Profiler.h"
+
 class ImageWidget : public QGraphicsView
 {
 	Q_OBJECT
@@ -15,10 +20,13 @@ class ImageWidget : public QGraphicsView
 public:
 
 	explicit ImageWidget(QWidget* parent = nullptr) :
-		QGraphicsView(parent)
+		QGraphicsView(parent),
+		m_profiler(nullptr)
 	{
 		setScene(&m_scene);
 		m_scene.addItem(&m_item);
+		m_scene.addItem(&m_tiles);
+		m_tiles.hide();
 		setDragMode(QGraphicsView::ScrollHandDrag);
 		setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 		setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
@@ -26,12 +34,33 @@ public:
 	}
 
 	void scale(qreal s) { QGraphicsView::scale(s, s); }
+
+	//Profiler pixmap uploads are timed with, as "fromImage" operations
+	void setProfiler(Profiler* profiler) { m_profiler = profiler; }
 	QSize sizeHint() const override { return{ 400, 400 }; }
 
+	/*
+		Resolution at which an image of the given size can be previewed without visible loss:
+		its on screen size at the current zoom, but no larger than what fits in the viewport.
+	*/
+	QSize previewSize(const QSize& imageSize) const
+	{
+		const qreal zoom = std::min<qreal>(transform().m11(), 1.0);
+		const QSize onScreen = (QSizeF(imageSize) * zoom).toSize();
+		return onScreen.boundedTo(imageSize.scaled(viewport()->size(), Qt::KeepAspectRatio)).expandedTo(QSize(1, 1));
+	}
+
 public slots:
 
+	//Show an image, it is uploaded to a pixmap here and nowhere else
+	void setImage(const QImage& img)
+	{
+		setPixmap(toPixmap(img));
+	}
+
 	void setPixmap(const QPixmap& pixmap)
 	{
+		m_item.setTransform(QTransform());
 		m_item.setPixmap(pixmap);
 		auto offset = -QRectF(pixmap.rect()).center();
 		m_item.setOffset(offset);
@@ -39,8 +68,57 @@ public slots:
 		translate(1, 1);
 	}
 
+	/*
+		Show the tiles of a tiled pipeline instead of pixmaps, only visible tiles are computed.
+		A null source switches back to pixmaps.
+	*/
+	void setTiledSource(TiledPipeline* source)
+	{
+		QObject::disconnect(m_tilesChanged);
+		m_tiles.setSource(source);
+		m_tiles.setVisible(source != nullptr);
+		m_item.setVisible(source == nullptr);
+
+		if (source)
+		{
+			m_tilesChanged = QObject::connect(source, &TiledPipeline::tilesChanged, this, &ImageWidget::refreshTiles);
+			refreshTiles();
+		}
+	}
+
+	//Show a downscaled preview stretched over the area of the full size image
+	void setPreview(const QImage& img, const QSize& imageSize)
+	{
+		const QPixmap pixmap = toPixmap(img);
+		m_item.setPixmap(pixmap);
+		m_item.setOffset(-QRectF(pixmap.rect()).center());
+		m_item.setTransform(QTransform::fromScale((qreal)imageSize.width() / pixmap.width(), (qreal)imageSize.height() / pixmap.height()));
+	}
+
 private:
 
+	QPixmap toPixmap(const QImage& img)
+	{
+		ProfileScope scope(m_profiler, "fromImage");
+
+		if (scope.isActive())
+		{
+			scope.stats().pixels = (qint64)img.width() * img.height();
+			scope.stats().bytes = img.sizeInBytes();
+		}
+
+		return QPixmap::fromImage(img);
+	}
+
+	void refreshTiles()
+	{
+		//The loaded image may have changed size
+		m_tiles.prepareGeometryChange();
+		const QRectF bounds = m_tiles.boundingRect();
+		setSceneRect(bounds.x() * 4, bounds.y() * 4, bounds.width() * 4, bounds.height() * 4);
+		m_tiles.update();
+	}
+
 	void wheelEvent(QWheelEvent* event)
 	{
 		qreal d = (qreal)event->delta() / 120;
@@ -50,4 +128,7 @@ private:
 
 	QGraphicsScene m_scene;
 	QGraphicsPixmapItem m_item;
+	TiledImageItem m_tiles;
+	QMetaObject::Connection m_tilesChanged;
+	Profiler* m_profiler;
 };
\ No newline at end of file
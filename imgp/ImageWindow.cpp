@@ -2,18 +2,24 @@
 	Image Editor main window
 */
 
+#include <algorithm>
+#include <cstring>
+
 #include <QLabel>
 #include <QSlider>
 #include <QHBoxLayout>
 #include <QFormLayout>
 #include <QGroupBox>
 #include <QRadioButton>
+#include <QComboBox>
 #include <QMenuBar>
+#include <QStatusBar>
 #include <QSplitter>
 #include <QFileDialog>
 #include <QDockWidget>
 
 #include <QDir>
+#include <QFileInfo>
 #include <QDragEnterEvent>
 #include <QDropEvent>
 #include <QMimeData>
@@ -22,11 +28,14 @@
 
 #include "ImageWidget.h"
 #include "ImageWindow.h"
+#include "RawImage.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 ImageWindow::ImageWindow(QWidget* parent) :
-	QMainWindow(parent)
+	QMainWindow(parent),
+	m_halo(0),
+	m_tiled(false)
 {
 	m_fileMenu = menuBar()->addMenu(tr("&File"));
 	m_viewMenu = menuBar()->addMenu(tr("&View"));
@@ -37,8 +46,16 @@ ImageWindow::ImageWindow(QWidget* parent) :
 	//Setup menu actions
 	createActions();
 
+	//Timings are recorded by the workers and reported here
+	m_img.setProfiler(&m_profiler);
+	m_tiles.setProfiler(&m_profiler);
+	m_imageView->setProfiler(&m_profiler);
+	QObject::connect(&m_profiler, &Profiler::operationProfiled, this, &ImageWindow::profileOperation);
+
 	//Image update event
-	QObject::connect(&m_img, &ImagePipeline::imageUpdated, m_imageView, &ImageWidget::setPixmap);
+	QObject::connect(&m_img, &AsyncPipeline::imageUpdated, m_imageView, &ImageWidget::setImage);
+	QObject::connect(&m_img, &AsyncPipeline::imageUpdated, this, &ImageWindow::updateStatus);
+	QObject::connect(&m_img, &AsyncPipeline::previewUpdated, m_imageView, &ImageWidget::setPreview);
 
 	/*
 		Setup image operations
@@ -47,14 +64,14 @@ ImageWindow::ImageWindow(QWidget* parent) :
 	QAbstractButton* none = new QRadioButton("none", m_filters);
 	m_filters->layout()->addWidget(none);
 	none->setChecked(true);
-	QObject::connect(none, &QAbstractButton::toggled, [&](bool checked) { if (checked) m_img.resetImage(); });
+	QObject::connect(none, &QAbstractButton::toggled, [&](bool checked) { if (checked) process(nullptr); });
 
 	//Set image to greyscale
 	QAbstractButton* grey = new QRadioButton("greyscale", m_filters);
 	m_filters->layout()->addWidget(grey);
 
 	QObject::connect(grey, &QAbstractButton::toggled, [&](bool checked) {
-		if (checked) m_img.makeGrayscale(); else m_img.resetImage();
+		if (checked) process([](ImagePipeline& p) { p.makeGrayscale(); }); else process(nullptr);
 	});
 
 	/*
@@ -70,11 +87,25 @@ ImageWindow::ImageWindow(QWidget* parent) :
 	addFilter("sharpen",        kernels::sharpen);
 	addFilter("emboss",         kernels::emboss);
 
-	//Nonlinear filter
-	QAbstractButton* nonlinear = new QRadioButton("non-linear", m_filters);
-	m_filters->layout()->addWidget(nonlinear);
-	QObject::connect(nonlinear, &QAbstractButton::toggled, [&](bool checked) {
-		if (checked) m_img.applyNonLinearFilter(); else m_img.resetImage();
+	//Rank filter, configured in its own group
+	m_rankButton = new QRadioButton("rank filter", m_filters);
+	m_filters->layout()->addWidget(m_rankButton);
+	QObject::connect(m_rankButton, &QAbstractButton::toggled, [&](bool checked) {
+		if (checked) processRankFilter(); else process(nullptr);
+	});
+
+	//Box blur, local deviation and adaptive thresholding, configured in their own group
+	m_windowButton = new QRadioButton("local window", m_filters);
+	m_filters->layout()->addWidget(m_windowButton);
+	QObject::connect(m_windowButton, &QAbstractButton::toggled, [&](bool checked) {
+		if (checked) processWindowOperation(); else process(nullptr);
+	});
+
+	//Recursive Gaussian blur, its sigma set in its own group
+	m_gaussianButton = new QRadioButton("gaussian blur", m_filters);
+	m_filters->layout()->addWidget(m_gaussianButton);
+	QObject::connect(m_gaussianButton, &QAbstractButton::toggled, [&](bool checked) {
+		if (checked) processGaussianBlur(); else process(nullptr);
 	});
 
 	/*
@@ -87,7 +118,7 @@ ImageWindow::ImageWindow(QWidget* parent) :
 	QAbstractButton* threshold = new QRadioButton("threshold", m_filters);
 	m_filters->layout()->addWidget(threshold);
 	QObject::connect(threshold, &QAbstractButton::toggled, [&](bool checked) {
-		if (checked) m_img.applyThresholding(); else m_img.resetImage();
+		if (checked) process([](ImagePipeline& p) { p.applyThresholding(); }); else process(nullptr);
 	});
 
 	addHalftoneFilter("error diffusion dither", Dithering::ERROR_DIFFUSION);
@@ -140,15 +171,100 @@ QWidget* ImageWindow::createTools(QWidget* parent)
 	gamma->layout()->addWidget(gammaLabel);
 
 	connect(m_gammaSlider, &QSlider::valueChanged, [this, gammaLabel](int value) {
-		m_img.resetImage();
-		m_img.setGamma((float)value / 100.0f);
+		//Each tick replaces the previous gamma job, so a drag never queues up stale recomputes
+		const float gamma = (float)value / 100.0f;
+		process([gamma](ImagePipeline& p) { p.setGamma(gamma); });
 		gammaLabel->setText(QString::fromStdString("value = " + std::to_string((float)value / 100.0f)));
 	});
 
+	QGroupBox* rank = new QGroupBox("Rank filter:", container);
+	rank->setLayout(new QVBoxLayout(rank));
+	rank->setAlignment(Qt::AlignTop);
+
+	m_rankMode = new QComboBox(rank);
+	m_rankMode->addItem("median", 50.0f);
+	m_rankMode->addItem("minimum", 0.0f);
+	m_rankMode->addItem("maximum", 100.0f);
+
+	m_rankRadius = new QSlider(Qt::Horizontal, rank);
+	m_rankRadius->setMinimum(1);
+	m_rankRadius->setMaximum(RankFilter::MaxRadius);
+	m_rankRadius->setValue(1);
+
+	QLabel* radiusLabel = new QLabel("radius = 1", rank);
+
+	rank->layout()->setAlignment(Qt::AlignTop);
+	rank->layout()->addWidget(m_rankMode);
+	rank->layout()->addWidget(m_rankRadius);
+	rank->layout()->addWidget(radiusLabel);
+
+	connect(m_rankMode, QOverload<int>::of(&QComboBox::currentIndexChanged), [this]() {
+		if (m_rankButton->isChecked()) processRankFilter();
+	});
+
+	connect(m_rankRadius, &QSlider::valueChanged, [this, radiusLabel](int value) {
+		radiusLabel->setText("radius = " + QString::number(value));
+		if (m_rankButton->isChecked()) processRankFilter();
+	});
+
+	QGroupBox* window = new QGroupBox("Local window:", container);
+	window->setLayout(new QVBoxLayout(window));
+	window->setAlignment(Qt::AlignTop);
+
+	m_windowMode = new QComboBox(window);
+	m_windowMode->addItem("box blur");
+	m_windowMode->addItem("local deviation");
+	m_windowMode->addItem("adaptive threshold");
+
+	m_windowRadius = new QSlider(Qt::Horizontal, window);
+	m_windowRadius->setMinimum(1);
+	m_windowRadius->setMaximum(100);
+	m_windowRadius->setValue(8);
+
+	QLabel* windowLabel = new QLabel("radius = 8", window);
+
+	window->layout()->setAlignment(Qt::AlignTop);
+	window->layout()->addWidget(m_windowMode);
+	window->layout()->addWidget(m_windowRadius);
+	window->layout()->addWidget(windowLabel);
+
+	connect(m_windowMode, QOverload<int>::of(&QComboBox::currentIndexChanged), [this]() {
+		if (m_windowButton->isChecked()) processWindowOperation();
+	});
+
+	connect(m_windowRadius, &QSlider::valueChanged, [this, windowLabel](int value) {
+		windowLabel->setText("radius = " + QString::number(value));
+		if (m_windowButton->isChecked()) processWindowOperation();
+	});
+
+	//Sigma in tenths of a pixel
+	QGroupBox* gaussian = new QGroupBox("Gaussian:", container);
+	gaussian->setLayout(new QVBoxLayout(gaussian));
+	gaussian->setAlignment(Qt::AlignTop);
+
+	m_gaussianSigma = new QSlider(Qt::Horizontal, gaussian);
+	m_gaussianSigma->setMinimum(5);
+	m_gaussianSigma->setMaximum(500);
+	m_gaussianSigma->setValue(20);
+
+	QLabel* sigmaLabel = new QLabel("sigma = 2.0", gaussian);
+
+	gaussian->layout()->setAlignment(Qt::AlignTop);
+	gaussian->layout()->addWidget(m_gaussianSigma);
+	gaussian->layout()->addWidget(sigmaLabel);
+
+	connect(m_gaussianSigma, &QSlider::valueChanged, [this, sigmaLabel](int value) {
+		sigmaLabel->setText("sigma = " + QString::number(value / 10.0, 'f', 1));
+		if (m_gaussianButton->isChecked()) processGaussianBlur();
+	});
+
 	container->setLayout(new QVBoxLayout(container));
 	container->layout()->setAlignment(Qt::AlignLeft);
 	container->layout()->addWidget(m_filters);
 	container->layout()->addWidget(gamma);
+	container->layout()->addWidget(rank);
+	container->layout()->addWidget(window);
+	container->layout()->addWidget(gaussian);
 
 	return container;
 }
@@ -174,6 +290,28 @@ void ImageWindow::createActions()
 	openAction->setStatusTip(tr("Open an image"));
 	connect(openAction, &QAction::triggered, this, &ImageWindow::open);
 	m_fileMenu->addAction(openAction);
+
+	QAction* traceAction = new QAction(tr("Export &trace..."), m_fileMenu);
+	traceAction->setStatusTip(tr("Save the timings recorded while profiling as a Chrome trace"));
+	connect(traceAction, &QAction::triggered, this, &ImageWindow::exportTrace);
+	m_fileMenu->addAction(traceAction);
+
+	QAction* kernelsAction = new QAction(tr("Load &kernels..."), m_fileMenu);
+	kernelsAction->setStatusTip(tr("Add the filter kernels of a JSON file to the tools"));
+	connect(kernelsAction, &QAction::triggered, this, &ImageWindow::loadKernels);
+	m_fileMenu->addAction(kernelsAction);
+
+	QAction* tiledAction = new QAction(tr("&Tiled rendering"), m_viewMenu);
+	tiledAction->setCheckable(true);
+	tiledAction->setStatusTip(tr("Only process the visible part of the image"));
+	connect(tiledAction, &QAction::toggled, this, &ImageWindow::setTiled);
+	m_viewMenu->addAction(tiledAction);
+
+	QAction* profileAction = new QAction(tr("Show ti&mings"), m_viewMenu);
+	profileAction->setCheckable(true);
+	profileAction->setStatusTip(tr("Time every operation and show the timings in the status bar"));
+	connect(profileAction, &QAction::toggled, this, &ImageWindow::setProfiling);
+	m_viewMenu->addAction(profileAction);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -184,7 +322,9 @@ QAbstractButton* ImageWindow::addFilter(const QString& name, const KernelView& k
 {
 	QAbstractButton* toggle = new QRadioButton(name, m_filters);
 	m_filters->layout()->addWidget(toggle);
-	QObject::connect(toggle, &QAbstractButton::toggled, [this, kernel](bool checked) { if (checked) m_img.applyFilter(kernel); else m_img.resetImage(); });
+	QObject::connect(toggle, &QAbstractButton::toggled, [this, kernel](bool checked) {
+		if (checked) process([kernel](ImagePipeline& p) { p.applyFilter(kernel); }, (int)(std::max(kernel.n, kernel.m) + 1) / 2); else process(nullptr);
+	});
 	return toggle;
 }
 
@@ -193,11 +333,112 @@ QAbstractButton* ImageWindow::addHalftoneFilter(const QString& name, Dithering m
 	QAbstractButton* toggle = new QRadioButton(name, m_filters);
 	m_filters->layout()->addWidget(toggle);
 	QObject::connect(toggle, &QAbstractButton::toggled, [this, mode](bool checked) {
-		if (checked) m_img.applyDithering(mode); else m_img.resetImage();
+		//Error diffusion carries error across the whole image, so it cannot be computed per tile
+		const bool diffused = (mode == Dithering::ERROR_DIFFUSION || mode == Dithering::FLOYD_STEINBERG);
+		if (checked) process([mode](ImagePipeline& p) { p.applyDithering(mode); }, diffused ? -1 : 0); else process(nullptr);
 	});
 	return toggle;
 }
 
+QAbstractButton* ImageWindow::addKernelFilter(const QString& name)
+{
+	QAbstractButton* toggle = new QRadioButton(name, m_filters);
+	m_filters->layout()->addWidget(toggle);
+	QObject::connect(toggle, &QAbstractButton::toggled, [this, name](bool checked) {
+		//Looked up when chosen, a file loaded since may have replaced it, wrapping kernels read the whole image
+		const KernelView kernel = m_kernels.find(name);
+		const int halo = (kernel.border == Border::WRAP) ? -1 : (int)(std::max(kernel.n, kernel.m) + 1) / 2;
+		if (checked) process([kernel](ImagePipeline& p) { p.applyFilter(kernel); }, halo); else process(nullptr);
+	});
+	return toggle;
+}
+
+void ImageWindow::processRankFilter()
+{
+	const RankFilter filter(m_rankRadius->value(), m_rankMode->currentData().toFloat());
+	process([filter](ImagePipeline& p) { p.applyRankFilter(filter); }, filter.radius());
+}
+
+void ImageWindow::processWindowOperation()
+{
+	const int radius = m_windowRadius->value();
+
+	switch (m_windowMode->currentIndex())
+	{
+		case 0:
+			process([radius](ImagePipeline& p) { p.applyBoxBlur(radius); }, radius);
+			break;
+
+		case 1:
+			process([radius](ImagePipeline& p) { p.applyLocalDeviation(radius); }, radius);
+			break;
+
+		default:
+			process([radius](ImagePipeline& p) { p.applyAdaptiveThresholding(radius); }, radius);
+	}
+}
+
+void ImageWindow::processGaussianBlur()
+{
+	const float sigma = m_gaussianSigma->value() / 10.0f;
+	process([sigma](ImagePipeline& p) { p.applyGaussianBlur(sigma); }, RecursiveGaussian(sigma).radius());
+}
+
+void ImageWindow::process(const AsyncPipeline::Job& job, int halo)
+{
+	m_job = job;
+	m_halo = halo;
+
+	if (m_tiled)
+	{
+		m_tiles.setJob(job, halo);
+		return;
+	}
+
+	//Preview at the resolution the image is currently shown at, then refine
+	m_img.setPreviewSize(m_imageView->previewSize(m_img.sourceSize()));
+	m_img.submit(job);
+}
+
+void ImageWindow::setTiled(bool tiled)
+{
+	m_tiled = tiled;
+	m_imageView->setTiledSource(tiled ? &m_tiles : nullptr);
+
+	//Bring the mode switched to up to date, the other one is left idle
+	reloadSource();
+}
+
+void ImageWindow::reloadSource()
+{
+	if (m_tiled)
+	{
+		m_tiles.load(m_source);
+		m_tiles.setJob(m_job, m_halo);
+	}
+	else
+	{
+		m_img.load(m_source);
+		process(m_job, m_halo);
+	}
+}
+
+void ImageWindow::updateStatus()
+{
+	QString status = tr("Peak pipeline memory: %1 MB").arg(m_img.peakMemory() / (1024.0 * 1024.0), 0, 'f', 1);
+
+	if (m_profiler.isEnabled())
+	{
+		if (!m_jobTimings.isEmpty())
+			status += " | " + m_jobTimings;
+
+		if (!m_displayTimings.isEmpty())
+			status += " | " + m_displayTimings;
+	}
+
+	statusBar()->showMessage(status);
+}
+
 void ImageWindow::dragEnterEvent(QDragEnterEvent *event)
 {
 	if (event->mimeData()->hasUrls())
@@ -216,33 +457,171 @@ void ImageWindow::dropEvent(QDropEvent* event)
 
 void ImageWindow::loadImage(const QString& imgName)
 {
-	QImage i(imgName);
+	//Raw images are mapped instead of decoded
+	QString error;
+	QImage i = RawImage::isRawImage(imgName) ? RawImage::load(imgName, error) : QImage(imgName);
 
 	if (i.isNull())
 	{
-		qWarning() << "Unable to read image " << imgName;
+		qWarning() << "Unable to read image " << imgName << error;
 	}
 	else
 	{
-		m_img.load(i);
+		m_source = i;
+		m_sourcePath = imgName;
+
+		if (m_tiled)
+		{
+			m_tiles.load(i);
+		}
+		else
+		{
+			m_img.load(i);
+		}
+
 		QMainWindow::setWindowTitle("Image Viewer -- " + QDir(imgName).absolutePath());
 	}
 }
 
 void ImageWindow::saveImage(const QString& saveName)
 {
-	m_img.image().save(saveName);
+	QImage result = m_img.image();
+
+	//Tiles only cover what was viewed, so render the whole image
+	if (m_tiled)
+	{
+		ImagePipeline pipeline;
+		pipeline.load(m_source);
+		pipeline.defer();
+
+		if (m_job)
+			m_job(pipeline);
+
+		pipeline.execute();
+		result = pipeline.image();
+	}
+
+	//Saving over the loaded file writes through the pages a raw image is mapped from, the pipelines keep a copy of it instead
+	if (!m_sourcePath.isEmpty() && QFileInfo(saveName) == QFileInfo(m_sourcePath))
+	{
+		if (result.constBits() == m_source.constBits())
+			result = m_source.copy();
+
+		m_source = m_source.copy();
+		m_sourcePath.clear();
+		reloadSource();
+	}
+
+	writeImage(saveName, result);
+}
+
+void ImageWindow::writeImage(const QString& saveName, const QImage& img)
+{
+	QString error;
+
+	if (saveName.endsWith(QString(".") + RawImage::Suffix, Qt::CaseInsensitive))
+	{
+		if (!RawImage::save(saveName, img, error))
+			qWarning() << "Unable to write image " << saveName << error;
+
+		return;
+	}
+
+	img.save(saveName);
+}
+
+void ImageWindow::setProfiling(bool enabled)
+{
+	//Each profiling session starts a new trace
+	if (enabled)
+		m_profiler.clear();
+
+	m_jobTimings.clear();
+	m_displayTimings.clear();
+	m_stageTimings.clear();
+
+	m_profiler.setEnabled(enabled);
+	updateStatus();
+}
+
+void ImageWindow::profileOperation(const OperationStats& stats)
+{
+	const QString time = QString::number(stats.milliseconds(), 'f', 1);
+
+	if (std::strcmp(stats.name, "fromImage") == 0)
+	{
+		m_displayTimings = tr("display %1 ms").arg(time);
+		return;
+	}
+
+	//The stages of an operation finish before it does on the same thread, deeper ones are left to the trace
+	if (stats.depth == 1)
+		m_stageTimings[stats.thread] << QString("%1 %2 ms").arg(stats.name, time);
+
+	if (stats.depth != 0)
+		return;
+
+	const QStringList stages = m_stageTimings.take(stats.thread);
+
+	m_jobTimings = tr("%1 %2 ms, %3 MP/s, %4 MB touched, %5 allocations")
+		.arg(stats.name, time)
+		.arg(stats.pixelsPerSecond() / 1e6, 0, 'f', 1)
+		.arg(stats.bytes / (1024.0 * 1024.0), 0, 'f', 1)
+		.arg(stats.allocations);
+
+	if (!stages.isEmpty())
+		m_jobTimings += " (" + stages.join(", ") + ")";
+
+	updateStatus();
+}
+
+void ImageWindow::exportTrace()
+{
+	const QString name = QFileDialog::getSaveFileName(this, "Export trace", "", "Chrome trace (*.json)");
+
+	if (name.isEmpty())
+		return;
+
+	QString error;
+
+	if (!m_profiler.writeChromeTrace(name, error))
+		qWarning() << "Unable to write trace " << name << error;
+}
+
+void ImageWindow::loadKernels()
+{
+	const QString name = QFileDialog::getOpenFileName(this, "Load kernels", "", "Kernels (*.json)");
+
+	if (name.isEmpty())
+		return;
+
+	QString error;
+
+	if (!m_kernels.load(name, error))
+	{
+		qWarning() << "Unable to load kernels" << error;
+		return;
+	}
+
+	for (const QString& kernel : m_kernels.names())
+	{
+		if (!m_kernelButtons.contains(kernel))
+		{
+			addKernelFilter(kernel);
+			m_kernelButtons << kernel;
+		}
+	}
 }
 
 void ImageWindow::saveAs()
 {
-	QString name = QFileDialog::getSaveFileName(this, "Save image", "", "Image (*.png *.jpg *.jpeg)");
+	QString name = QFileDialog::getSaveFileName(this, "Save image", "", "Image (*.png *.jpg *.jpeg);;Raw image (*.imgp)");
 	this->saveImage(name);
 }
 
 void ImageWindow::open()
 {
-	QString open = QFileDialog::getOpenFileName(this, "Open image", "", "Image (*.png *.jpg *.jpeg)");
+	QString open = QFileDialog::getOpenFileName(this, "Open image", "", "Image (*.png *.jpg *.jpeg *.imgp)");
 	this->loadImage(open);
 }
 
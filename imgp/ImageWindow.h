@@ -7,11 +7,17 @@
 #include <QMainWindow>
 #include <QImage>
 #include <QAbstractButton>
+#include <QStringList>
+#include <QHash>
 
-#include "ImagePipeline.h"
+#include "AsyncPipeline.h"
+#include "TiledPipeline.h"
+#include "Profiler.h"
+#include "KernelRegistry.h"
 
 class QLabel;
 class QSlider;
+class QComboBox;
 class QGroupBox;
 class QMenu;
 class ImageWidget;
@@ -24,7 +30,7 @@ public:
 
 	explicit ImageWindow(QWidget* parent = nullptr);
 
-	const ImagePipeline& imgproc() const { return m_img; }
+	const AsyncPipeline& imgproc() const { return m_img; }
 
 public slots:
 
@@ -35,15 +41,53 @@ private slots:
 
 	void saveAs();
 	void open();
+	void exportTrace();
+	void loadKernels();
+
+	//Show the timings of the pipelines in the status bar
+	void setProfiling(bool enabled);
+	void profileOperation(const OperationStats& stats);
 
 private:
 
-	ImagePipeline m_img;
+	//Declared first, the pipelines' workers record into it until they are destroyed
+	Profiler m_profiler;
+
+	//Readout of the last job and pixmap upload timed, and the stages of the jobs being timed by the thread running them,
+	//as the proxy, full resolution and tiled pipelines report theirs in between each other's
+	QString m_jobTimings;
+	QString m_displayTimings;
+	QHash<int, QStringList> m_stageTimings;
+
+	AsyncPipeline m_img;
+	TiledPipeline m_tiles;
+
+	//Loaded image, the file it was loaded from, and the job last run on it
+	QImage m_source;
+	QString m_sourcePath;
+	AsyncPipeline::Job m_job;
+	int m_halo;
+	bool m_tiled;
 
 	ImageWidget* m_imageView;
 	QGroupBox* m_filters;
 	QSlider* m_gammaSlider;
 
+	QAbstractButton* m_rankButton;
+	QComboBox* m_rankMode;
+	QSlider* m_rankRadius;
+
+	QAbstractButton* m_windowButton;
+	QComboBox* m_windowMode;
+	QSlider* m_windowRadius;
+
+	QAbstractButton* m_gaussianButton;
+	QSlider* m_gaussianSigma;
+
+	//Kernels loaded at runtime, and the ones with a button in the tools
+	KernelRegistry m_kernels;
+	QStringList m_kernelButtons;
+
 	QMenu* m_fileMenu;
 	QMenu* m_viewMenu;
 
@@ -52,9 +96,39 @@ private:
 	void dragEnterEvent(QDragEnterEvent *event);
 
 
+	/*
+		Run a job on the image, previewing it first, or only on the visible tiles in tiled mode.
+		halo is the number of pixels around each pixel the job reads, negative if it reads the whole image.
+	*/
+	void process(const AsyncPipeline::Job& job, int halo = 0);
+
+	//Switch between processing whole images and visible tiles
+	void setTiled(bool tiled);
+
+	//Load m_source into the pipeline of the current mode and run the last job on it
+	void reloadSource();
+
+	//Write an image, as a raw image if the name has the raw image suffix
+	void writeImage(const QString& saveName, const QImage& img);
+
 	QAbstractButton* addFilter(const QString& name, const KernelView& kernel);
 	QAbstractButton* addHalftoneFilter(const QString& name, Dithering mode);
 
+	//Add a button for a kernel of the registry, which runs the kernel of that name when it is chosen
+	QAbstractButton* addKernelFilter(const QString& name);
+
+	//Run the rank filter chosen in the tools
+	void processRankFilter();
+
+	//Run the windowed operation chosen in the tools
+	void processWindowOperation();
+
+	//Run the Gaussian blur of the sigma chosen in the tools
+	void processGaussianBlur();
+
+	//Show the peak memory, and the timings while profiling
+	void updateStatus();
+
 	// Setup
 	void createActions();
 	QWidget* createTools(QWidget* parent = nullptr);
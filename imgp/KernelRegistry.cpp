@@ -0,0 +1,216 @@
+/*
+	Filter kernels defined at runtime
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "KernelRegistry.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Read an integer which must fit [min, max], numbers with a fraction are not integers
+static bool readInt(const QJsonValue& value, int min, int max, int& out)
+{
+	if (!value.isDouble())
+		return false;
+
+	const double v = value.toDouble();
+
+	if (v != std::floor(v) || v < min || v > max)
+		return false;
+
+	out = (int)v;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool KernelRegistry::load(const QString& path, QString& error)
+{
+	QFile file(path);
+
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		error = path + ": " + file.errorString();
+		return false;
+	}
+
+	if (!parse(file.readAll(), error))
+	{
+		error = path + ": " + error;
+		return false;
+	}
+
+	return true;
+}
+
+bool KernelRegistry::parse(const QByteArray& json, QString& error)
+{
+	QJsonParseError parseError;
+	const QJsonDocument doc = QJsonDocument::fromJson(json, &parseError);
+
+	if (doc.isNull())
+	{
+		error = parseError.errorString() + " at offset " + QString::number(parseError.offset);
+		return false;
+	}
+
+	if (!doc.isObject() || !doc.object().value("kernels").isArray())
+	{
+		error = "expected an object with a \"kernels\" array";
+		return false;
+	}
+
+	//Every kernel is checked before any is added
+	struct Parsed
+	{
+		QString name;
+		std::vector<int> weights;
+		KernelView view;
+	};
+
+	std::vector<Parsed> parsed;
+
+	for (const QJsonValue& value : doc.object().value("kernels").toArray())
+	{
+		const QJsonObject object = value.toObject();
+
+		Parsed kernel;
+		kernel.name = object.value("name").toString().trimmed();
+
+		const QString prefix = "kernel " + QString::number(parsed.size() + 1) + (kernel.name.isEmpty() ? QString() : " (" + kernel.name + ")") + ": ";
+
+		if (kernel.name.isEmpty())
+		{
+			error = prefix + "no name";
+			return false;
+		}
+
+		//Rows of weights
+		const QJsonArray rows = object.value("weights").toArray();
+		const int n = rows.size();
+		const int m = n ? rows[0].toArray().size() : 0;
+
+		if (n == 0 || m == 0 || n > MaxSize || m > MaxSize)
+		{
+			error = prefix + "weights must be 1 to " + QString::number(MaxSize) + " rows of 1 to " + QString::number(MaxSize) + " integers";
+			return false;
+		}
+
+		qint64 magnitude = 0;
+
+		for (const QJsonValue& row : rows)
+		{
+			const QJsonArray weights = row.toArray();
+
+			if (weights.size() != m)
+			{
+				error = prefix + "rows of weights differ in length";
+				return false;
+			}
+
+			for (const QJsonValue& weight : weights)
+			{
+				int w = 0;
+
+				if (!readInt(weight, -65535, 65535, w))
+				{
+					error = prefix + "weights must be integers from -65535 to 65535";
+					return false;
+				}
+
+				kernel.weights.push_back(w);
+				magnitude += std::abs(w);
+			}
+		}
+
+		kernel.view.n = (uint)n;
+		kernel.view.m = (uint)m;
+
+		if (object.contains("divisor") && !readInt(object.value("divisor"), 1, 1 << 24, kernel.view.divisor))
+		{
+			error = prefix + "divisor must be a positive integer";
+			return false;
+		}
+
+		if (object.contains("bias") && !readInt(object.value("bias"), -255, 255, kernel.view.bias))
+		{
+			error = prefix + "bias must be an integer from -255 to 255";
+			return false;
+		}
+
+		const QString border = object.value("border").toString("clamp");
+
+		if (border == "mirror")
+			kernel.view.border = Border::MIRROR;
+		else if (border == "wrap")
+			kernel.view.border = Border::WRAP;
+		else if (border != "clamp")
+		{
+			error = prefix + "border must be clamp, mirror or wrap";
+			return false;
+		}
+
+		//Sums of every channel are 32 bit integers, the bias is added to them times the divisor
+		qint64 sum = 0;
+
+		for (int w : kernel.weights)
+			sum += w;
+
+		const qint64 divisor = kernel.view.divisor ? kernel.view.divisor : std::max<qint64>(sum, 1);
+
+		if (magnitude * 255 + std::abs(kernel.view.bias) * divisor > INT32_MAX)
+		{
+			error = prefix + "weights, divisor and bias are too large";
+			return false;
+		}
+
+		parsed.push_back(std::move(kernel));
+	}
+
+	for (Parsed& kernel : parsed)
+	{
+		m_weights.push_back(std::move(kernel.weights));
+		kernel.view.v = m_weights.back().data();
+
+		auto it = std::find_if(m_kernels.begin(), m_kernels.end(), [&kernel](const Entry& e) { return e.name == kernel.name; });
+
+		if (it != m_kernels.end())
+			it->view = kernel.view;
+		else
+			m_kernels.push_back({ kernel.name, kernel.view });
+	}
+
+	return true;
+}
+
+QStringList KernelRegistry::names() const
+{
+	QStringList list;
+
+	for (const Entry& e : m_kernels)
+		list << e.name;
+
+	return list;
+}
+
+KernelView KernelRegistry::find(const QString& name) const
+{
+	for (const Entry& e : m_kernels)
+	{
+		if (e.name == name)
+			return e.view;
+	}
+
+	return KernelView();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,64 @@
+/*
+	Filter kernels defined at runtime
+*/
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+
+#include "FilterKernels.h"
+
+/*
+	Named filter kernels loaded from JSON files, next to the ones compiled into FilterKernels.h:
+
+	{
+		"kernels": [
+			{ "name": "sharpen", "weights": [[0, -1, 0], [-1, 5, -1], [0, -1, 0]] },
+			{ "name": "relief", "weights": [[-2, -1, 0], [-1, 1, 1], [0, 1, 2]], "divisor": 1, "bias": 128, "border": "mirror" }
+		]
+	}
+
+	weights holds rows of integer weights, all of the same length. divisor defaults to the sum of the weights,
+	bias to 0 and border to "clamp", the others being "mirror" and "wrap", see KernelView.
+
+	Runtime kernels are convolved like the built-in ones, 3x3, 5x5 and 7x7 kernels by their own vectorized
+	instantiations. A kernel replaces any loaded before of the same name, the views of the kernels stay valid
+	as long as the registry.
+*/
+class KernelRegistry
+{
+public:
+
+	//Largest number of rows and columns of a kernel
+	static const int MaxSize = 255;
+
+	/*
+		Add the kernels of a JSON file or document. If any of them is invalid none is added,
+		and error says which and why.
+	*/
+	bool load(const QString& path, QString& error);
+	bool parse(const QByteArray& json, QString& error);
+
+	//Names of the kernels in the order they were first loaded
+	QStringList names() const;
+
+	//Kernel of the given name, with no weights if there is none
+	KernelView find(const QString& name) const;
+
+private:
+
+	struct Entry
+	{
+		QString name;
+		KernelView view;
+	};
+
+	std::vector<Entry> m_kernels;
+
+	//Weights of every kernel loaded, replaced ones included, so views handed out stay valid
+	std::deque<std::vector<int>> m_weights;
+};
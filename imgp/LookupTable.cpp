@@ -0,0 +1,126 @@
+/*
+	Lookup tables for 8-bit point operations
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "LookupTable.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LookupTable::LookupTable()
+{
+	for (int v = 0; v < 256; v++)
+		set(v, (uchar)v);
+}
+
+void LookupTable::set(int v, uchar mapped)
+{
+	m_table[0][v] = mapped;
+	m_table[1][v] = mapped;
+	m_table[2][v] = mapped;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LookupTable LookupTable::gamma(float gamma)
+{
+	LookupTable t;
+
+	for (int v = 0; v < 256; v++)
+		t.set(v, (uchar)(255 * powf((float)v / 255, 1.0f / gamma)));
+
+	return t;
+}
+
+LookupTable LookupTable::threshold(int level)
+{
+	LookupTable t;
+
+	for (int v = 0; v < 256; v++)
+		t.set(v, (v < level) ? 0 : 255);
+
+	return t;
+}
+
+LookupTable LookupTable::levels(int black, int white, float gamma)
+{
+	LookupTable t;
+
+	white = std::max(white, black + 1);
+
+	for (int v = 0; v < 256; v++)
+	{
+		const float x = std::min(std::max((float)(v - black) / (white - black), 0.0f), 1.0f);
+		t.set(v, (uchar)(255 * powf(x, 1.0f / gamma) + 0.5f));
+	}
+
+	return t;
+}
+
+LookupTable LookupTable::curve(const std::vector<QPoint>& points)
+{
+	LookupTable t;
+
+	if (points.empty())
+		return t;
+
+	for (int v = 0; v < 256; v++)
+	{
+		//First control point at or after v
+		auto next = std::lower_bound(points.begin(), points.end(), v, [](const QPoint& p, int x) { return p.x() < x; });
+
+		int mapped;
+
+		if (next == points.begin())
+			mapped = next->y();
+		else if (next == points.end())
+			mapped = points.back().y();
+		else
+		{
+			const QPoint& a = *(next - 1);
+			const QPoint& b = *next;
+			mapped = a.y() + ((b.y() - a.y()) * (v - a.x()) + (b.x() - a.x()) / 2) / (b.x() - a.x());
+		}
+
+		t.set(v, (uchar)std::min(std::max(mapped, 0), 255));
+	}
+
+	return t;
+}
+
+LookupTable LookupTable::then(const LookupTable& next) const
+{
+	LookupTable t;
+
+	for (int c = 0; c < 3; c++)
+		for (int v = 0; v < 256; v++)
+			t.m_table[c][v] = next.m_table[c][m_table[c][v]];
+
+	return t;
+}
+
+bool LookupTable::isGray() const
+{
+	return std::memcmp(m_table[0], m_table[2], 256) == 0 && std::memcmp(m_table[1], m_table[2], 256) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+simd::ChannelTable LookupTable::channelTable() const
+{
+	simd::ChannelTable table;
+
+	for (int v = 0; v < 256; v++)
+	{
+		table.r[v] = (uint32_t)m_table[0][v] << 16;
+		table.g[v] = (uint32_t)m_table[1][v] << 8;
+		table.b[v] = (uint32_t)m_table[2][v];
+	}
+
+	return table;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,60 @@
+/*
+	Lookup tables for 8-bit point operations
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <QPoint>
+
+#include "Simd.h"
+
+/*
+	A 256 entry table per colour channel.
+
+	Any point operation which maps each channel value independently (gamma, threshold, levels, curves)
+	is a table, and a chain of them composes into a single table which is applied in one pass.
+*/
+class LookupTable
+{
+public:
+
+	//Identity table
+	LookupTable();
+
+	//Gamma correction, same as ImagePipeline::setGamma
+	static LookupTable gamma(float gamma);
+
+	//Values below level become 0, all others 255
+	static LookupTable threshold(int level = 128);
+
+	//Stretch [black, white] to the full range, with a gamma correction in between
+	static LookupTable levels(int black, int white, float gamma = 1.0f);
+
+	//Piecewise linear curve through control points (input, output), sorted by input
+	static LookupTable curve(const std::vector<QPoint>& points);
+
+	//Return a table which applies this table followed by next
+	LookupTable then(const LookupTable& next) const;
+
+	uchar red(int v) const { return m_table[0][v]; }
+	uchar green(int v) const { return m_table[1][v]; }
+	uchar blue(int v) const { return m_table[2][v]; }
+
+	//Returns true if every channel has the same mapping, gray images then stay gray
+	bool isGray() const;
+
+	//Table of the blue channel, which is the table of every channel of a gray table
+	const uchar* grayTable() const { return m_table[2]; }
+
+	//Set the same mapping of value v for every channel
+	void set(int v, uchar mapped);
+
+	//Table in the layout of the vectorized lookup kernel
+	simd::ChannelTable channelTable() const;
+
+private:
+
+	uchar m_table[3][256];
+};
@@ -0,0 +1,592 @@
+/*
+	High precision images
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "PreciseImage.h"
+#include "Convolution.h"
+#include "LookupTable.h"
+#include "Simd.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Rows of float images are used as they are, 16-bit rows are converted
+static const float* toFloat(const float* values, float*, int)
+{
+	return values;
+}
+
+static const float* toFloat(const uint16_t* values, float* buffer, int count)
+{
+	simd::wordsToFloat(values, buffer, count);
+	return buffer;
+}
+
+static void fromFloat(const float* values, float* out, int count)
+{
+	if (values != out)
+		std::memcpy(out, values, (size_t)count * sizeof(float));
+}
+
+static void fromFloat(const float* values, uint16_t* out, int count)
+{
+	simd::floatToWords(values, out, count);
+}
+
+static float* computeBuffer(float* line, float*)
+{
+	return line;
+}
+
+static float* computeBuffer(uint16_t*, float* buffer)
+{
+	return buffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+bool PreciseImage<T>::reset(int width, int height, int channels)
+{
+	m_width = width;
+	m_height = height;
+	m_channels = channels;
+
+	const size_t capacity = m_data.capacity();
+	m_data.resize((size_t)width * height * channels);
+
+	return m_data.capacity() != capacity;
+}
+
+template<typename T>
+const float* PreciseImage<T>::loadLine(int c, int y, float* buffer) const
+{
+	return toFloat(line(std::min(c, m_channels - 1), y), buffer, m_width);
+}
+
+template<typename T>
+float* PreciseImage<T>::lineBuffer(int c, int y, float* buffer)
+{
+	return computeBuffer(line(c, y), buffer);
+}
+
+template<typename T>
+void PreciseImage<T>::storeLine(int c, int y, const float* values)
+{
+	fromFloat(values, line(c, y), m_width);
+}
+
+template<typename T>
+void PreciseImage<T>::readRows(const QImage& img, int y0, int y1)
+{
+	const float scale = ChannelTraits<T>::max() / 255;
+
+	thread_local std::vector<float> buffers[3];
+	thread_local std::vector<uchar> gray;
+
+	for (int c = 0; c < 3; c++)
+		buffers[c].resize(m_width);
+
+	for (int y = y0; y < y1; y++)
+	{
+		if (m_channels == 3)
+		{
+			float* r = lineBuffer(0, y, buffers[0].data());
+			float* g = lineBuffer(1, y, buffers[1].data());
+			float* b = lineBuffer(2, y, buffers[2].data());
+
+			simd::unpackRgb(reinterpret_cast<const QRgb*>(img.constScanLine(y)), r, g, b, m_width, scale);
+
+			storeLine(0, y, r);
+			storeLine(1, y, g);
+			storeLine(2, y, b);
+		}
+		else
+		{
+			const uchar* values = img.constScanLine(y);
+
+			//Binary rows are expanded to black and white gray values first
+			if (img.format() == QImage::Format_MonoLSB)
+			{
+				gray.resize(m_width);
+
+				for (int i = 0; i < m_width; i++)
+					gray[i] = ((values[i / 8] >> (i % 8)) & 1) ? 255 : 0;
+
+				values = gray.data();
+			}
+
+			float* v = lineBuffer(0, y, buffers[0].data());
+			simd::unpackGray(values, v, m_width, scale);
+			storeLine(0, y, v);
+		}
+	}
+}
+
+template<typename T>
+void PreciseImage<T>::writeRows(uchar* bits, int stride, int y0, int y1) const
+{
+	const float scale = 255 / ChannelTraits<T>::max();
+
+	thread_local std::vector<float> buffers[3];
+
+	for (int c = 0; c < 3; c++)
+		buffers[c].resize(m_width);
+
+	for (int y = y0; y < y1; y++)
+	{
+		uchar* out = bits + (size_t)y * stride;
+
+		if (m_channels == 3)
+		{
+			const float* r = loadLine(0, y, buffers[0].data());
+			const float* g = loadLine(1, y, buffers[1].data());
+			const float* b = loadLine(2, y, buffers[2].data());
+
+			simd::packRgb(r, g, b, reinterpret_cast<QRgb*>(out), m_width, scale);
+		}
+		else
+		{
+			simd::packGray(loadLine(0, y, buffers[0].data()), out, m_width, scale);
+		}
+	}
+}
+
+template<typename T>
+void PreciseImage<T>::storeRows(const PreciseImage& rows, int y)
+{
+	for (int c = 0; c < m_channels; c++)
+	{
+		for (int r = 0; r < rows.height(); r++)
+			simd::streamCopy(rows.line(c, r), line(c, y + r), (size_t)m_width * sizeof(T));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static void roundValues(float* values, int count)
+{
+}
+
+template<>
+void roundValues<uint16_t>(float* values, int count)
+{
+	thread_local std::vector<uint16_t> words;
+	words.resize(count);
+
+	simd::floatToWords(values, words.data(), count);
+	simd::wordsToFloat(words.data(), values, count);
+}
+
+template<typename T>
+ByteImage<T>::ByteImage(const QImage& img) :
+	ByteImage(img, nullptr, 0, false)
+{
+}
+
+template<typename T>
+ByteImage<T>::ByteImage(const QImage& img, const std::vector<float>* tables, int channels, bool gray) :
+	m_img(img),
+	m_tables(tables),
+	m_rgb(img.depth() == 32),
+	m_channels(tables ? channels : m_rgb ? 3 : 1),
+	m_gray(gray)
+{
+}
+
+template<typename T>
+const uchar* ByteImage<T>::grayValues(int y) const
+{
+	const uchar* values = m_img.constScanLine(y);
+
+	if (m_img.format() != QImage::Format_MonoLSB)
+		return values;
+
+	thread_local std::vector<uchar> gray;
+	gray.resize(width());
+
+	for (int i = 0; i < width(); i++)
+		gray[i] = ((values[i / 8] >> (i % 8)) & 1) ? 255 : 0;
+
+	return gray.data();
+}
+
+template<typename T>
+void ByteImage<T>::mapLine(int c, int y, float* out) const
+{
+	if (m_tables)
+		lookupLine(c, y, m_tables[std::min(c, m_channels - 1)].data(), out);
+	else if (m_rgb)
+		simd::unpackChannel(reinterpret_cast<const QRgb*>(m_img.constScanLine(y)), out, width(), 16 - 8 * c, ChannelTraits<T>::max() / 255);
+	else
+		simd::unpackGray(grayValues(y), out, width(), ChannelTraits<T>::max() / 255);
+}
+
+template<typename T>
+const float* ByteImage<T>::loadLine(int c, int y, float* buffer) const
+{
+	if (m_gray)
+		grayscaleLine(y, buffer);
+	else
+		mapLine(c, y, buffer);
+
+	return buffer;
+}
+
+template<typename T>
+void ByteImage<T>::lookupLine(int c, int y, const float* table, float* out) const
+{
+	if (m_rgb)
+	{
+		simd::lookupChannel(reinterpret_cast<const QRgb*>(m_img.constScanLine(y)), out, width(), 16 - 8 * c, table);
+	}
+	else
+	{
+		const uchar* values = grayValues(y);
+
+		for (int i = 0; i < width(); i++)
+			out[i] = table[values[i]];
+	}
+}
+
+template<typename T>
+void ByteImage<T>::grayscaleLine(int y, float* out) const
+{
+	//Gray channels are only read in
+	if (m_channels == 1)
+	{
+		mapLine(0, y, out);
+	}
+	else if (!m_tables)
+	{
+		simd::unpackGrayscale(reinterpret_cast<const QRgb*>(m_img.constScanLine(y)), out, width(), ChannelTraits<T>::max() / 255);
+	}
+	else
+	{
+		thread_local std::vector<float> buffers[3];
+
+		for (int c = 0; c < 3; c++)
+		{
+			buffers[c].resize(width());
+			mapLine(c, y, buffers[c].data());
+		}
+
+		simd::grayscale(buffers[0].data(), buffers[1].data(), buffers[2].data(), out, width());
+	}
+
+	//Computed values are rounded as a stored plane would be
+	if (m_channels != 1)
+		roundValues<T>(out, width());
+}
+
+template<typename T>
+void ByteImage<T>::writeRows(uchar* bits, int stride, int y0, int y1) const
+{
+	const float scale = 255 / ChannelTraits<T>::max();
+
+	thread_local std::vector<float> buffers[3];
+
+	for (int c = 0; c < 3; c++)
+		buffers[c].resize(width());
+
+	for (int y = y0; y < y1; y++)
+	{
+		uchar* out = bits + (size_t)y * stride;
+
+		if (channels() == 3)
+		{
+			const float* r = loadLine(0, y, buffers[0].data());
+			const float* g = loadLine(1, y, buffers[1].data());
+			const float* b = loadLine(2, y, buffers[2].data());
+
+			simd::packRgb(r, g, b, reinterpret_cast<QRgb*>(out), width(), scale);
+		}
+		else
+		{
+			simd::packGray(loadLine(0, y, buffers[0].data()), out, width(), scale);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PreciseCurve::PreciseCurve(int segments, bool gray) :
+	m_segments(segments),
+	m_gray(gray)
+{
+	for (int c = 0; c < 3; c++)
+		m_samples[c].resize(segments + 1);
+}
+
+PreciseCurve::PreciseCurve(const LookupTable& table) :
+	PreciseCurve(255, table.isGray())
+{
+	for (int v = 0; v < 256; v++)
+	{
+		m_samples[0][v] = table.red(v) / 255.0f;
+		m_samples[1][v] = table.green(v) / 255.0f;
+		m_samples[2][v] = table.blue(v) / 255.0f;
+	}
+}
+
+PreciseCurve PreciseCurve::gamma(float gamma)
+{
+	//The power function bends most near 0, from the first 8-bit step up 4096 segments keep the error below a 16-bit step
+	const int segments = 4096;
+	PreciseCurve curve(segments, true);
+
+	for (int i = 0; i <= segments; i++)
+	{
+		const float v = powf((float)i / segments, 1.0f / gamma);
+
+		for (int c = 0; c < 3; c++)
+			curve.m_samples[c][i] = v;
+	}
+
+	return curve;
+}
+
+std::vector<float> PreciseCurve::samples(int c, float max) const
+{
+	std::vector<float> scaled(m_samples[c]);
+
+	for (float& v : scaled)
+		v *= max;
+
+	return scaled;
+}
+
+std::vector<float> PreciseCurve::map(int c, const std::vector<float>& values, float max) const
+{
+	std::vector<float> out(values.size());
+	simd::interpolate(values.data(), out.data(), (int)values.size(), samples(c, max).data(), m_segments, m_segments / max);
+
+	return out;
+}
+
+std::vector<float> PreciseCurve::table(int c, float max) const
+{
+	uchar values[256];
+
+	for (int v = 0; v < 256; v++)
+		values[v] = (uchar)v;
+
+	std::vector<float> in(256);
+	simd::unpackGray(values, in.data(), 256, max / 255);
+
+	return map(c, in, max);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+void precise::grayscale(const PreciseImage<T>& in, PreciseImage<T>& out, int y0, int y1)
+{
+	const int width = in.width();
+
+	thread_local std::vector<float> buffers[4];
+
+	for (int c = 0; c < 4; c++)
+		buffers[c].resize(width);
+
+	for (int y = y0; y < y1; y++)
+	{
+		float* gray = out.lineBuffer(0, y - y0, buffers[3].data());
+
+		//Gray images only have their channel copied
+		if (in.channels() == 1)
+			std::memcpy(gray, in.loadLine(0, y, buffers[0].data()), (size_t)width * sizeof(float));
+		else
+			simd::grayscale(in.loadLine(0, y, buffers[0].data()), in.loadLine(1, y, buffers[1].data()), in.loadLine(2, y, buffers[2].data()), gray, width);
+
+		out.storeLine(0, y - y0, gray);
+	}
+}
+
+template<typename T>
+void precise::grayscale(const ByteImage<T>& in, PreciseImage<T>& out, int y0, int y1)
+{
+	thread_local std::vector<float> buffer;
+	buffer.resize(in.width());
+
+	for (int y = y0; y < y1; y++)
+	{
+		float* gray = out.lineBuffer(0, y - y0, buffer.data());
+		in.grayscaleLine(y, gray);
+		out.storeLine(0, y - y0, gray);
+	}
+}
+
+template<typename Image, typename T>
+void precise::lookup(const Image& in, PreciseImage<T>& out, const std::vector<float>* samples, int segments, int y0, int y1)
+{
+	const int width = in.width();
+	const float scale = segments / ChannelTraits<T>::max();
+
+	thread_local std::vector<float> buffers[2];
+
+	for (int c = 0; c < 2; c++)
+		buffers[c].resize(width);
+
+	for (int y = y0; y < y1; y++)
+	{
+		for (int c = 0; c < out.channels(); c++)
+		{
+			float* values = out.lineBuffer(c, y - y0, buffers[1].data());
+			simd::interpolate(in.loadLine(c, y, buffers[0].data()), values, width, samples[c].data(), segments, scale);
+			out.storeLine(c, y - y0, values);
+		}
+	}
+}
+
+template<typename T>
+void precise::lookup(const ByteImage<T>& in, PreciseImage<T>& out, const std::vector<float>* tables, int y0, int y1)
+{
+	thread_local std::vector<float> buffer;
+	buffer.resize(in.width());
+
+	for (int y = y0; y < y1; y++)
+	{
+		for (int c = 0; c < out.channels(); c++)
+		{
+			float* values = out.lineBuffer(c, y - y0, buffer.data());
+			in.lookupLine(c, y, tables[c].data(), values);
+			out.storeLine(c, y - y0, values);
+		}
+	}
+}
+
+template<typename Image, typename T>
+void precise::convolve(const Image& in, PreciseImage<T>& out, const Convolution& convolution, int y0, int y1)
+{
+	const int width = in.width();
+	const int height = in.height();
+
+	const int rows = convolution.rows();
+	const int cols = convolution.cols();
+
+	//Kernel extent left of and above the centre tap
+	const int left = cols >> 1;
+	const int top = rows >> 1;
+
+	const float scale = 1.0f / convolution.factor();
+	const float max = ChannelTraits<T>::max();
+
+	//Sums start from the bias times the divisor, in the units of the channels
+	const float offset = convolution.offset() * (max / 255.0f);
+
+	//Weights as floats, the column factors followed by the row factors for a separable kernel
+	const bool separable = convolution.isSeparable();
+
+	thread_local std::vector<float> weights;
+	weights.clear();
+
+	if (separable)
+	{
+		weights.insert(weights.end(), convolution.columnFactors().begin(), convolution.columnFactors().end());
+		weights.insert(weights.end(), convolution.rowFactors().begin(), convolution.rowFactors().end());
+	}
+	else
+	{
+		weights.assign(convolution.weights().begin(), convolution.weights().end());
+	}
+
+	thread_local std::vector<float> buffers;
+	thread_local std::vector<float> sums;
+	thread_local std::vector<float> extended;
+	thread_local std::vector<float> accum;
+	thread_local std::vector<const float*> lines;
+
+	//Direct kernels extend every row they read, separable ones only the column sums
+	const int span = width + cols - 1;
+
+	buffers.resize((size_t)rows * width);
+	sums.resize(width);
+	extended.resize((size_t)(separable ? 1 : rows) * span);
+	accum.resize(width);
+	lines.resize(separable ? std::max(rows, cols) : rows * cols);
+
+	auto borderLine = [&](int c, int y, int ky) {
+		return in.loadLine(c, convolution.borderIndex(y + ky - top, height), buffers.data() + (size_t)ky * width);
+	};
+
+	//Extend a row past its ends with the values the border mode reads, every tap then reads a whole row shifted by its column
+	auto extend = [&](const float* values, int ky) {
+		float* row = extended.data() + (size_t)ky * span;
+
+		for (int i = 0; i < left; i++)
+			row[i] = values[convolution.borderIndex(i - left, width)];
+
+		std::memcpy(row + left, values, (size_t)width * sizeof(float));
+
+		for (int i = left + width; i < span; i++)
+			row[i] = values[convolution.borderIndex(i - left, width)];
+
+		for (int kx = 0; kx < cols; kx++)
+			lines[ky * cols + kx] = row + kx;
+	};
+
+	for (int y = y0; y < y1; y++)
+	{
+		for (int c = 0; c < out.channels(); c++)
+		{
+			float* result = out.lineBuffer(c, y - y0, accum.data());
+			std::fill(result, result + width, offset);
+
+			//A separable kernel sums its columns first, then runs its row over the sums
+			if (separable)
+			{
+				for (int ky = 0; ky < rows; ky++)
+					lines[ky] = borderLine(c, y, ky);
+
+				std::fill(sums.begin(), sums.end(), 0.0f);
+				simd::weightedSum(lines.data(), weights.data(), rows, sums.data(), width);
+
+				extend(sums.data(), 0);
+				simd::weightedSum(lines.data(), weights.data() + rows, cols, result, width);
+			}
+			else
+			{
+				//Every tap in one sweep, so the sums stay in registers
+				for (int ky = 0; ky < rows; ky++)
+					extend(borderLine(c, y, ky), ky);
+
+				simd::weightedSum(lines.data(), weights.data(), rows * cols, result, width);
+			}
+
+			simd::clampScaled(result, width, scale, max);
+			out.storeLine(c, y - y0, result);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template class PreciseImage<uint16_t>;
+template class PreciseImage<float>;
+
+template class ByteImage<uint16_t>;
+template class ByteImage<float>;
+
+template void precise::grayscale(const PreciseImage<uint16_t>&, PreciseImage<uint16_t>&, int, int);
+template void precise::grayscale(const PreciseImage<float>&, PreciseImage<float>&, int, int);
+template void precise::grayscale(const ByteImage<uint16_t>&, PreciseImage<uint16_t>&, int, int);
+template void precise::grayscale(const ByteImage<float>&, PreciseImage<float>&, int, int);
+
+template void precise::lookup(const PreciseImage<uint16_t>&, PreciseImage<uint16_t>&, const std::vector<float>*, int, int, int);
+template void precise::lookup(const PreciseImage<float>&, PreciseImage<float>&, const std::vector<float>*, int, int, int);
+template void precise::lookup(const ByteImage<uint16_t>&, PreciseImage<uint16_t>&, const std::vector<float>*, int, int, int);
+template void precise::lookup(const ByteImage<float>&, PreciseImage<float>&, const std::vector<float>*, int, int, int);
+template void precise::lookup(const ByteImage<uint16_t>&, PreciseImage<uint16_t>&, const std::vector<float>*, int, int);
+template void precise::lookup(const ByteImage<float>&, PreciseImage<float>&, const std::vector<float>*, int, int);
+
+template void precise::convolve(const PreciseImage<uint16_t>&, PreciseImage<uint16_t>&, const Convolution&, int, int);
+template void precise::convolve(const PreciseImage<float>&, PreciseImage<float>&, const Convolution&, int, int);
+template void precise::convolve(const ByteImage<uint16_t>&, PreciseImage<uint16_t>&, const Convolution&, int, int);
+template void precise::convolve(const ByteImage<float>&, PreciseImage<float>&, const Convolution&, int, int);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
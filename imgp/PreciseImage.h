@@ -0,0 +1,206 @@
+/*
+	High precision images
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <QImage>
+
+class Convolution;
+class LookupTable;
+
+//Channel value range of a pixel type, the 8-bit value v is v * max() / 255
+template<typename T> struct ChannelTraits;
+
+template<> struct ChannelTraits<uint16_t>
+{
+	static float max() { return 65535.0f; }
+};
+
+template<> struct ChannelTraits<float>
+{
+	static float max() { return 1.0f; }
+};
+
+/*
+	Planar image of 16-bit integer or float channels, either one gray channel or red, green and blue.
+
+	The pipeline keeps its current image in one of these when it runs at a higher precision, so a chain of
+	operations is only rounded to 8 bits where its result is handed out. Kernels compute in float rows either
+	way, 16-bit rows are converted as they are loaded and stored, which halves their memory and bandwidth
+	for a rounding to 1/65535 between operations. Like the 8-bit kernels, results are opaque.
+*/
+template<typename T>
+class PreciseImage
+{
+public:
+
+	PreciseImage() :
+		m_width(0),
+		m_height(0),
+		m_channels(0)
+	{}
+
+	//Resize the image, its storage is kept if it is large enough, returns true if it had to be reallocated
+	bool reset(int width, int height, int channels);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	int channels() const { return m_channels; }
+
+	qint64 sizeInBytes() const { return (qint64)m_data.capacity() * sizeof(T); }
+
+	T* line(int c, int y) { return m_data.data() + ((size_t)c * m_height + y) * m_width; }
+	const T* line(int c, int y) const { return m_data.data() + ((size_t)c * m_height + y) * m_width; }
+
+	//Return row y of channel c as floats in the range of T, converted into buffer unless T is float, a gray image has its channel at every c
+	const float* loadLine(int c, int y, float* buffer) const;
+
+	//Return where row y of channel c can be computed as floats, the row itself if T is float and buffer otherwise, storeLine() then stores it
+	float* lineBuffer(int c, int y, float* buffer);
+
+	//Store floats in the range of T into row y of channel c, 16-bit values are rounded
+	void storeLine(int c, int y, const float* values);
+
+	//Read rows [y0, y1) of a working format (3 channels), gray scale or binary (1 channel) image of the same size
+	void readRows(const QImage& img, int y0, int y1);
+
+	//Round rows [y0, y1) into the rows of a working format image, or of a gray scale image for a single channel
+	void writeRows(uchar* bits, int stride, int y0, int y1) const;
+
+	//Copy the rows of an image of the same width and channels in from row y on, without keeping them in cache
+	void storeRows(const PreciseImage& rows, int y);
+
+private:
+
+	int m_width;
+	int m_height;
+	int m_channels;
+
+	std::vector<T> m_data;
+};
+
+/*
+	8-bit working format, gray scale or binary image read like a PreciseImage<T>, in the range of T,
+	optionally mapped through a table of 256 values per channel and converted to gray.
+
+	The first operation at a higher precision reads the 8-bit image through one of these, a row of a channel
+	at a time while the row is in cache, instead of converting the whole image into a PreciseImage first.
+	Point operations on the 8-bit image only map its 256 values, the tables stand for their result, and
+	gray values are computed from the channels again wherever they are read.
+*/
+template<typename T>
+class ByteImage
+{
+public:
+
+	explicit ByteImage(const QImage& img);
+
+	//Image mapped through tables of channels channels in the range of T unless tables is null, then converted to gray if gray is true
+	ByteImage(const QImage& img, const std::vector<float>* tables, int channels, bool gray);
+
+	int width() const { return m_img.width(); }
+	int height() const { return m_img.height(); }
+	int channels() const { return m_gray ? 1 : m_channels; }
+
+	//Returns true if rows are the values of the 8-bit image as they are
+	bool isPlain() const { return !m_tables && !m_gray; }
+
+	//Convert row y of channel c into buffer and return it, a gray image has its channel at every c
+	const float* loadLine(int c, int y, float* buffer) const;
+
+	//Map row y of channel c of the 8-bit image through a table of 256 floats, one per 8-bit value
+	void lookupLine(int c, int y, const float* table, float* out) const;
+
+	//Convert row y to gray values like precise::grayscale(), 8-bit colour rows from their exact weighted sums
+	void grayscaleLine(int y, float* out) const;
+
+	//Round rows [y0, y1) like PreciseImage::writeRows()
+	void writeRows(uchar* bits, int stride, int y0, int y1) const;
+
+private:
+
+	//Row y of channel c before the conversion to gray
+	void mapLine(int c, int y, float* out) const;
+
+	//Row y as gray values, binary rows are expanded to black and white
+	const uchar* grayValues(int y) const;
+
+	const QImage& m_img;
+	const std::vector<float>* m_tables;
+
+	//Whether the 8-bit image has colour channels, the number of channels mapped from it and whether they are converted to gray
+	bool m_rgb;
+	int m_channels;
+	bool m_gray;
+};
+
+/*
+	Point operation of the high precision path, a piecewise linear curve per colour channel.
+
+	A lookup table becomes the curve through its 256 entries. Gamma correction is sampled from the power
+	function itself at 4096 segments, so values between the 8-bit steps are mapped along the curve
+	instead of being truncated to the step below.
+*/
+class PreciseCurve
+{
+public:
+
+	explicit PreciseCurve(const LookupTable& table);
+
+	static PreciseCurve gamma(float gamma);
+
+	//Returns true if every channel has the same curve, gray images then stay gray
+	bool isGray() const { return m_gray; }
+
+	int segments() const { return m_segments; }
+
+	//The segments + 1 samples of channel c, scaled to the range [0, max]
+	std::vector<float> samples(int c, float max) const;
+
+	//Map values in the range [0, max] through channel c, exactly as precise::lookup() maps the values of a PreciseImage
+	std::vector<float> map(int c, const std::vector<float>& values, float max) const;
+
+	//Channel c of the curve at the 256 8-bit values, as map() would map them once read in at the range [0, max]
+	std::vector<float> table(int c, float max) const;
+
+private:
+
+	PreciseCurve(int segments, bool gray);
+
+	int m_segments;
+	bool m_gray;
+
+	//Samples of every channel in the range [0, 1]
+	std::vector<float> m_samples[3];
+};
+
+/*
+	Kernels of the high precision path, run over rows [y0, y1) of the input into the rows of out from 0, which
+	has the width of the input and the number of channels it should have. The input is a PreciseImage<T> or,
+	for the first operation, a ByteImage<T>.
+*/
+namespace precise
+{
+	//Convert colour rows to gray, with the weights of qGray() but without truncating
+	template<typename T>
+	void grayscale(const PreciseImage<T>& in, PreciseImage<T>& out, int y0, int y1);
+
+	template<typename T>
+	void grayscale(const ByteImage<T>& in, PreciseImage<T>& out, int y0, int y1);
+
+	//Map rows through the samples of a curve per channel, which out may have more of than in
+	template<typename Image, typename T>
+	void lookup(const Image& in, PreciseImage<T>& out, const std::vector<float>* samples, int segments, int y0, int y1);
+
+	//Map the rows of a plain 8-bit image through the tables of a curve per channel, see PreciseCurve::table()
+	template<typename T>
+	void lookup(const ByteImage<T>& in, PreciseImage<T>& out, const std::vector<float>* tables, int y0, int y1);
+
+	//Convolve rows with a filter kernel, clamping at the image borders like the 8-bit kernels
+	template<typename Image, typename T>
+	void convolve(const Image& in, PreciseImage<T>& out, const Convolution& convolution, int y0, int y1);
+}
@@ -0,0 +1,113 @@
+/*
+	Timing of pipeline operations
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <QFile>
+
+#include "Profiler.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Profiler::Profiler(QObject* parent) :
+	QObject(parent),
+	m_enabled(false),
+	m_epoch(now())
+{
+	qRegisterMetaType<OperationStats>();
+}
+
+qint64 Profiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::record(OperationStats stats)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		//Few threads run operations, a linear search is enough
+		const std::thread::id id = std::this_thread::get_id();
+		auto it = std::find(m_threads.begin(), m_threads.end(), id);
+
+		if (it == m_threads.end())
+			it = m_threads.insert(m_threads.end(), id);
+
+		stats.thread = (int)(it - m_threads.begin());
+
+		if ((int)m_operations.size() < MaxOperations)
+			m_operations.push_back(stats);
+	}
+
+	operationProfiled(stats);
+}
+
+std::vector<OperationStats> Profiler::operations() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_operations;
+}
+
+void Profiler::clear()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_operations.clear();
+}
+
+bool Profiler::writeChromeTrace(const QString& path, QString& error) const
+{
+	const std::vector<OperationStats> ops = operations();
+
+	QFile file(path);
+
+	if (!file.open(QIODevice::WriteOnly))
+	{
+		error = file.errorString();
+		return false;
+	}
+
+	//Events are written as they are formatted, traces can hold a million of them
+	QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	char event[512];
+	bool written = true;
+
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		const OperationStats& s = ops[i];
+
+		//Timestamps are in microseconds
+		std::snprintf(event, sizeof(event),
+			"{\"name\":\"%s\",\"cat\":\"imgp\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+			"\"args\":{\"pixels\":%lld,\"bytes\":%lld,\"allocations\":%d,\"mpix_per_s\":%.2f}}%s\n",
+			s.name, s.thread, (s.start - m_epoch) / 1e3, s.duration / 1e3,
+			(long long)s.pixels, (long long)s.bytes, s.allocations, s.pixelsPerSecond() / 1e6, (i + 1 < ops.size()) ? "," : "");
+
+		json += event;
+
+		if (json.size() >= 1024 * 1024)
+		{
+			written = (file.write(json) == json.size());
+
+			if (!written)
+				break;
+
+			json.clear();
+		}
+	}
+
+	json += "]}\n";
+
+	if (!written || file.write(json) != json.size())
+	{
+		error = file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,142 @@
+/*
+	Timing of pipeline operations
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QObject>
+#include <QString>
+
+//Timing and counters of one run of an operation
+struct OperationStats
+{
+	//Name of the operation, a string literal
+	const char* name;
+
+	//Start, see Profiler::now(), and wall time in nanoseconds
+	qint64 start;
+	qint64 duration;
+
+	//Pixels of the input image, and bytes of the images read and written
+	qint64 pixels;
+	qint64 bytes;
+
+	//Image buffers allocated by the operation
+	int allocations;
+
+	//Number of operations this one runs inside of, e.g. the stages of a chain have a depth of 1
+	int depth;
+
+	//Thread the operation ran on, numbered from 0 in the order threads first recorded an operation
+	int thread;
+
+	double milliseconds() const { return duration / 1e6; }
+	double pixelsPerSecond() const { return duration > 0 ? pixels * 1e9 / duration : 0.0; }
+};
+
+Q_DECLARE_METATYPE(OperationStats)
+
+/*
+	Collects the timings of pipeline operations, for a live readout and for offline analysis.
+
+	Pipelines given a profiler time every operation they run while it is enabled, and report it through
+	operationProfiled, on the thread that ran it. A disabled profiler, or none, costs a pipeline one check
+	per operation. Recorded operations are kept until they are cleared, up to MaxOperations, and can be
+	written out as a Chrome trace (chrome://tracing, Perfetto) where nested operations show as a call stack.
+
+	Recording is thread safe, one profiler can be shared by several pipelines.
+*/
+class Profiler : public QObject
+{
+	Q_OBJECT
+
+public:
+
+	//Operations kept for the trace, later ones are still reported but not kept
+	static const int MaxOperations = 1 << 20;
+
+	explicit Profiler(QObject* parent = nullptr);
+
+	//Profilers start disabled
+	bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+	void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+
+	//Monotonic time in nanoseconds
+	static qint64 now();
+
+	//Record a finished operation, its thread is set here
+	void record(OperationStats stats);
+
+	//Operations recorded so far, in the order they finished
+	std::vector<OperationStats> operations() const;
+
+	//Drop the recorded operations
+	void clear();
+
+	/*
+		Write the recorded operations to a file in the Chrome trace event format, as complete events with
+		their counters as arguments. Returns false and sets error on failure.
+	*/
+	bool writeChromeTrace(const QString& path, QString& error) const;
+
+signals:
+
+	void operationProfiled(const OperationStats& stats);
+
+private:
+
+	std::atomic<bool> m_enabled;
+
+	//Time the trace starts at
+	const qint64 m_epoch;
+
+	mutable std::mutex m_lock;
+	std::vector<OperationStats> m_operations;
+	std::vector<std::thread::id> m_threads;
+};
+
+/*
+	Times the scope it lives in as an operation, if the profiler is enabled. The counters are filled in by the owner.
+*/
+class ProfileScope
+{
+public:
+
+	ProfileScope(Profiler* profiler, const char* name) :
+		m_profiler((profiler && profiler->isEnabled()) ? profiler : nullptr)
+	{
+		if (!m_profiler)
+			return;
+
+		m_stats = OperationStats();
+		m_stats.name = name;
+		m_stats.start = Profiler::now();
+	}
+
+	~ProfileScope()
+	{
+		if (!m_profiler)
+			return;
+
+		m_stats.duration = Profiler::now() - m_stats.start;
+		m_profiler->record(m_stats);
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	bool isActive() const { return m_profiler != nullptr; }
+
+	//Counters of the operation, only meaningful while active
+	OperationStats& stats() { return m_stats; }
+
+private:
+
+	Profiler* m_profiler;
+	OperationStats m_stats;
+};
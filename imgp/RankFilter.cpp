@@ -0,0 +1,342 @@
+/*
+	Rank filter engine
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "RankFilter.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*
+	Histograms are split into 16 coarse bins of 16 fine bins. The neighbourhood's coarse histogram is kept
+	up to date for every pixel, a fine segment is only brought up to date once the rank falls into it.
+*/
+static const int Bins = 256;
+static const int Coarse = 16;
+static const int Fine = Bins / Coarse;
+
+//Neighbourhood histogram of one channel
+struct KernelHistogram
+{
+	uint16_t coarse[Coarse];
+	uint16_t fine[Coarse][Fine];
+
+	//Column the fine segment was last updated at
+	int updated[Coarse];
+};
+
+static int clamp(int v, int size)
+{
+	return std::max(0, std::min(size - 1, v));
+}
+
+/*
+	Add column histogram bins to a neighbourhood histogram, and remove another column's.
+	The bins are copied first, uint8_t may alias the histogram and would keep the loops from vectorizing.
+*/
+template<int N>
+static void slide(uint16_t* hist, const uint8_t* added, const uint8_t* removed)
+{
+	uint8_t a[N];
+	uint8_t b[N];
+	std::memcpy(a, added, N);
+	std::memcpy(b, removed, N);
+
+	for (int i = 0; i < N; i++)
+		hist[i] += a[i] - b[i];
+}
+
+template<int N>
+static void accumulate(uint16_t* hist, const uint8_t* added)
+{
+	uint8_t a[N];
+	std::memcpy(a, added, N);
+
+	for (int i = 0; i < N; i++)
+		hist[i] += a[i];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+RankFilter::RankFilter(int radius, float percentile) :
+	m_radius(std::max(1, std::min(MaxRadius, radius))),
+	m_percentile(std::max(0.0f, std::min(100.0f, percentile)))
+{
+	const int size = 2 * m_radius + 1;
+	const int count = size * size;
+
+	m_rank = std::min(count - 1, (int)std::lround(m_percentile / 100.0f * (count - 1)));
+}
+
+void RankFilter::filterSorted(const QImage& img, int y0, int y1, uchar* out, int stride) const
+{
+	//Sorting network for 9 values
+	static const int network[25][2] = {
+		{ 0, 1 }, { 3, 4 }, { 6, 7 }, { 1, 2 }, { 4, 5 }, { 7, 8 }, { 0, 1 }, { 3, 4 }, { 6, 7 },
+		{ 0, 3 }, { 3, 6 }, { 0, 3 }, { 1, 4 }, { 4, 7 }, { 1, 4 }, { 2, 5 }, { 5, 8 }, { 2, 5 },
+		{ 1, 3 }, { 5, 7 }, { 2, 6 }, { 4, 6 }, { 2, 4 }, { 2, 3 }, { 5, 6 },
+	};
+
+	const int width = img.width();
+	const int height = img.height();
+	const bool gray = img.format() == QImage::Format_Grayscale8;
+	const int channels = gray ? 1 : 3;
+
+	//Each neighbour of a row's pixels in its own plane, so every compare and swap runs across the whole row
+	thread_local std::vector<uint8_t> planes;
+	planes.resize((size_t)9 * channels * width);
+
+	auto plane = [&](int i, int c) { return planes.data() + ((size_t)i * channels + c) * width; };
+
+	for (int y = y0; y < y1; y++)
+	{
+		for (int dy = 0; dy < 3; dy++)
+		{
+			//Gray values are a plane already, shifted by one pixel either way
+			if (gray)
+			{
+				const uchar* values = img.constScanLine(clamp(y + dy - 1, height));
+
+				uint8_t* left = plane(dy * 3, 0);
+				left[0] = values[0];
+				std::memcpy(left + 1, values, width - 1);
+
+				std::memcpy(plane(dy * 3 + 1, 0), values, width);
+
+				uint8_t* right = plane(dy * 3 + 2, 0);
+				std::memcpy(right, values + 1, width - 1);
+				right[width - 1] = values[width - 1];
+
+				continue;
+			}
+
+			const QRgb* line = reinterpret_cast<const QRgb*>(img.constScanLine(clamp(y + dy - 1, height)));
+
+			for (int dx = 0; dx < 3; dx++)
+			{
+				uint8_t* r = plane(dy * 3 + dx, 0);
+				uint8_t* g = plane(dy * 3 + dx, 1);
+				uint8_t* b = plane(dy * 3 + dx, 2);
+
+				//Neighbours of x are at x + dx - 1, clamped
+				const int first = dx == 0 ? 1 : 0;
+				const int last = dx == 2 ? width - 1 : width;
+				const QRgb* src = line + dx - 1;
+
+				for (int x = first; x < last; x++)
+				{
+					const QRgb p = src[x];
+					r[x] = qRed(p);
+					g[x] = qGreen(p);
+					b[x] = qBlue(p);
+				}
+
+				if (first)
+				{
+					r[0] = qRed(line[0]);
+					g[0] = qGreen(line[0]);
+					b[0] = qBlue(line[0]);
+				}
+
+				if (last < width)
+				{
+					r[last] = qRed(line[last]);
+					g[last] = qGreen(line[last]);
+					b[last] = qBlue(line[last]);
+				}
+			}
+		}
+
+		for (int c = 0; c < channels; c++)
+		{
+			for (const auto& pair : network)
+			{
+				uint8_t* lo = plane(pair[0], c);
+				uint8_t* hi = plane(pair[1], c);
+
+				for (int x = 0; x < width; x++)
+				{
+					const uint8_t a = lo[x];
+					const uint8_t b = hi[x];
+					lo[x] = a < b ? a : b;
+					hi[x] = a < b ? b : a;
+				}
+			}
+		}
+
+		if (gray)
+		{
+			std::memcpy(out + (size_t)(y - y0) * stride, plane(m_rank, 0), width);
+			continue;
+		}
+
+		const uint8_t* r = plane(m_rank, 0);
+		const uint8_t* g = plane(m_rank, 1);
+		const uint8_t* b = plane(m_rank, 2);
+
+		QRgb* dst = reinterpret_cast<QRgb*>(out + (size_t)(y - y0) * stride);
+
+		for (int x = 0; x < width; x++)
+			dst[x] = qRgb(r[x], g[x], b[x]);
+	}
+}
+
+void RankFilter::filterRows(const QImage& img, int y0, int y1, uchar* out, int stride) const
+{
+	if (m_radius == 1)
+	{
+		filterSorted(img, y0, y1, out, stride);
+		return;
+	}
+
+	const int width = img.width();
+	const int height = img.height();
+	const int r = m_radius;
+	const int size = 2 * r + 1;
+	const int rank = m_rank;
+	const bool gray = img.format() == QImage::Format_Grayscale8;
+	const int channels = gray ? 1 : 3;
+
+	/*
+		The band is processed in vertical stripes, so the column histograms of a stripe stay in cache
+		while they slide down the rows. Stripes read r columns on either side of them.
+	*/
+	const int stripeWidth = std::max(64, 320 - 2 * r);
+
+	//Column histograms of every channel, counts never exceed 2 * MaxRadius + 1
+	thread_local std::vector<uint8_t> columnFine;
+	thread_local std::vector<uint8_t> columnCoarse;
+
+	for (int sx0 = 0; sx0 < width; sx0 += stripeWidth)
+	{
+		const int sx1 = std::min(width, sx0 + stripeWidth);
+
+		//Columns read by the stripe
+		const int hx0 = std::max(0, sx0 - r);
+		const int hx1 = std::min(width, sx1 + r);
+		const int columns = hx1 - hx0;
+
+		columnFine.assign((size_t)channels * columns * Bins, 0);
+		columnCoarse.assign((size_t)channels * columns * Coarse, 0);
+
+		uint8_t* const fineBase = columnFine.data();
+		uint8_t* const coarseBase = columnCoarse.data();
+
+		//Histograms of image column x, clamped to the image
+		auto fineOf = [=](int c, int x) { return fineBase + ((size_t)c * columns + (clamp(x, width) - hx0)) * Bins; };
+		auto coarseOf = [=](int c, int x) { return coarseBase + ((size_t)c * columns + (clamp(x, width) - hx0)) * Coarse; };
+
+		//Add (delta 1) or remove (delta -1) an image row from the column histograms
+		auto addRow = [&](int y, int delta) {
+			const uchar* bytes = img.constScanLine(clamp(y, height));
+			const QRgb* line = reinterpret_cast<const QRgb*>(bytes);
+
+			for (int x = hx0; x < hx1; x++)
+			{
+				int values[3];
+
+				if (gray)
+				{
+					values[0] = bytes[x];
+				}
+				else
+				{
+					values[0] = qRed(line[x]);
+					values[1] = qGreen(line[x]);
+					values[2] = qBlue(line[x]);
+				}
+
+				for (int c = 0; c < channels; c++)
+				{
+					fineOf(c, x)[values[c]] += delta;
+					coarseOf(c, x)[values[c] / Fine] += delta;
+				}
+			}
+		};
+
+		for (int dy = -r; dy <= r; dy++)
+			addRow(y0 + dy, 1);
+
+		KernelHistogram kernels[3];
+
+		for (int y = y0; y < y1; y++)
+		{
+			if (y > y0)
+			{
+				addRow(y - 1 - r, -1);
+				addRow(y + r, 1);
+			}
+
+			uchar* row = out + (size_t)(y - y0) * stride;
+
+			for (int x = sx0; x < sx1; x++)
+			{
+				int values[3];
+
+				for (int c = 0; c < channels; c++)
+				{
+					KernelHistogram& k = kernels[c];
+
+					//Slide the coarse histogram, or build it at the start of a stripe row
+					if (x == sx0)
+					{
+						std::fill(std::begin(k.coarse), std::end(k.coarse), 0);
+						std::fill(std::begin(k.updated), std::end(k.updated), x - size - 1);
+
+						for (int dx = -r; dx <= r; dx++)
+							accumulate<Coarse>(k.coarse, coarseOf(c, x + dx));
+					}
+					else
+					{
+						slide<Coarse>(k.coarse, coarseOf(c, x + r), coarseOf(c, x - r - 1));
+					}
+
+					//Coarse bin holding the rank
+					int below = 0;
+					int bin = 0;
+
+					while (below + k.coarse[bin] <= rank)
+						below += k.coarse[bin++];
+
+					uint16_t* fine = k.fine[bin];
+					const int offset = bin * Fine;
+
+					//Bring the fine segment up to date, rebuilding it if that is cheaper
+					if (2 * (x - k.updated[bin]) > size)
+					{
+						std::fill(fine, fine + Fine, 0);
+
+						for (int dx = -r; dx <= r; dx++)
+							accumulate<Fine>(fine, fineOf(c, x + dx) + offset);
+					}
+					else
+					{
+						for (int xx = k.updated[bin] + 1; xx <= x; xx++)
+							slide<Fine>(fine, fineOf(c, xx + r) + offset, fineOf(c, xx - r - 1) + offset);
+					}
+
+					k.updated[bin] = x;
+
+					int value = 0;
+
+					while (below + fine[value] <= rank)
+						below += fine[value++];
+
+					values[c] = offset + value;
+				}
+
+				if (gray)
+					row[x] = (uchar)values[0];
+				else
+					reinterpret_cast<QRgb*>(row)[x] = qRgb(values[0], values[1], values[2]);
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
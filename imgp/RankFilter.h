@@ -0,0 +1,51 @@
+/*
+	Rank filter engine
+*/
+
+#pragma once
+
+#include <QImage>
+
+/*
+	Median, minimum, maximum and percentile filters over a square neighbourhood of each pixel.
+
+	Every colour channel is ranked on its own, 8-bit gray scale images as a single channel, and image borders are clamped. Values are counted in
+	sliding histograms (Perreault and Hebert, "Median Filtering in Constant Time"): a histogram per
+	image column slides down the rows and the neighbourhood histogram slides along each row, adding
+	one column and removing another, so the cost per pixel does not grow with the radius.
+	Radius 1 neighbourhoods are small enough to sort directly.
+*/
+class RankFilter
+{
+public:
+
+	static const int MaxRadius = 50;
+
+	//Filter selecting the value at percentile (0 to 100) of a neighbourhood of the given radius
+	RankFilter(int radius, float percentile);
+
+	static RankFilter median(int radius) { return RankFilter(radius, 50.0f); }
+	static RankFilter minimum(int radius) { return RankFilter(radius, 0.0f); }
+	static RankFilter maximum(int radius) { return RankFilter(radius, 100.0f); }
+
+	int radius() const { return m_radius; }
+	float percentile() const { return m_percentile; }
+
+	/*
+		Filter rows [y0, y1) of a working format or 8-bit gray scale image into out, which has the same format,
+		where out points to row y0 and rows are stride bytes apart.
+		Setting up the histograms costs about 2 * radius rows, so bands should be much taller than that.
+	*/
+	void filterRows(const QImage& img, int y0, int y1, uchar* out, int stride) const;
+
+private:
+
+	//Sorts each 3x3 neighbourhood with a sorting network, which beats the histograms at radius 1
+	void filterSorted(const QImage& img, int y0, int y1, uchar* out, int stride) const;
+
+	int m_radius;
+	float m_percentile;
+
+	//Position of the selected value among the sorted (2r+1)^2 neighbourhood values
+	int m_rank;
+};
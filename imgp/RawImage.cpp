@@ -0,0 +1,214 @@
+/*
+	Memory-mapped raw image files
+*/
+
+#include <cstring>
+#include <vector>
+
+#include <QFile>
+#include <QSaveFile>
+
+#include "RawImage.h"
+#include "ImagePipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char* const RawImage::Suffix = "imgp";
+
+struct RawHeader
+{
+	char magic[8];
+	quint32 byteOrder;
+	quint32 width;
+	quint32 height;
+	quint32 format;
+	quint32 stride;
+	quint32 reserved;
+	quint64 dataOffset;
+	quint8 padding[24];
+};
+
+static_assert(sizeof(RawHeader) == 64, "raw image header must be 64 bytes");
+
+static const char rawMagic[8] = { 'I', 'M', 'G', 'P', 'R', 'A', 'W', '1' };
+
+//Reads as 0x04030201 if the file was written in the other byte order
+static const quint32 byteOrder = 0x01020304;
+
+//Pixel data starts on a page, rows on a cache line
+static const quint64 pageSize = 4096;
+static const int rowAlignment = 64;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Read and validate the header of an open file
+static bool readHeader(QFile& file, RawHeader& header, QString& error)
+{
+	if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != (qint64)sizeof(header) || std::memcmp(header.magic, rawMagic, sizeof(rawMagic)) != 0)
+	{
+		error = "not a raw image";
+		return false;
+	}
+
+	if (header.byteOrder != byteOrder)
+	{
+		error = "raw image has the wrong byte order";
+		return false;
+	}
+
+	const QImage::Format format = (QImage::Format)header.format;
+
+	if (header.format == QImage::Format_Invalid || header.format >= QImage::NImageFormats || header.width == 0 || header.height == 0 ||
+		header.width > (1u << 20) || header.height > (1u << 20) || header.dataOffset % pageSize != 0)
+	{
+		error = "invalid raw image header";
+		return false;
+	}
+
+	//Rows must hold the pixels, and the file all of the rows
+	const int bits = QImage::toPixelFormat(format).bitsPerPixel();
+
+	if (bits == 0 || (quint64)header.stride * 8 < (quint64)header.width * bits ||
+		(quint64)file.size() < header.dataOffset + (quint64)header.stride * header.height)
+	{
+		error = "truncated raw image";
+		return false;
+	}
+
+	return true;
+}
+
+//Cleanup function of mapped images, closing the file releases the mapping
+static void closeMapping(void* file)
+{
+	delete static_cast<QFile*>(file);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool RawImage::isRawImage(const QString& path)
+{
+	QFile file(path);
+	char magic[sizeof(rawMagic)];
+
+	return file.open(QIODevice::ReadOnly) && file.read(magic, sizeof(magic)) == (qint64)sizeof(magic) && std::memcmp(magic, rawMagic, sizeof(rawMagic)) == 0;
+}
+
+QImage RawImage::load(const QString& path, QString& error)
+{
+	QFile* file = new QFile(path);
+	RawHeader header;
+
+	if (!file->open(QIODevice::ReadOnly))
+	{
+		error = file->errorString();
+		delete file;
+		return QImage();
+	}
+
+	if (!readHeader(*file, header, error))
+	{
+		delete file;
+		return QImage();
+	}
+
+	const qint64 bytes = (qint64)header.stride * header.height;
+	const uchar* pixels = file->map((qint64)header.dataOffset, bytes);
+
+	if (!pixels)
+	{
+		error = file->errorString();
+		delete file;
+		return QImage();
+	}
+
+	//The image owns the file from here, and closes it once its last copy is gone
+	return QImage(pixels, header.width, header.height, header.stride, (QImage::Format)header.format, closeMapping, file);
+}
+
+bool RawImage::save(const QString& path, const QImage& img, QString& error)
+{
+	if (img.isNull())
+	{
+		error = "null image";
+		return false;
+	}
+
+	//A colour table would need a place in the file, convert those formats instead, gray ones to gray scale
+	const bool indexed = img.format() == QImage::Format_Mono || img.format() == QImage::Format_MonoLSB || img.format() == QImage::Format_Indexed8;
+	const QImage src = indexed ? img.convertToFormat(img.allGray() ? ImagePipeline::GrayFormat : ImagePipeline::WorkingFormat) : img;
+
+	RawHeader header = {};
+	std::memcpy(header.magic, rawMagic, sizeof(rawMagic));
+	header.byteOrder = byteOrder;
+	header.width = src.width();
+	header.height = src.height();
+	header.format = src.format();
+	header.stride = (src.bytesPerLine() + rowAlignment - 1) / rowAlignment * rowAlignment;
+	header.dataOffset = pageSize;
+
+	const qint64 bytes = (qint64)header.stride * header.height;
+
+	//A raw image of the same header is overwritten in place, the rows are copied straight into its mapped pages
+	if (QFile::exists(path))
+	{
+		QFile existing(path);
+		RawHeader old;
+		QString ignored;
+
+		if (existing.open(QIODevice::ReadWrite) && readHeader(existing, old, ignored) && std::memcmp(&old, &header, sizeof(header)) == 0 &&
+			existing.size() == (qint64)header.dataOffset + bytes)
+		{
+			uchar* pixels = existing.map((qint64)header.dataOffset, bytes);
+
+			if (pixels)
+			{
+				const size_t rowBytes = (size_t)src.bytesPerLine();
+
+				for (int y = 0; y < src.height(); y++)
+					std::memcpy(pixels + (size_t)y * header.stride, src.constScanLine(y), rowBytes);
+
+				existing.unmap(pixels);
+				return true;
+			}
+		}
+	}
+
+	//Otherwise resizing a mapped file would zero the pages of images mapped from it, the old file stays until the new one is complete
+	QSaveFile file(path);
+
+	//The header is padded with zeros up to the pixels
+	std::vector<char> head((size_t)header.dataOffset, 0);
+	std::memcpy(head.data(), &header, sizeof(header));
+
+	if (!file.open(QIODevice::WriteOnly) || file.write(head.data(), (qint64)head.size()) != (qint64)head.size())
+	{
+		error = file.errorString();
+		return false;
+	}
+
+	//Rows are padded to the stride, there is nothing to encode
+	const size_t rowBytes = (size_t)src.bytesPerLine();
+	std::vector<char> row(header.stride, 0);
+
+	for (int y = 0; y < src.height(); y++)
+	{
+		std::memcpy(row.data(), src.constScanLine(y), rowBytes);
+
+		if (file.write(row.data(), (qint64)row.size()) != (qint64)row.size())
+		{
+			error = file.errorString();
+			return false;
+		}
+	}
+
+	if (!file.commit())
+	{
+		error = file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
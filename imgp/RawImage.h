@@ -0,0 +1,44 @@
+/*
+	Memory-mapped raw image files
+*/
+
+#pragma once
+
+#include <QImage>
+#include <QString>
+
+/*
+	Uncompressed image container which is used in place through a memory mapping.
+
+	A 64 byte header (magic, byte order, width, height, QImage format, stride, data offset) is followed
+	by the pixel rows. Rows are 64 byte aligned and start on a page boundary, so the mapped pixels can be
+	wrapped by a QImage as they are and read by the SIMD kernels directly. Loading never decodes or copies,
+	pages are read from disk as they are touched and stay shared with the page cache.
+
+	Files are written in native byte order, images saved on a machine of the other byte order are rejected.
+*/
+class RawImage
+{
+public:
+
+	//File name suffix of raw images
+	static const char* const Suffix;
+
+	//Check whether a file is a raw image, from its header
+	static bool isRawImage(const QString& path);
+
+	/*
+		Map a raw image file and return an image over the mapped pixels, which keeps the mapping alive.
+		The mapping is read only, writing to the image detaches it into a private copy.
+		Returns a null image and sets error on failure.
+	*/
+	static QImage load(const QString& path, QString& error);
+
+	/*
+		Write an image to a raw image file. A raw image at path with the same header is written back through a mapping,
+		images mapped from it see the new pixels. Other files are written under a temporary name and replace path once
+		complete, so a failed save leaves path as it was and images mapped from path keep their pixels.
+		Formats which need a colour table are converted to the pipeline's gray scale or working format first.
+	*/
+	static bool save(const QString& path, const QImage& img, QString& error);
+};
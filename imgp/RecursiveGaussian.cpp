@@ -0,0 +1,145 @@
+/*
+	Recursive Gaussian filter
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "RecursiveGaussian.h"
+#include "Simd.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+constexpr float RecursiveGaussian::MinSigma;
+constexpr float RecursiveGaussian::MaxSigma;
+
+//Rows filtered at once, a cache line of floats per step
+static const int RowGroup = 16;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+RecursiveGaussian::RecursiveGaussian(float sigma) :
+	m_sigma(std::max(MinSigma, std::min(MaxSigma, sigma)))
+{
+	//Coefficients of the paper, large sigmas leave little between the weights and 1
+	const double s = m_sigma;
+	const double q = (s >= 2.5) ? 0.98711 * s - 0.96330 : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * s);
+
+	const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+	const double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+	const double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+	const double b3 = 0.422205 * q * q * q;
+
+	const double a1 = b1 / b0;
+	const double a2 = b2 / b0;
+	const double a3 = b3 / b0;
+
+	m_a[0] = a1;
+	m_a[1] = a2;
+	m_a[2] = a3;
+
+	//The weights sum to 1, so a constant line stays constant
+	m_b = 1.0 - (a1 + a2 + a3);
+	const double scale = (1.0 - a1 - a2 - a3) / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3) * a3));
+
+	const double m[9] = {
+		-a3 * a1 + 1.0 - a3 * a3 - a2,
+		(a3 + a1) * (a2 + a3 * a1),
+		a3 * (a1 + a3 * a2),
+		a1 + a3 * a2,
+		-(a2 - 1.0) * (a2 + a3 * a1),
+		-(a3 * a1 + a3 * a3 + a2 - 1.0) * a3,
+		a3 * a1 + a2 + a1 * a1 - a2 * a2,
+		a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3,
+		a3 * (a1 + a3 * a2),
+	};
+
+	for (int i = 0; i < 9; i++)
+		m_m[i] = m[i] * scale;
+}
+
+int RecursiveGaussian::radius() const
+{
+	return (int)std::ceil(4.0f * m_sigma);
+}
+
+void RecursiveGaussian::filterLines(float* data, int count, std::ptrdiff_t step, int lines) const
+{
+	const double weights[4] = { m_b, m_a[0], m_a[1], m_a[2] };
+
+	//Last three outputs of every line, and its last value
+	thread_local std::vector<double> state;
+	state.resize((size_t)lines * 4);
+
+	double* const w1 = state.data();
+	double* const w2 = w1 + lines;
+	double* const w3 = w2 + lines;
+	double* const end = w3 + lines;
+
+	float* const last = data + (std::ptrdiff_t)(count - 1) * step;
+
+	//Causal pass, from the state of a line repeating its first value
+	for (int l = 0; l < lines; l++)
+	{
+		w1[l] = w2[l] = w3[l] = data[l];
+		end[l] = last[l];
+	}
+
+	simd::recursiveFilter(data, count, step, lines, weights, w1, w2, w3);
+
+	//Anticausal pass over the causal result, its last output and state follow from how far the causal pass is from settling
+	for (int l = 0; l < lines; l++)
+	{
+		const double u = end[l];
+		const double d1 = w1[l] - u;
+		const double d2 = w2[l] - u;
+		const double d3 = w3[l] - u;
+
+		w1[l] = u + m_m[0] * d1 + m_m[1] * d2 + m_m[2] * d3;
+		w2[l] = u + m_m[3] * d1 + m_m[4] * d2 + m_m[5] * d3;
+		w3[l] = u + m_m[6] * d1 + m_m[7] * d2 + m_m[8] * d3;
+
+		last[l] = (float)w1[l];
+	}
+
+	simd::recursiveFilter(last - step, count - 1, -step, lines, weights, w1, w2, w3);
+}
+
+void RecursiveGaussian::blurRows(float* plane, int width, std::ptrdiff_t stride, int y0, int y1) const
+{
+	//A group of rows is interleaved so the values of a step are contiguous, the recursions then run side by side like columns
+	thread_local std::vector<float> block;
+	block.resize((size_t)width * RowGroup);
+
+	for (int y = y0; y < y1; y += RowGroup)
+	{
+		const int rows = std::min(RowGroup, y1 - y);
+
+		for (int r = 0; r < rows; r++)
+		{
+			const float* row = plane + (y + r) * stride;
+
+			for (int x = 0; x < width; x++)
+				block[(size_t)x * rows + r] = row[x];
+		}
+
+		filterLines(block.data(), width, rows, rows);
+
+		for (int r = 0; r < rows; r++)
+		{
+			float* row = plane + (y + r) * stride;
+
+			for (int x = 0; x < width; x++)
+				row[x] = block[(size_t)x * rows + r];
+		}
+	}
+}
+
+void RecursiveGaussian::blurColumns(float* plane, int height, std::ptrdiff_t stride, int x0, int x1) const
+{
+	//Down the columns a row of the strip at a time, the columns' values of a row are contiguous
+	filterLines(plane + x0, height, stride, x1 - x0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
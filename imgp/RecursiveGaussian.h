@@ -0,0 +1,59 @@
+/*
+	Recursive Gaussian filter
+*/
+
+#pragma once
+
+#include <cstddef>
+
+/*
+	Gaussian blur by a recursive (IIR) filter, after Young and van Vliet, "Recursive implementation of the
+	Gaussian filter". A third order causal recursion runs forward along each line and then backward over its
+	result, which approximates a Gaussian of the given standard deviation at a cost per pixel which does not
+	depend on sigma. The image is blurred along its rows and then along its columns.
+
+	Lines are stored as floats and filtered in place, the recursion and its state run in double: at large sigma the
+	weights of the outputs sum to within about 1e-5 of 1, which amplifies rounding errors by 1e5. Lines are taken to repeat their first and last values beyond their
+	ends, which clamps the image borders like the filter kernels: the causal pass starts from the state a
+	constant line settles in, and the anticausal pass from the state given by the boundary conditions of Triggs
+	and Sdika, "Boundary conditions for Young-van Vliet recursive filtering".
+*/
+class RecursiveGaussian
+{
+public:
+
+	//Range of sigma the filter approximates a Gaussian over, in pixels
+	static constexpr float MinSigma = 0.5f;
+	static constexpr float MaxSigma = 200.0f;
+
+	//Filter of the given standard deviation, clamped to [MinSigma, MaxSigma]
+	explicit RecursiveGaussian(float sigma);
+
+	float sigma() const { return m_sigma; }
+
+	//Pixels on either side of a pixel which affect it noticeably, 4 sigma
+	int radius() const;
+
+	//Blur rows [y0, y1) of a plane of width floats per row, stride floats apart
+	void blurRows(float* plane, int width, std::ptrdiff_t stride, int y0, int y1) const;
+
+	//Blur columns [x0, x1) of a plane of height rows, stride floats apart
+	void blurColumns(float* plane, int height, std::ptrdiff_t stride, int x0, int x1) const;
+
+private:
+
+	/*
+		Run the recursion forward and backward along count values step floats apart, on several lines at once
+		whose values are contiguous at every step. The lines' recursions are independent and run side by side.
+	*/
+	void filterLines(float* data, int count, std::ptrdiff_t step, int lines) const;
+
+	float m_sigma;
+
+	//Gain of the input and weights of the last three outputs
+	double m_b;
+	double m_a[3];
+
+	//Triggs and Sdika's matrix times the gain, mapping the end of the causal result to the anticausal state
+	double m_m[9];
+};
@@ -0,0 +1,98 @@
+/*
+	Cache of operation results
+*/
+
+#include "ResultCache.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+quint64 ResultCache::hash(const void* data, size_t size, quint64 seed)
+{
+	const uchar* bytes = static_cast<const uchar*>(data);
+
+	for (size_t i = 0; i < size; i++)
+		seed = (seed ^ bytes[i]) * 1099511628211ull;
+
+	return seed;
+}
+
+size_t ResultCache::KeyHash::operator()(const Key& key) const
+{
+	quint64 h = hash(&key.source, sizeof(key.source));
+	h = hash(&key.operation, sizeof(key.operation), h);
+	return (size_t)hash(&key.params, sizeof(key.params), h);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ResultCache::ResultCache(qint64 budget) :
+	m_budget(budget),
+	m_size(0),
+	m_hits(0),
+	m_misses(0)
+{}
+
+QImage ResultCache::find(const Key& key)
+{
+	auto it = m_index.find(key);
+
+	if (it == m_index.end())
+	{
+		m_misses++;
+		return QImage();
+	}
+
+	//Move to the front of the recently used list
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+	m_hits++;
+
+	return it->second->result;
+}
+
+void ResultCache::insert(const Key& key, const QImage& result)
+{
+	//A result larger than the whole budget would only evict everything else
+	if (result.isNull() || result.sizeInBytes() > m_budget)
+		return;
+
+	auto it = m_index.find(key);
+
+	if (it != m_index.end())
+	{
+		m_size -= it->second->result.sizeInBytes();
+		m_entries.erase(it->second);
+		m_index.erase(it);
+	}
+
+	m_entries.push_front({ key, result });
+	m_index[key] = m_entries.begin();
+	m_size += result.sizeInBytes();
+
+	trim();
+}
+
+void ResultCache::clear()
+{
+	m_entries.clear();
+	m_index.clear();
+	m_size = 0;
+}
+
+void ResultCache::setBudget(qint64 bytes)
+{
+	m_budget = bytes;
+	trim();
+}
+
+void ResultCache::trim()
+{
+	while (m_size > m_budget && !m_entries.empty())
+	{
+		const Entry& last = m_entries.back();
+		m_size -= last.result.sizeInBytes();
+		m_index.erase(last.key);
+		m_entries.pop_back();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
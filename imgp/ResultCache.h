@@ -0,0 +1,86 @@
+/*
+	Cache of operation results
+*/
+
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+#include <QImage>
+
+/*
+	Least recently used cache of images produced by pipeline operations.
+
+	Results are keyed by the identity of the input image (QImage::cacheKey, which changes whenever
+	an image is written to), the operation and a hash of its parameters, so applying an operation
+	to an image it was already applied to returns the earlier result without recomputing it.
+	The total size of the cached images is kept within a byte budget.
+*/
+class ResultCache
+{
+public:
+
+	struct Key
+	{
+		qint64 source;
+		int operation;
+		quint64 params;
+
+		bool operator==(const Key& other) const
+		{
+			return source == other.source && operation == other.operation && params == other.params;
+		}
+	};
+
+	//Incremental FNV-1a hash for building the parameter part of a key
+	static quint64 hash(const void* data, size_t size, quint64 seed = 14695981039346656037ull);
+
+	explicit ResultCache(qint64 budget = 128ll * 1024 * 1024);
+
+	//Return the cached result of a key, or a null image and count a miss
+	QImage find(const Key& key);
+
+	//Cache a result, evicting the least recently used ones to stay within the budget
+	void insert(const Key& key, const QImage& result);
+
+	//Drop every result
+	void clear();
+
+	//Budget in bytes, 0 disables the cache
+	qint64 budget() const { return m_budget; }
+	void setBudget(qint64 bytes);
+
+	//Total size of the cached results in bytes
+	qint64 size() const { return m_size; }
+
+	//Lookups which did and did not find a result
+	quint64 hits() const { return m_hits; }
+	quint64 misses() const { return m_misses; }
+
+private:
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		QImage result;
+	};
+
+	//Evict least recently used results until the cache fits in the budget
+	void trim();
+
+	//Most recently used first
+	std::list<Entry> m_entries;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+
+	qint64 m_budget;
+	qint64 m_size;
+
+	quint64 m_hits;
+	quint64 m_misses;
+};
@@ -0,0 +1,1598 @@
+/*
+	Vectorized pixel kernels
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Simd.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define IMGP_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+//GCC and Clang need the instruction set of intrinsics enabled per function, MSVC always allows them
+#if defined(IMGP_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define IMGP_TARGET_SSE2 __attribute__((target("sse2")))
+#define IMGP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IMGP_TARGET_SSE2
+#define IMGP_TARGET_AVX2
+#endif
+
+//Unroll a loop whose trip count is known at compile time, which optimisation levels below -O3 leave alone
+#if defined(__GNUC__) || defined(__clang__)
+#define IMGP_UNROLL _Pragma("GCC unroll 8")
+#else
+#define IMGP_UNROLL
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scalar kernels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const QRgb opaque = 0xff000000;
+
+static void grayscaleScalar(const QRgb* in, QRgb* out, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const uint32_t c = (uint32_t)qGray(in[i]);
+		out[i] = opaque | (c << 16) | (c << 8) | c;
+	}
+}
+
+static void grayscale8Scalar(const QRgb* in, uchar* out, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (uchar)qGray(in[i]);
+}
+
+static void grayToRgbScalar(const uchar* in, QRgb* out, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = opaque | ((uint32_t)in[i] * 0x010101);
+}
+
+static void thresholdScalar(const QRgb* in, QRgb* out, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (qBlue(in[i]) < 128) ? opaque : 0xffffffff;
+}
+
+static void ditherBitsScalar(const QRgb* in, uchar* out, int count, const uint8_t* thresholds)
+{
+	for (int i = 0; i < count; i += 8)
+	{
+		uchar bits = 0;
+
+		for (int b = 0; b < 8 && i + b < count; b++)
+			bits |= (qBlue(in[i + b]) >= thresholds[i + b]) << b;
+
+		out[i / 8] = bits;
+	}
+}
+
+static void ditherBitsScalar(const uchar* in, uchar* out, int count, const uint8_t* thresholds)
+{
+	for (int i = 0; i < count; i += 8)
+	{
+		uchar bits = 0;
+
+		for (int b = 0; b < 8 && i + b < count; b++)
+			bits |= (in[i + b] >= thresholds[i + b]) << b;
+
+		out[i / 8] = bits;
+	}
+}
+
+static void lookupScalar(const QRgb* in, QRgb* out, int count, const simd::ChannelTable& table)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const QRgb p = in[i];
+		out[i] = opaque | table.r[qRed(p)] | table.g[qGreen(p)] | table.b[qBlue(p)];
+	}
+}
+
+//Clamp a value to [0, max] and round it to the nearest integer, NaN becomes 0 like with the vector min and max
+static int roundClamped(float v, float max)
+{
+	return (int)std::lrint(std::min(std::max(0.0f, v), max));
+}
+
+static void unpackRgbScalar(const QRgb* in, float* r, float* g, float* b, int count, float scale)
+{
+	for (int i = 0; i < count; i++)
+	{
+		r[i] = (float)qRed(in[i]) * scale;
+		g[i] = (float)qGreen(in[i]) * scale;
+		b[i] = (float)qBlue(in[i]) * scale;
+	}
+}
+
+static void unpackChannelScalar(const QRgb* in, float* out, int count, int shift, float scale)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (float)((in[i] >> shift) & 0xff) * scale;
+}
+
+static void lookupChannelScalar(const QRgb* in, float* out, int count, int shift, const float* table)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = table[(in[i] >> shift) & 0xff];
+}
+
+static void packRgbScalar(const float* r, const float* g, const float* b, QRgb* out, int count, float scale)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = opaque | (roundClamped(r[i] * scale, 255.0f) << 16) | (roundClamped(g[i] * scale, 255.0f) << 8) | roundClamped(b[i] * scale, 255.0f);
+}
+
+static void unpackGrayScalar(const uchar* in, float* out, int count, float scale)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (float)in[i] * scale;
+}
+
+static void packGrayScalar(const float* in, uchar* out, int count, float scale)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (uchar)roundClamped(in[i] * scale, 255.0f);
+}
+
+static void wordsToFloatScalar(const uint16_t* in, float* out, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (float)in[i];
+}
+
+static void floatToWordsScalar(const float* in, uint16_t* out, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (uint16_t)roundClamped(in[i], 65535.0f);
+}
+
+static void weightedSumScalar(const float* const* lines, const float* weights, int taps, float* accum, int offset, int count)
+{
+	for (int i = offset; i < offset + count; i++)
+	{
+		float sum = accum[i];
+
+		for (int k = 0; k < taps; k++)
+			sum = sum + lines[k][i] * weights[k];
+
+		accum[i] = sum;
+	}
+}
+
+static void clampScaledScalar(float* values, int count, float scale, float max)
+{
+	for (int i = 0; i < count; i++)
+		values[i] = std::min(std::max(0.0f, values[i] * scale), max);
+}
+
+static void grayscaleScalar(const float* r, const float* g, const float* b, float* out, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = (r[i] * 11.0f + g[i] * 16.0f + b[i] * 5.0f) * (1.0f / 32.0f);
+}
+
+static void unpackGrayscaleScalar(const QRgb* in, float* out, int count, float scale)
+{
+	const float s = scale * (1.0f / 32.0f);
+
+	for (int i = 0; i < count; i++)
+		out[i] = (float)(qRed(in[i]) * 11 + qGreen(in[i]) * 16 + qBlue(in[i]) * 5) * s;
+}
+
+static void interpolateScalar(const float* in, float* out, int count, const float* samples, int segments, float scale)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const float x = std::min(std::max(0.0f, in[i] * scale), (float)segments);
+		const int s = std::min((int)x, segments - 1);
+		const float f = x - (float)s;
+
+		out[i] = samples[s] + f * (samples[s + 1] - samples[s]);
+	}
+}
+
+static void recursiveFilterScalar(float* values, int count, std::ptrdiff_t step, int lines, const double* weights, double* w1, double* w2, double* w3)
+{
+	for (int l = 0; l < lines; l++)
+	{
+		double s1 = w1[l];
+		double s2 = w2[l];
+		double s3 = w3[l];
+
+		float* v = values + l;
+
+		for (int i = 0; i < count; i++, v += step)
+		{
+			const double w = weights[0] * *v + weights[1] * s1 + weights[2] * s2 + weights[3] * s3;
+
+			s3 = s2;
+			s2 = s1;
+			s1 = w;
+
+			*v = (float)w;
+		}
+
+		w1[l] = s1;
+		w2[l] = s2;
+		w3[l] = s3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef IMGP_SIMD_X86
+
+//Weights of qGray() in QRgb byte order b, g, r, a
+#define IMGP_GRAY_WEIGHTS 5, 16, 11, 0, 5, 16, 11, 0
+
+IMGP_TARGET_SSE2 static __m128i broadcastGray128(__m128i gray)
+{
+	return _mm_or_si128(_mm_or_si128(gray, _mm_slli_epi32(gray, 8)), _mm_or_si128(_mm_slli_epi32(gray, 16), _mm_set1_epi32((int)opaque)));
+}
+
+IMGP_TARGET_SSE2 static void grayscaleSSE2(const QRgb* in, QRgb* out, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights = _mm_setr_epi16(IMGP_GRAY_WEIGHTS);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+		//Per pixel pairs of partial sums, b*5 + g*16 and r*11
+		const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights);
+		const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights);
+
+		const __m128 flo = _mm_castsi128_ps(lo);
+		const __m128 fhi = _mm_castsi128_ps(hi);
+		const __m128i even = _mm_castps_si128(_mm_shuffle_ps(flo, fhi, _MM_SHUFFLE(2, 0, 2, 0)));
+		const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(flo, fhi, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		const __m128i gray = _mm_srli_epi32(_mm_add_epi32(even, odd), 5);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), broadcastGray128(gray));
+	}
+
+	grayscaleScalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void grayscale8SSE2(const QRgb* in, uchar* out, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights = _mm_setr_epi16(IMGP_GRAY_WEIGHTS);
+
+	//Gray values of 4 pixels, one per 32 bit lane
+	auto gray4 = [&](const QRgb* p) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		const __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights));
+		const __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights));
+		const __m128i even = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		return _mm_srli_epi32(_mm_add_epi32(even, odd), 5);
+	};
+
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i g01 = _mm_packs_epi32(gray4(in + i), gray4(in + i + 4));
+		const __m128i g23 = _mm_packs_epi32(gray4(in + i + 8), gray4(in + i + 12));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(g01, g23));
+	}
+
+	grayscale8Scalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void grayToRgbSSE2(const uchar* in, QRgb* out, int count)
+{
+	const __m128i alpha = _mm_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+		//Each value doubled into 16 bits, then into 32 bits, gives it in every channel
+		const __m128i lo = _mm_unpacklo_epi8(v, v);
+		const __m128i hi = _mm_unpackhi_epi8(v, v);
+
+		__m128i* dst = reinterpret_cast<__m128i*>(out + i);
+		_mm_storeu_si128(dst + 0, _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+		_mm_storeu_si128(dst + 1, _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+		_mm_storeu_si128(dst + 2, _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+		_mm_storeu_si128(dst + 3, _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+	}
+
+	grayToRgbScalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void thresholdSSE2(const QRgb* in, QRgb* out, int count)
+{
+	const __m128i alpha = _mm_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+		//Blue >= 128 exactly when its top bit is set, spread that bit over the whole pixel
+		const __m128i mask = _mm_srai_epi32(_mm_slli_epi32(p, 24), 31);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_or_si128(mask, alpha));
+	}
+
+	thresholdScalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void ditherBitsSSE2(const QRgb* in, uchar* out, int count, const uint8_t* thresholds)
+{
+	const __m128i byteMask = _mm_set1_epi32(0xff);
+
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i* p = reinterpret_cast<const __m128i*>(in + i);
+
+		//Blue channels of 16 pixels, in pixel order
+		const __m128i b01 = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(p), byteMask), _mm_and_si128(_mm_loadu_si128(p + 1), byteMask));
+		const __m128i b23 = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(p + 2), byteMask), _mm_and_si128(_mm_loadu_si128(p + 3), byteMask));
+		const __m128i blue = _mm_packus_epi16(b01, b23);
+
+		const __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(thresholds + i));
+
+		//Unsigned blue >= t exactly when max(blue, t) is blue, the mask has one bit per pixel
+		const int white = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(blue, t), blue));
+
+		out[i / 8] = (uchar)white;
+		out[i / 8 + 1] = (uchar)(white >> 8);
+	}
+
+	ditherBitsScalar(in + i, out + i / 8, count - i, thresholds + i);
+}
+
+IMGP_TARGET_SSE2 static void ditherBitsSSE2(const uchar* in, uchar* out, int count, const uint8_t* thresholds)
+{
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		const __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(thresholds + i));
+
+		const int white = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, t), v));
+
+		out[i / 8] = (uchar)white;
+		out[i / 8 + 1] = (uchar)(white >> 8);
+	}
+
+	ditherBitsScalar(in + i, out + i / 8, count - i, thresholds + i);
+}
+
+//High 32 bits of the unsigned product of every lane with r
+IMGP_TARGET_SSE2 static __m128i mulhi128(__m128i a, __m128i r)
+{
+	const __m128i even = _mm_srli_epi64(_mm_mul_epu32(a, r), 32);
+	const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), r);
+
+	return _mm_or_si128(even, _mm_and_si128(odd, _mm_set_epi32(-1, 0, -1, 0)));
+}
+
+IMGP_TARGET_SSE2 static __m128i normalise128(__m128i accum, const simd::Divisor& divisor)
+{
+	//Negative sums become 0, as in the scalar path
+	accum = _mm_add_epi32(accum, _mm_set1_epi32(divisor.offset));
+	accum = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_setzero_si128(), accum), accum);
+
+	if (divisor.factor > 1)
+		accum = mulhi128(accum, _mm_set1_epi32((int)divisor.reciprocal));
+
+	return accum;
+}
+
+//Square kernels of Size taps a side, known at compile time, or of any size if it is 0
+template<int Size>
+IMGP_TARGET_SSE2 static int convolveSSE2(const QRgb* const* lines, int rows, int cols, const int16_t* weights, const simd::Divisor& divisor, QRgb* out, int count)
+{
+	if (Size > 0)
+	{
+		rows = Size;
+		cols = Size;
+	}
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		//One accumulator per output pixel, lanes are the b, g, r, a channels
+		__m128i acc[4] = { zero, zero, zero, zero };
+
+		IMGP_UNROLL
+		for (int ky = 0; ky < rows; ky++)
+		{
+			const QRgb* line = lines[ky] + i;
+			const int16_t* w = weights + ky * cols;
+
+			//Taps are taken in pairs, madd multiplies interleaved channels of both taps and adds them
+			IMGP_UNROLL
+			for (int kx = 0; kx < cols; kx += 2)
+			{
+				const bool pair = (kx + 1 < cols);
+				const int w1 = pair ? w[kx + 1] : 0;
+				const __m128i wv = _mm_set1_epi32((int)(((uint32_t)(uint16_t)w1 << 16) | (uint16_t)w[kx]));
+
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + kx));
+				const __m128i b = pair ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + kx + 1)) : zero;
+
+				const __m128i alo = _mm_unpacklo_epi8(a, zero);
+				const __m128i blo = _mm_unpacklo_epi8(b, zero);
+				const __m128i ahi = _mm_unpackhi_epi8(a, zero);
+				const __m128i bhi = _mm_unpackhi_epi8(b, zero);
+
+				acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), wv));
+				acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), wv));
+				acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), wv));
+				acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), wv));
+			}
+		}
+
+		for (__m128i& a : acc)
+			a = normalise128(a, divisor);
+
+		//Saturating packs clamp every channel to [0, 255]
+		const __m128i p01 = _mm_packs_epi32(acc[0], acc[1]);
+		const __m128i p23 = _mm_packs_epi32(acc[2], acc[3]);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_or_si128(_mm_packus_epi16(p01, p23), alpha));
+	}
+
+	return i;
+}
+
+IMGP_TARGET_SSE2 static __m128i roundClamped128(__m128 v, __m128 max)
+{
+	return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), max));
+}
+
+IMGP_TARGET_SSE2 static void unpackRgbSSE2(const QRgb* in, float* r, float* g, float* b, int count, float scale)
+{
+	const __m128i byteMask = _mm_set1_epi32(0xff);
+	const __m128 s = _mm_set1_ps(scale);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+		_mm_storeu_ps(r + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), byteMask)), s));
+		_mm_storeu_ps(g + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), byteMask)), s));
+		_mm_storeu_ps(b + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(p, byteMask)), s));
+	}
+
+	unpackRgbScalar(in + i, r + i, g + i, b + i, count - i, scale);
+}
+
+IMGP_TARGET_SSE2 static void unpackChannelSSE2(const QRgb* in, float* out, int count, int shift, float scale)
+{
+	const __m128i byteMask = _mm_set1_epi32(0xff);
+	const __m128i bits = _mm_cvtsi32_si128(shift);
+	const __m128 s = _mm_set1_ps(scale);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(p, bits), byteMask)), s));
+	}
+
+	unpackChannelScalar(in + i, out + i, count - i, shift, scale);
+}
+
+IMGP_TARGET_SSE2 static void packRgbSSE2(const float* r, const float* g, const float* b, QRgb* out, int count, float scale)
+{
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128 max = _mm_set1_ps(255.0f);
+	const __m128i alpha = _mm_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i rv = roundClamped128(_mm_mul_ps(_mm_loadu_ps(r + i), s), max);
+		const __m128i gv = roundClamped128(_mm_mul_ps(_mm_loadu_ps(g + i), s), max);
+		const __m128i bv = roundClamped128(_mm_mul_ps(_mm_loadu_ps(b + i), s), max);
+
+		const __m128i p = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(rv, 16), _mm_slli_epi32(gv, 8)), _mm_or_si128(bv, alpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), p);
+	}
+
+	packRgbScalar(r + i, g + i, b + i, out + i, count - i, scale);
+}
+
+IMGP_TARGET_SSE2 static void unpackGraySSE2(const uchar* in, float* out, int count, float scale)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 s = _mm_set1_ps(scale);
+
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		const __m128i lo = _mm_unpacklo_epi8(v, zero);
+		const __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+		_mm_storeu_ps(out + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), s));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), s));
+		_mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), s));
+		_mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), s));
+	}
+
+	unpackGrayScalar(in + i, out + i, count - i, scale);
+}
+
+IMGP_TARGET_SSE2 static void packGraySSE2(const float* in, uchar* out, int count, float scale)
+{
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128 max = _mm_set1_ps(255.0f);
+
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v[4];
+
+		for (int k = 0; k < 4; k++)
+			v[k] = roundClamped128(_mm_mul_ps(_mm_loadu_ps(in + i + 4 * k), s), max);
+
+		//Values are in [0, 255] already, so the saturating packs do not change them
+		const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+	}
+
+	packGrayScalar(in + i, out + i, count - i, scale);
+}
+
+IMGP_TARGET_SSE2 static void wordsToFloatSSE2(const uint16_t* in, float* out, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+		_mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+		_mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+	}
+
+	wordsToFloatScalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void floatToWordsSSE2(const float* in, uint16_t* out, int count)
+{
+	const __m128 max = _mm_set1_ps(65535.0f);
+	const __m128i bias = _mm_set1_epi32(32768);
+	const __m128i sign = _mm_set1_epi16((short)0x8000);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		//SSE2 only packs signed values, so the range is moved down by 32768 and the sign bit flipped back after packing
+		const __m128i lo = _mm_sub_epi32(roundClamped128(_mm_loadu_ps(in + i), max), bias);
+		const __m128i hi = _mm_sub_epi32(roundClamped128(_mm_loadu_ps(in + i + 4), max), bias);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(_mm_packs_epi32(lo, hi), sign));
+	}
+
+	floatToWordsScalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void weightedSumSSE2(const float* const* lines, const float* weights, int taps, float* accum, int count)
+{
+	int i = 0;
+
+	//Four independent sums hide the latency of the additions, each of which depends on the last
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128 s0 = _mm_loadu_ps(accum + i);
+		__m128 s1 = _mm_loadu_ps(accum + i + 4);
+		__m128 s2 = _mm_loadu_ps(accum + i + 8);
+		__m128 s3 = _mm_loadu_ps(accum + i + 12);
+
+		for (int k = 0; k < taps; k++)
+		{
+			const __m128 w = _mm_set1_ps(weights[k]);
+			const float* line = lines[k] + i;
+
+			s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(line), w));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(line + 4), w));
+			s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(line + 8), w));
+			s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(line + 12), w));
+		}
+
+		_mm_storeu_ps(accum + i, s0);
+		_mm_storeu_ps(accum + i + 4, s1);
+		_mm_storeu_ps(accum + i + 8, s2);
+		_mm_storeu_ps(accum + i + 12, s3);
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 sum = _mm_loadu_ps(accum + i);
+
+		for (int k = 0; k < taps; k++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(lines[k] + i), _mm_set1_ps(weights[k])));
+
+		_mm_storeu_ps(accum + i, sum);
+	}
+
+	weightedSumScalar(lines, weights, taps, accum, i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void clampScaledSSE2(float* values, int count, float scale, float max)
+{
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128 m = _mm_set1_ps(max);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(values + i, _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(values + i), s), _mm_setzero_ps()), m));
+
+	clampScaledScalar(values + i, count - i, scale, max);
+}
+
+IMGP_TARGET_SSE2 static void recursiveFilterSSE2(float* values, int count, std::ptrdiff_t step, int lines, const double* weights, double* w1, double* w2, double* w3)
+{
+	const __m128d b = _mm_set1_pd(weights[0]);
+	const __m128d a1 = _mm_set1_pd(weights[1]);
+	const __m128d a2 = _mm_set1_pd(weights[2]);
+	const __m128d a3 = _mm_set1_pd(weights[3]);
+
+	int l = 0;
+
+	//Each step depends on the last, the state of four lines stays in registers along the whole of them, two lines a register
+	for (; l + 4 <= lines; l += 4)
+	{
+		__m128d s1 = _mm_loadu_pd(w1 + l);
+		__m128d s2 = _mm_loadu_pd(w2 + l);
+		__m128d s3 = _mm_loadu_pd(w3 + l);
+		__m128d t1 = _mm_loadu_pd(w1 + l + 2);
+		__m128d t2 = _mm_loadu_pd(w2 + l + 2);
+		__m128d t3 = _mm_loadu_pd(w3 + l + 2);
+
+		float* v = values + l;
+
+		for (int i = 0; i < count; i++, v += step)
+		{
+			const __m128 x = _mm_loadu_ps(v);
+
+			const __m128d w = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(b, _mm_cvtps_pd(x)), _mm_mul_pd(a1, s1)), _mm_mul_pd(a2, s2)), _mm_mul_pd(a3, s3));
+			const __m128d u = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(b, _mm_cvtps_pd(_mm_movehl_ps(x, x))), _mm_mul_pd(a1, t1)), _mm_mul_pd(a2, t2)), _mm_mul_pd(a3, t3));
+
+			s3 = s2;
+			s2 = s1;
+			s1 = w;
+			t3 = t2;
+			t2 = t1;
+			t1 = u;
+
+			_mm_storeu_ps(v, _mm_movelh_ps(_mm_cvtpd_ps(w), _mm_cvtpd_ps(u)));
+		}
+
+		_mm_storeu_pd(w1 + l, s1);
+		_mm_storeu_pd(w2 + l, s2);
+		_mm_storeu_pd(w3 + l, s3);
+		_mm_storeu_pd(w1 + l + 2, t1);
+		_mm_storeu_pd(w2 + l + 2, t2);
+		_mm_storeu_pd(w3 + l + 2, t3);
+	}
+
+	recursiveFilterScalar(values + l, count, step, lines - l, weights, w1 + l, w2 + l, w3 + l);
+}
+
+IMGP_TARGET_SSE2 static void grayscaleSSE2(const float* r, const float* g, const float* b, float* out, int count)
+{
+	const __m128 wr = _mm_set1_ps(11.0f);
+	const __m128 wg = _mm_set1_ps(16.0f);
+	const __m128 wb = _mm_set1_ps(5.0f);
+	const __m128 s = _mm_set1_ps(1.0f / 32.0f);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(r + i), wr), _mm_mul_ps(_mm_loadu_ps(g + i), wg)), _mm_mul_ps(_mm_loadu_ps(b + i), wb));
+		_mm_storeu_ps(out + i, _mm_mul_ps(sum, s));
+	}
+
+	grayscaleScalar(r + i, g + i, b + i, out + i, count - i);
+}
+
+IMGP_TARGET_SSE2 static void unpackGrayscaleSSE2(const QRgb* in, float* out, int count, float scale)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights = _mm_setr_epi16(IMGP_GRAY_WEIGHTS);
+	const __m128 s = _mm_set1_ps(scale * (1.0f / 32.0f));
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+		//Weighted sums as in grayscaleSSE2(), which are exact, and only then scaled
+		const __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights));
+		const __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights));
+		const __m128i even = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(even, odd)), s));
+	}
+
+	unpackGrayscaleScalar(in + i, out + i, count - i, scale);
+}
+
+IMGP_TARGET_SSE2 static void streamCopySSE2(const void* in, void* out, size_t bytes)
+{
+	const uchar* src = static_cast<const uchar*>(in);
+	uchar* dst = static_cast<uchar*>(out);
+
+	//Streaming stores need aligned addresses, the bytes up to the first one are copied normally
+	const size_t head = std::min(bytes, (size_t)(-reinterpret_cast<uintptr_t>(dst) & 15));
+	std::memcpy(dst, src, head);
+
+	size_t i = head;
+
+	for (; i + 16 <= bytes; i += 16)
+		_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+
+	std::memcpy(dst + i, src + i, bytes - i);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+IMGP_TARGET_AVX2 static void grayscaleAVX2(const QRgb* in, QRgb* out, int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i weights = _mm256_setr_epi16(IMGP_GRAY_WEIGHTS, IMGP_GRAY_WEIGHTS);
+	const __m256i alpha = _mm256_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+
+		//Unpacks and shuffles stay within 128 bit lanes, so pixel order is kept
+		const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(p, zero), weights);
+		const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(p, zero), weights);
+
+		const __m256 flo = _mm256_castsi256_ps(lo);
+		const __m256 fhi = _mm256_castsi256_ps(hi);
+		const __m256i even = _mm256_castps_si256(_mm256_shuffle_ps(flo, fhi, _MM_SHUFFLE(2, 0, 2, 0)));
+		const __m256i odd = _mm256_castps_si256(_mm256_shuffle_ps(flo, fhi, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		const __m256i gray = _mm256_srli_epi32(_mm256_add_epi32(even, odd), 5);
+		const __m256i result = _mm256_or_si256(_mm256_or_si256(gray, _mm256_slli_epi32(gray, 8)), _mm256_or_si256(_mm256_slli_epi32(gray, 16), alpha));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+	}
+
+	grayscaleScalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_AVX2 static void thresholdAVX2(const QRgb* in, QRgb* out, int count)
+{
+	const __m256i alpha = _mm256_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		const __m256i mask = _mm256_srai_epi32(_mm256_slli_epi32(p, 24), 31);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_or_si256(mask, alpha));
+	}
+
+	thresholdScalar(in + i, out + i, count - i);
+}
+
+IMGP_TARGET_AVX2 static void ditherBitsAVX2(const uchar* in, uchar* out, int count, const uint8_t* thresholds)
+{
+	int i = 0;
+
+	for (; i + 32 <= count; i += 32)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		const __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(thresholds + i));
+
+		//Bit i of the mask is byte i, so pixels stay in order
+		const uint32_t white = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, t), v));
+
+		std::memcpy(out + i / 8, &white, 4);
+	}
+
+	ditherBitsSSE2(in + i, out + i / 8, count - i, thresholds + i);
+}
+
+IMGP_TARGET_AVX2 static void lookupAVX2(const QRgb* in, QRgb* out, int count, const simd::ChannelTable& table)
+{
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	const __m256i alpha = _mm256_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+
+		const __m256i r = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table.r), _mm256_and_si256(_mm256_srli_epi32(p, 16), byteMask), 4);
+		const __m256i g = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table.g), _mm256_and_si256(_mm256_srli_epi32(p, 8), byteMask), 4);
+		const __m256i b = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table.b), _mm256_and_si256(p, byteMask), 4);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, alpha)));
+	}
+
+	lookupScalar(in + i, out + i, count - i, table);
+}
+
+IMGP_TARGET_AVX2 static __m256i normalise256(__m256i accum, const simd::Divisor& divisor)
+{
+	accum = _mm256_max_epi32(_mm256_add_epi32(accum, _mm256_set1_epi32(divisor.offset)), _mm256_setzero_si256());
+
+	if (divisor.factor > 1)
+	{
+		const __m256i r = _mm256_set1_epi32((int)divisor.reciprocal);
+		const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(accum, r), 32);
+		const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(accum, 32), r);
+
+		accum = _mm256_blend_epi32(even, odd, 0xaa);
+	}
+
+	return accum;
+}
+
+template<int Size>
+IMGP_TARGET_AVX2 static int convolveAVX2(const QRgb* const* lines, int rows, int cols, const int16_t* weights, const simd::Divisor& divisor, QRgb* out, int count)
+{
+	if (Size > 0)
+	{
+		rows = Size;
+		cols = Size;
+	}
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alpha = _mm256_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		//Accumulators hold pixels (0|4), (1|5), (2|6) and (3|7), as unpacking stays within 128 bit lanes
+		__m256i acc[4] = { zero, zero, zero, zero };
+
+		IMGP_UNROLL
+		for (int ky = 0; ky < rows; ky++)
+		{
+			const QRgb* line = lines[ky] + i;
+			const int16_t* w = weights + ky * cols;
+
+			IMGP_UNROLL
+			for (int kx = 0; kx < cols; kx += 2)
+			{
+				const bool pair = (kx + 1 < cols);
+				const int w1 = pair ? w[kx + 1] : 0;
+				const __m256i wv = _mm256_set1_epi32((int)(((uint32_t)(uint16_t)w1 << 16) | (uint16_t)w[kx]));
+
+				const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + kx));
+				const __m256i b = pair ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + kx + 1)) : zero;
+
+				const __m256i alo = _mm256_unpacklo_epi8(a, zero);
+				const __m256i blo = _mm256_unpacklo_epi8(b, zero);
+				const __m256i ahi = _mm256_unpackhi_epi8(a, zero);
+				const __m256i bhi = _mm256_unpackhi_epi8(b, zero);
+
+				acc[0] = _mm256_add_epi32(acc[0], _mm256_madd_epi16(_mm256_unpacklo_epi16(alo, blo), wv));
+				acc[1] = _mm256_add_epi32(acc[1], _mm256_madd_epi16(_mm256_unpackhi_epi16(alo, blo), wv));
+				acc[2] = _mm256_add_epi32(acc[2], _mm256_madd_epi16(_mm256_unpacklo_epi16(ahi, bhi), wv));
+				acc[3] = _mm256_add_epi32(acc[3], _mm256_madd_epi16(_mm256_unpackhi_epi16(ahi, bhi), wv));
+			}
+		}
+
+		for (__m256i& a : acc)
+			a = normalise256(a, divisor);
+
+		//Packs also work per 128 bit lane, which puts the pixels back in order
+		const __m256i p01 = _mm256_packs_epi32(acc[0], acc[1]);
+		const __m256i p23 = _mm256_packs_epi32(acc[2], acc[3]);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_or_si256(_mm256_packus_epi16(p01, p23), alpha));
+	}
+
+	return i;
+}
+
+IMGP_TARGET_AVX2 static __m256i roundClamped256(__m256 v, __m256 max)
+{
+	return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), max));
+}
+
+IMGP_TARGET_AVX2 static void unpackRgbAVX2(const QRgb* in, float* r, float* g, float* b, int count, float scale)
+{
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	const __m256 s = _mm256_set1_ps(scale);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+
+		_mm256_storeu_ps(r + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 16), byteMask)), s));
+		_mm256_storeu_ps(g + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 8), byteMask)), s));
+		_mm256_storeu_ps(b + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(p, byteMask)), s));
+	}
+
+	unpackRgbScalar(in + i, r + i, g + i, b + i, count - i, scale);
+}
+
+IMGP_TARGET_AVX2 static void unpackChannelAVX2(const QRgb* in, float* out, int count, int shift, float scale)
+{
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	const __m128i bits = _mm_cvtsi32_si128(shift);
+	const __m256 s = _mm256_set1_ps(scale);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(p, bits), byteMask)), s));
+	}
+
+	unpackChannelScalar(in + i, out + i, count - i, shift, scale);
+}
+
+IMGP_TARGET_AVX2 static void lookupChannelAVX2(const QRgb* in, float* out, int count, int shift, const float* table)
+{
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	const __m128i bits = _mm_cvtsi32_si128(shift);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		_mm256_storeu_ps(out + i, _mm256_i32gather_ps(table, _mm256_and_si256(_mm256_srl_epi32(p, bits), byteMask), 4));
+	}
+
+	lookupChannelScalar(in + i, out + i, count - i, shift, table);
+}
+
+IMGP_TARGET_AVX2 static void packGrayAVX2(const float* in, uchar* out, int count, float scale)
+{
+	const __m256 s = _mm256_set1_ps(scale);
+	const __m256 max = _mm256_set1_ps(255.0f);
+
+	//The packs interleave the 128 bit lanes, groups of 4 values are put back in order
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	int i = 0;
+
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i v[4];
+
+		for (int k = 0; k < 4; k++)
+			v[k] = roundClamped256(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8 * k), s), max);
+
+		const __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permutevar8x32_epi32(packed, order));
+	}
+
+	packGrayScalar(in + i, out + i, count - i, scale);
+}
+
+IMGP_TARGET_AVX2 static void packRgbAVX2(const float* r, const float* g, const float* b, QRgb* out, int count, float scale)
+{
+	const __m256 s = _mm256_set1_ps(scale);
+	const __m256 max = _mm256_set1_ps(255.0f);
+	const __m256i alpha = _mm256_set1_epi32((int)opaque);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i rv = roundClamped256(_mm256_mul_ps(_mm256_loadu_ps(r + i), s), max);
+		const __m256i gv = roundClamped256(_mm256_mul_ps(_mm256_loadu_ps(g + i), s), max);
+		const __m256i bv = roundClamped256(_mm256_mul_ps(_mm256_loadu_ps(b + i), s), max);
+
+		const __m256i p = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(rv, 16), _mm256_slli_epi32(gv, 8)), _mm256_or_si256(bv, alpha));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), p);
+	}
+
+	packRgbScalar(r + i, g + i, b + i, out + i, count - i, scale);
+}
+
+IMGP_TARGET_AVX2 static void weightedSumAVX2(const float* const* lines, const float* weights, int taps, float* accum, int count)
+{
+	int i = 0;
+
+	//Four independent sums hide the latency of the additions, each of which depends on the last
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256 s0 = _mm256_loadu_ps(accum + i);
+		__m256 s1 = _mm256_loadu_ps(accum + i + 8);
+		__m256 s2 = _mm256_loadu_ps(accum + i + 16);
+		__m256 s3 = _mm256_loadu_ps(accum + i + 24);
+
+		for (int k = 0; k < taps; k++)
+		{
+			const __m256 w = _mm256_set1_ps(weights[k]);
+			const float* line = lines[k] + i;
+
+			s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(line), w));
+			s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(line + 8), w));
+			s2 = _mm256_add_ps(s2, _mm256_mul_ps(_mm256_loadu_ps(line + 16), w));
+			s3 = _mm256_add_ps(s3, _mm256_mul_ps(_mm256_loadu_ps(line + 24), w));
+		}
+
+		_mm256_storeu_ps(accum + i, s0);
+		_mm256_storeu_ps(accum + i + 8, s1);
+		_mm256_storeu_ps(accum + i + 16, s2);
+		_mm256_storeu_ps(accum + i + 24, s3);
+	}
+
+	//Multiply and add stay separate instructions, a fused multiply add would round differently from the scalar kernel
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_loadu_ps(accum + i);
+
+		for (int k = 0; k < taps; k++)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(lines[k] + i), _mm256_set1_ps(weights[k])));
+
+		_mm256_storeu_ps(accum + i, sum);
+	}
+
+	weightedSumScalar(lines, weights, taps, accum, i, count - i);
+}
+
+IMGP_TARGET_AVX2 static void clampScaledAVX2(float* values, int count, float scale, float max)
+{
+	const __m256 s = _mm256_set1_ps(scale);
+	const __m256 m = _mm256_set1_ps(max);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(values + i, _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(values + i), s), _mm256_setzero_ps()), m));
+
+	clampScaledScalar(values + i, count - i, scale, max);
+}
+
+IMGP_TARGET_AVX2 static void grayscaleAVX2(const float* r, const float* g, const float* b, float* out, int count)
+{
+	const __m256 wr = _mm256_set1_ps(11.0f);
+	const __m256 wg = _mm256_set1_ps(16.0f);
+	const __m256 wb = _mm256_set1_ps(5.0f);
+	const __m256 s = _mm256_set1_ps(1.0f / 32.0f);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(r + i), wr), _mm256_mul_ps(_mm256_loadu_ps(g + i), wg)),
+			_mm256_mul_ps(_mm256_loadu_ps(b + i), wb));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(sum, s));
+	}
+
+	grayscaleScalar(r + i, g + i, b + i, out + i, count - i);
+}
+
+IMGP_TARGET_AVX2 static void unpackGrayscaleAVX2(const QRgb* in, float* out, int count, float scale)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i weights = _mm256_setr_epi16(IMGP_GRAY_WEIGHTS, IMGP_GRAY_WEIGHTS);
+	const __m256 s = _mm256_set1_ps(scale * (1.0f / 32.0f));
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+
+		//Weighted sums as in grayscaleAVX2(), which are exact, and only then scaled
+		const __m256 lo = _mm256_castsi256_ps(_mm256_madd_epi16(_mm256_unpacklo_epi8(p, zero), weights));
+		const __m256 hi = _mm256_castsi256_ps(_mm256_madd_epi16(_mm256_unpackhi_epi8(p, zero), weights));
+		const __m256i even = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		const __m256i odd = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(even, odd)), s));
+	}
+
+	unpackGrayscaleScalar(in + i, out + i, count - i, scale);
+}
+
+IMGP_TARGET_AVX2 static void recursiveFilterAVX2(float* values, int count, std::ptrdiff_t step, int lines, const double* weights, double* w1, double* w2, double* w3)
+{
+	const __m256d b = _mm256_set1_pd(weights[0]);
+	const __m256d a1 = _mm256_set1_pd(weights[1]);
+	const __m256d a2 = _mm256_set1_pd(weights[2]);
+	const __m256d a3 = _mm256_set1_pd(weights[3]);
+
+	int l = 0;
+
+	//Eight lines at once, two independent recursions hide the latency of a step
+	for (; l + 8 <= lines; l += 8)
+	{
+		__m256d s1 = _mm256_loadu_pd(w1 + l);
+		__m256d s2 = _mm256_loadu_pd(w2 + l);
+		__m256d s3 = _mm256_loadu_pd(w3 + l);
+		__m256d t1 = _mm256_loadu_pd(w1 + l + 4);
+		__m256d t2 = _mm256_loadu_pd(w2 + l + 4);
+		__m256d t3 = _mm256_loadu_pd(w3 + l + 4);
+
+		float* v = values + l;
+
+		for (int i = 0; i < count; i++, v += step)
+		{
+			const __m256d w = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(b, _mm256_cvtps_pd(_mm_loadu_ps(v))), _mm256_mul_pd(a1, s1)), _mm256_mul_pd(a2, s2)), _mm256_mul_pd(a3, s3));
+			const __m256d u = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(b, _mm256_cvtps_pd(_mm_loadu_ps(v + 4))), _mm256_mul_pd(a1, t1)), _mm256_mul_pd(a2, t2)), _mm256_mul_pd(a3, t3));
+
+			s3 = s2;
+			s2 = s1;
+			s1 = w;
+			t3 = t2;
+			t2 = t1;
+			t1 = u;
+
+			_mm_storeu_ps(v, _mm256_cvtpd_ps(w));
+			_mm_storeu_ps(v + 4, _mm256_cvtpd_ps(u));
+		}
+
+		_mm256_storeu_pd(w1 + l, s1);
+		_mm256_storeu_pd(w2 + l, s2);
+		_mm256_storeu_pd(w3 + l, s3);
+		_mm256_storeu_pd(w1 + l + 4, t1);
+		_mm256_storeu_pd(w2 + l + 4, t2);
+		_mm256_storeu_pd(w3 + l + 4, t3);
+	}
+
+	recursiveFilterSSE2(values + l, count, step, lines - l, weights, w1 + l, w2 + l, w3 + l);
+}
+
+IMGP_TARGET_AVX2 static void interpolateAVX2(const float* in, float* out, int count, const float* samples, int segments, float scale)
+{
+	const __m256 s = _mm256_set1_ps(scale);
+	const __m256 end = _mm256_set1_ps((float)segments);
+	const __m256i last = _mm256_set1_epi32(segments - 1);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), s), _mm256_setzero_ps()), end);
+		const __m256i segment = _mm256_min_epi32(_mm256_cvttps_epi32(x), last);
+		const __m256 f = _mm256_sub_ps(x, _mm256_cvtepi32_ps(segment));
+
+		const __m256 s0 = _mm256_i32gather_ps(samples, segment, 4);
+		const __m256 s1 = _mm256_i32gather_ps(samples + 1, segment, 4);
+
+		_mm256_storeu_ps(out + i, _mm256_add_ps(s0, _mm256_mul_ps(f, _mm256_sub_ps(s1, s0))));
+	}
+
+	interpolateScalar(in + i, out + i, count - i, samples, segments, scale);
+}
+
+#endif //IMGP_SIMD_X86
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+simd::Isa simd::detect()
+{
+#if defined(IMGP_SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	const bool sse2 = (info[3] & (1 << 26)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+	bool avx2 = false;
+
+	if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	return avx2 ? Isa::AVX2 : (sse2 ? Isa::SSE2 : Isa::Scalar);
+#elif defined(IMGP_SIMD_X86)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return Isa::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return Isa::SSE2;
+
+	return Isa::Scalar;
+#else
+	return Isa::Scalar;
+#endif
+}
+
+static simd::Isa& activeIsa()
+{
+	static simd::Isa isa = simd::detect();
+	return isa;
+}
+
+simd::Isa simd::isa()
+{
+	return activeIsa();
+}
+
+void simd::setIsa(Isa isa)
+{
+	activeIsa() = (Isa)std::min((int)isa, (int)detect());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void simd::grayscale(const QRgb* in, QRgb* out, int count)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: grayscaleAVX2(in, out, count); return;
+	case Isa::SSE2: grayscaleSSE2(in, out, count); return;
+#endif
+	default: grayscaleScalar(in, out, count); return;
+	}
+}
+
+void simd::grayscale8(const QRgb* in, uchar* out, int count)
+{
+	//Packing down to bytes needs as many shuffles as there are AVX2 lanes to gain
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+	case Isa::SSE2: grayscale8SSE2(in, out, count); return;
+#endif
+	default: grayscale8Scalar(in, out, count); return;
+	}
+}
+
+void simd::grayToRgb(const uchar* in, QRgb* out, int count)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+	case Isa::SSE2: grayToRgbSSE2(in, out, count); return;
+#endif
+	default: grayToRgbScalar(in, out, count); return;
+	}
+}
+
+void simd::bitsToRgb(const uchar* in, QRgb* out, int count)
+{
+	//Bound by the stores, any of the vector kernels would only save the shifts
+	for (int i = 0; i < count; i++)
+		out[i] = ((in[i / 8] >> (i % 8)) & 1) ? 0xffffffff : opaque;
+}
+
+void simd::threshold(const QRgb* in, QRgb* out, int count)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: thresholdAVX2(in, out, count); return;
+	case Isa::SSE2: thresholdSSE2(in, out, count); return;
+#endif
+	default: thresholdScalar(in, out, count); return;
+	}
+}
+
+void simd::ditherBits(const QRgb* in, uchar* out, int count, const uint8_t* thresholds)
+{
+	//Packing is bound by the compare, the SSE2 version is as fast as AVX2 would be
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+	case Isa::SSE2: ditherBitsSSE2(in, out, count, thresholds); return;
+#endif
+	default: ditherBitsScalar(in, out, count, thresholds); return;
+	}
+}
+
+void simd::ditherBits(const uchar* in, uchar* out, int count, const uint8_t* thresholds)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: ditherBitsAVX2(in, out, count, thresholds); return;
+	case Isa::SSE2: ditherBitsSSE2(in, out, count, thresholds); return;
+#endif
+	default: ditherBitsScalar(in, out, count, thresholds); return;
+	}
+}
+
+void simd::lookup(const uchar* in, uchar* out, int count, const uint8_t* table)
+{
+	//One load per value, there is nothing for vector instructions to do without a gather
+	for (int i = 0; i < count; i++)
+		out[i] = table[in[i]];
+}
+
+void simd::lookup(const QRgb* in, QRgb* out, int count, const ChannelTable& table)
+{
+	//Byte lookups do not vectorise without a gather instruction
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: lookupAVX2(in, out, count, table); return;
+#endif
+	default: lookupScalar(in, out, count, table); return;
+	}
+}
+
+int simd::convolve(const QRgb* const* lines, int rows, int cols, const int16_t* weights, const Divisor& divisor, QRgb* out, int count)
+{
+#ifdef IMGP_SIMD_X86
+	const int size = (rows == cols && (rows == 3 || rows == 5 || rows == 7)) ? rows : 0;
+#endif
+
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+		switch (size)
+		{
+		case 3: return convolveAVX2<3>(lines, rows, cols, weights, divisor, out, count);
+		case 5: return convolveAVX2<5>(lines, rows, cols, weights, divisor, out, count);
+		case 7: return convolveAVX2<7>(lines, rows, cols, weights, divisor, out, count);
+		default: return convolveAVX2<0>(lines, rows, cols, weights, divisor, out, count);
+		}
+
+	case Isa::SSE2:
+		switch (size)
+		{
+		case 3: return convolveSSE2<3>(lines, rows, cols, weights, divisor, out, count);
+		case 5: return convolveSSE2<5>(lines, rows, cols, weights, divisor, out, count);
+		case 7: return convolveSSE2<7>(lines, rows, cols, weights, divisor, out, count);
+		default: return convolveSSE2<0>(lines, rows, cols, weights, divisor, out, count);
+		}
+#endif
+	default: return 0;
+	}
+}
+
+void simd::unpackRgb(const QRgb* in, float* r, float* g, float* b, int count, float scale)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: unpackRgbAVX2(in, r, g, b, count, scale); return;
+	case Isa::SSE2: unpackRgbSSE2(in, r, g, b, count, scale); return;
+#endif
+	default: unpackRgbScalar(in, r, g, b, count, scale); return;
+	}
+}
+
+void simd::unpackChannel(const QRgb* in, float* out, int count, int shift, float scale)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: unpackChannelAVX2(in, out, count, shift, scale); return;
+	case Isa::SSE2: unpackChannelSSE2(in, out, count, shift, scale); return;
+#endif
+	default: unpackChannelScalar(in, out, count, shift, scale); return;
+	}
+}
+
+void simd::lookupChannel(const QRgb* in, float* out, int count, int shift, const float* table)
+{
+	//Without gathers a table is looked up a value at a time
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: lookupChannelAVX2(in, out, count, shift, table); return;
+#endif
+	default: lookupChannelScalar(in, out, count, shift, table); return;
+	}
+}
+
+void simd::packRgb(const float* r, const float* g, const float* b, QRgb* out, int count, float scale)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: packRgbAVX2(r, g, b, out, count, scale); return;
+	case Isa::SSE2: packRgbSSE2(r, g, b, out, count, scale); return;
+#endif
+	default: packRgbScalar(r, g, b, out, count, scale); return;
+	}
+}
+
+void simd::unpackGray(const uchar* in, float* out, int count, float scale)
+{
+	//Widening bytes to floats needs more shuffles across AVX2 lanes than it saves
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+	case Isa::SSE2: unpackGraySSE2(in, out, count, scale); return;
+#endif
+	default: unpackGrayScalar(in, out, count, scale); return;
+	}
+}
+
+void simd::packGray(const float* in, uchar* out, int count, float scale)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: packGrayAVX2(in, out, count, scale); return;
+	case Isa::SSE2: packGraySSE2(in, out, count, scale); return;
+#endif
+	default: packGrayScalar(in, out, count, scale); return;
+	}
+}
+
+void simd::wordsToFloat(const uint16_t* in, float* out, int count)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+	case Isa::SSE2: wordsToFloatSSE2(in, out, count); return;
+#endif
+	default: wordsToFloatScalar(in, out, count); return;
+	}
+}
+
+void simd::floatToWords(const float* in, uint16_t* out, int count)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+	case Isa::SSE2: floatToWordsSSE2(in, out, count); return;
+#endif
+	default: floatToWordsScalar(in, out, count); return;
+	}
+}
+
+void simd::weightedSum(const float* const* lines, const float* weights, int taps, float* accum, int count)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: weightedSumAVX2(lines, weights, taps, accum, count); return;
+	case Isa::SSE2: weightedSumSSE2(lines, weights, taps, accum, count); return;
+#endif
+	default: weightedSumScalar(lines, weights, taps, accum, 0, count); return;
+	}
+}
+
+void simd::clampScaled(float* values, int count, float scale, float max)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: clampScaledAVX2(values, count, scale, max); return;
+	case Isa::SSE2: clampScaledSSE2(values, count, scale, max); return;
+#endif
+	default: clampScaledScalar(values, count, scale, max); return;
+	}
+}
+
+void simd::grayscale(const float* r, const float* g, const float* b, float* out, int count)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: grayscaleAVX2(r, g, b, out, count); return;
+	case Isa::SSE2: grayscaleSSE2(r, g, b, out, count); return;
+#endif
+	default: grayscaleScalar(r, g, b, out, count); return;
+	}
+}
+
+void simd::unpackGrayscale(const QRgb* in, float* out, int count, float scale)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: unpackGrayscaleAVX2(in, out, count, scale); return;
+	case Isa::SSE2: unpackGrayscaleSSE2(in, out, count, scale); return;
+#endif
+	default: unpackGrayscaleScalar(in, out, count, scale); return;
+	}
+}
+
+void simd::streamCopy(const void* in, void* out, size_t bytes)
+{
+	//Wider stores would not move the bytes any faster
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2:
+	case Isa::SSE2: streamCopySSE2(in, out, bytes); return;
+#endif
+	default: std::memcpy(out, in, bytes); return;
+	}
+}
+
+void simd::streamFence()
+{
+	//Streaming stores are weakly ordered, waiting for them costs about as long as a read from memory
+#ifdef IMGP_SIMD_X86
+	if (isa() != Isa::Scalar)
+		_mm_sfence();
+#endif
+}
+
+void simd::interpolate(const float* in, float* out, int count, const float* samples, int segments, float scale)
+{
+	//Two table loads per value, which only vectorise with a gather instruction
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: interpolateAVX2(in, out, count, samples, segments, scale); return;
+#endif
+	default: interpolateScalar(in, out, count, samples, segments, scale); return;
+	}
+}
+
+void simd::recursiveFilter(float* values, int count, std::ptrdiff_t step, int lines, const double* weights, double* w1, double* w2, double* w3)
+{
+	switch (isa())
+	{
+#ifdef IMGP_SIMD_X86
+	case Isa::AVX2: recursiveFilterAVX2(values, count, step, lines, weights, w1, w2, w3); return;
+	case Isa::SSE2: recursiveFilterSSE2(values, count, step, lines, weights, w1, w2, w3); return;
+#endif
+	default: recursiveFilterScalar(values, count, step, lines, weights, w1, w2, w3); return;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
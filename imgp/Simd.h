@@ -0,0 +1,157 @@
+/*
+	Vectorized pixel kernels
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <QRgb>
+
+/*
+	Hot loops of the image pipeline with SSE2 and AVX2 implementations.
+
+	The instruction set is chosen at runtime from what the CPU supports. Every kernel has a scalar
+	implementation which gives exactly the same output, it is used on other architectures and for
+	the ends of spans that do not fill a whole vector.
+*/
+namespace simd
+{
+	enum class Isa
+	{
+		Scalar = 0,
+		SSE2   = 1,
+		AVX2   = 2,
+	};
+
+	//Best instruction set supported by the CPU
+	Isa detect();
+
+	//Instruction set used by the kernels, defaults to detect()
+	Isa isa();
+
+	//Restrict the kernels to an instruction set, it is clamped to what the CPU supports
+	void setIsa(Isa isa);
+
+	/*
+		Per channel lookup table of a point operation.
+		Entries are already shifted into their channel position of a QRgb.
+	*/
+	struct ChannelTable
+	{
+		uint32_t r[256];
+		uint32_t g[256];
+		uint32_t b[256];
+	};
+
+	/*
+		Integer divisor of a convolution weight sum, with an offset added to the sum first.
+		A non zero reciprocal is a 32.32 fixed point value which divides exactly.
+	*/
+	struct Divisor
+	{
+		int factor;
+		uint32_t reciprocal;
+		int offset;
+	};
+
+	//Convert pixels to opaque gray
+	void grayscale(const QRgb* in, QRgb* out, int count);
+
+	//Convert pixels to 8-bit gray values
+	void grayscale8(const QRgb* in, uchar* out, int count);
+
+	//Expand 8-bit gray values to opaque gray pixels
+	void grayToRgb(const uchar* in, QRgb* out, int count);
+
+	//Expand packed bits, least significant bit first, to opaque black and white pixels
+	void bitsToRgb(const uchar* in, QRgb* out, int count);
+
+	//Threshold the blue channel of pixels at 128 to opaque black or white
+	void threshold(const QRgb* in, QRgb* out, int count);
+
+	//Dither the blue channel of pixels into packed bits, least significant bit first, 1 where it reaches thresholds[i]
+	void ditherBits(const QRgb* in, uchar* out, int count, const uint8_t* thresholds);
+
+	//Dither 8-bit gray values into packed bits, 1 where a value reaches thresholds[i]
+	void ditherBits(const uchar* in, uchar* out, int count, const uint8_t* thresholds);
+
+	//Map every colour channel of pixels through a table, the output is opaque
+	void lookup(const QRgb* in, QRgb* out, int count, const ChannelTable& table);
+
+	//Map 8-bit gray values through a 256 entry table
+	void lookup(const uchar* in, uchar* out, int count, const uint8_t* table);
+
+	/*
+		Convolve count pixels with a rows*cols kernel, the output is opaque.
+
+		lines[ky] points to the pixel under the top left tap of the first output pixel for kernel row ky,
+		every tap must be inside the image. The divisor must be 1 or have a reciprocal.
+		Returns the number of pixels written, which is a multiple of the vector width, the rest is left to the caller.
+		3x3, 5x5 and 7x7 kernels run instantiations of their own with the loops over their taps unrolled.
+	*/
+	int convolve(const QRgb* const* lines, int rows, int cols, const int16_t* weights, const Divisor& divisor, QRgb* out, int count);
+
+	/*
+		Float kernels of the high precision path.
+
+		Conversions to 8 and 16 bits clamp and round to nearest, the others keep their multiplications
+		and additions separate so every instruction set rounds the same way.
+	*/
+
+	//Split pixels into float colour channels, multiplied by scale
+	void unpackRgb(const QRgb* in, float* r, float* g, float* b, int count, float scale);
+
+	//Convert the channel of pixels shift bits up, 16 for red, 8 for green and 0 for blue, to floats multiplied by scale
+	void unpackChannel(const QRgb* in, float* out, int count, int shift, float scale);
+
+	//Map the channel of pixels shift bits up through a table of 256 floats
+	void lookupChannel(const QRgb* in, float* out, int count, int shift, const float* table);
+
+	//Round float colour channels multiplied by scale into opaque pixels
+	void packRgb(const float* r, const float* g, const float* b, QRgb* out, int count, float scale);
+
+	//Convert 8-bit gray values to floats, multiplied by scale
+	void unpackGray(const uchar* in, float* out, int count, float scale);
+
+	//Round floats multiplied by scale into 8-bit gray values
+	void packGray(const float* in, uchar* out, int count, float scale);
+
+	//Convert 16-bit values to floats and back
+	void wordsToFloat(const uint16_t* in, float* out, int count);
+	void floatToWords(const float* in, uint16_t* out, int count);
+
+	//Add the weighted values of several lines to accumulators, accum[i] += lines[0][i] * weights[0] + ... in that order
+	void weightedSum(const float* const* lines, const float* weights, int taps, float* accum, int count);
+
+	//Multiply values by scale and clamp them to [0, max]
+	void clampScaled(float* values, int count, float scale, float max);
+
+	//Gray values of float colour channels, with the weights of qGray()
+	void grayscale(const float* r, const float* g, const float* b, float* out, int count);
+
+	//Gray values of pixels with the weights of qGray() but without truncating, as floats multiplied by scale
+	void unpackGrayscale(const QRgb* in, float* out, int count, float scale);
+
+	//Copy bytes without keeping them in cache, for results which are only read again by a later pass over the image
+	void streamCopy(const void* in, void* out, size_t bytes);
+
+	//Complete the copies of streamCopy(), before the thread that made them hands them on
+	void streamFence();
+
+	/*
+		Map values through a piecewise linear curve of segments + 1 samples,
+		value v falls at position v * scale along the curve, clamped to its ends.
+	*/
+	void interpolate(const float* in, float* out, int count, const float* samples, int segments, float scale);
+
+	/*
+		Run a third order recursion along count steps of several independent lines, w = weights[0] * v +
+		weights[1] * w1 + weights[2] * w2 + weights[3] * w3 replacing every value v. The lines' values of a step
+		are contiguous, those of the next step are step floats further on, or back if it is negative.
+		w1, w2 and w3 hold the last three outputs of every line, before and after. The recursion runs in double,
+		only the values stored are rounded to float.
+	*/
+	void recursiveFilter(float* values, int count, std::ptrdiff_t step, int lines, const double* weights, double* w1, double* w2, double* w3);
+}
@@ -0,0 +1,120 @@
+/*
+	Out of core image processing
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "StreamingPipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Ordered and pattern dithering tile the image with threshold maps of up to 16x16, so windows start on multiples of their size
+static const int patternSize = 16;
+
+static int alignUp(int v, int alignment)
+{
+	return (v + alignment - 1) / alignment * alignment;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+StreamingPipeline::StreamingPipeline(const Job& job, int halo, int stripRows) :
+	m_job(job),
+	m_halo(halo),
+	m_stripRows(alignUp(std::max(1, stripRows), patternSize)),
+	m_peakMemory(0)
+{
+	m_pipeline.blockSignals(true);
+
+	//Every window is a new image, nothing would ever be found in the result cache
+	m_pipeline.resultCache().setBudget(0);
+}
+
+bool StreamingPipeline::run(StripReader& reader, StripWriter& writer)
+{
+	if (m_halo < 0)
+	{
+		m_error = "the pipeline depends on the whole image and cannot be streamed";
+		return false;
+	}
+
+	const int width = reader.size().width();
+	const int height = reader.size().height();
+
+	//Rows kept above a strip, and read below it
+	const int above = alignUp(m_halo, patternSize);
+	const int below = m_halo;
+
+	//Rolling buffer of the rows around the current strip, windows are views of its top rows
+	QImage rows(width, std::min(height, above + m_stripRows + below), ImagePipeline::WorkingFormat);
+
+	if (rows.isNull())
+	{
+		m_error = "unable to allocate the row buffer";
+		return false;
+	}
+
+	uchar* const bits = rows.bits();
+	const int stride = rows.bytesPerLine();
+
+	//Rows [r0, r1) of the image currently held in the buffer
+	int r0 = 0;
+	int r1 = 0;
+
+	m_peakMemory = 0;
+
+	for (int s0 = 0; s0 < height; s0 += m_stripRows)
+	{
+		const int s1 = std::min(height, s0 + m_stripRows);
+
+		//Window of the strip, clipped to the image
+		const int w0 = std::max(0, s0 - above);
+		const int w1 = std::min(height, s1 + below);
+
+		//Drop the rows above the window, the rows still needed move to the top of the buffer
+		if (w0 < r1)
+		{
+			std::memmove(bits, bits + (size_t)(w0 - r0) * stride, (size_t)(r1 - w0) * stride);
+		}
+		else
+		{
+			r1 = w0;
+		}
+
+		r0 = w0;
+
+		if (w1 > r1 && !reader.read(r1, w1 - r1, rows, r1 - r0))
+		{
+			m_error = reader.errorString();
+			return false;
+		}
+
+		r1 = w1;
+
+		//The window shares the buffer's rows, it is only read by the pipeline
+		const QImage window(bits, width, w1 - w0, stride, ImagePipeline::WorkingFormat);
+
+		m_pipeline.load(window);
+		m_pipeline.resetPeakMemory();
+		m_pipeline.defer();
+
+		if (m_job)
+			m_job(m_pipeline);
+
+		m_pipeline.execute();
+
+		//The pipeline counts the window it loaded, which is part of the buffer
+		m_peakMemory = std::max(m_peakMemory, rows.sizeInBytes() + m_pipeline.peakMemory() - window.sizeInBytes());
+
+		if (!writer.write(m_pipeline.image(), s0 - w0, s1 - s0))
+		{
+			m_error = writer.errorString();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,53 @@
+/*
+	Out of core image processing
+*/
+
+#pragma once
+
+#include <functional>
+
+#include <QString>
+
+#include "ImagePipeline.h"
+#include "StripIO.h"
+
+/*
+	Runs a pipeline job over an image too large to hold in memory, a strip of rows at a time.
+
+	Each strip is processed in a window grown by the job's halo, the rows of context every output row
+	depends on, and clipped to the image so edges are clamped as they would be on the whole image.
+	Windows overlap, the rows two strips share stay in a rolling buffer and every row is read once.
+	Memory use is proportional to the image width times the strip height plus twice the halo.
+
+	Jobs with a negative halo (error diffusion) depend on the whole image and cannot be streamed.
+*/
+class StreamingPipeline
+{
+public:
+
+	using Job = std::function<void(ImagePipeline&)>;
+
+	StreamingPipeline(const Job& job, int halo, int stripRows = 128);
+
+	//Read, process and write the image strip by strip
+	bool run(StripReader& reader, StripWriter& writer);
+
+	//Largest number of bytes held by the rolling buffer and the pipeline of the last run
+	qint64 peakMemory() const { return m_peakMemory; }
+
+	QString errorString() const { return m_error; }
+
+	//Thread pool each strip is split across
+	void setThreadPool(ThreadPool* pool) { m_pipeline.setThreadPool(pool); }
+
+private:
+
+	Job m_job;
+	int m_halo;
+	int m_stripRows;
+
+	ImagePipeline m_pipeline;
+
+	qint64 m_peakMemory;
+	QString m_error;
+};
@@ -0,0 +1,308 @@
+/*
+	Reading and writing images a strip of rows at a time
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <QImageIOHandler>
+#include <QImageReader>
+
+#include "StripIO.h"
+#include "ImagePipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Read a decimal number of a netpbm header, skipping whitespace and comments before it
+static bool readHeaderValue(QFile& file, int& value)
+{
+	char c = 0;
+
+	for (;;)
+	{
+		if (!file.getChar(&c))
+			return false;
+
+		if (c == '#')
+		{
+			while (c != '\n')
+			{
+				if (!file.getChar(&c))
+					return false;
+			}
+		}
+		else if (!std::isspace((uchar)c))
+		{
+			break;
+		}
+	}
+
+	value = 0;
+
+	while (c >= '0' && c <= '9')
+	{
+		if (value > (1 << 24))
+			return false;
+
+		value = value * 10 + (c - '0');
+
+		if (!file.getChar(&c))
+			return false;
+	}
+
+	//Exactly one whitespace character ends the value, after the last one the pixel data starts
+	return std::isspace((uchar)c);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+StripReader::StripReader() :
+	m_dataOffset(0),
+	m_channels(0),
+	m_sampleBytes(1),
+	m_maxValue(255)
+{
+}
+
+bool StripReader::open(const QString& path)
+{
+	m_path = path;
+	m_error.clear();
+	m_size = QSize();
+	m_file.close();
+
+	if (openNetpbm())
+		return true;
+
+	if (!m_error.isEmpty())
+		return false;
+
+	QImageReader reader(path);
+
+	if (!reader.canRead())
+	{
+		m_error = reader.errorString();
+		return false;
+	}
+
+	if (!reader.supportsOption(QImageIOHandler::ClipRect) || !reader.supportsOption(QImageIOHandler::Size))
+	{
+		m_error = "format " + QString::fromLatin1(reader.format()) + " cannot be read in strips";
+		return false;
+	}
+
+	m_size = reader.size();
+	return true;
+}
+
+bool StripReader::openNetpbm()
+{
+	m_file.setFileName(m_path);
+
+	if (!m_file.open(QIODevice::ReadOnly))
+	{
+		m_error = m_file.errorString();
+		return false;
+	}
+
+	char magic[2];
+
+	if (m_file.read(magic, 2) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+	{
+		//Not a binary netpbm file, leave it to QImageReader
+		m_file.close();
+		return false;
+	}
+
+	int width = 0;
+	int height = 0;
+
+	if (!readHeaderValue(m_file, width) || !readHeaderValue(m_file, height) || !readHeaderValue(m_file, m_maxValue) ||
+		width <= 0 || height <= 0 || m_maxValue <= 0 || m_maxValue > 65535)
+	{
+		m_error = "invalid netpbm header";
+		m_file.close();
+		return false;
+	}
+
+	m_channels = magic[1] == '5' ? 1 : 3;
+	m_sampleBytes = m_maxValue > 255 ? 2 : 1;
+	m_dataOffset = m_file.pos();
+	m_size = QSize(width, height);
+
+	if (m_file.size() < m_dataOffset + (qint64)width * height * m_channels * m_sampleBytes)
+	{
+		m_error = "truncated netpbm file";
+		m_file.close();
+		return false;
+	}
+
+	return true;
+}
+
+bool StripReader::read(int y, int count, QImage& dst, int dstY)
+{
+	return m_file.isOpen() ? readNetpbm(y, count, dst, dstY) : readClipped(y, count, dst, dstY);
+}
+
+bool StripReader::readNetpbm(int y, int count, QImage& dst, int dstY)
+{
+	const int width = m_size.width();
+	const qint64 rowBytes = (qint64)width * m_channels * m_sampleBytes;
+
+	//Strips are usually read in order, so seeking is rarely needed
+	const qint64 offset = m_dataOffset + y * rowBytes;
+
+	if (m_file.pos() != offset && !m_file.seek(offset))
+	{
+		m_error = m_file.errorString();
+		return false;
+	}
+
+	m_row.resize(rowBytes);
+
+	for (int j = 0; j < count; j++)
+	{
+		if (m_file.read(reinterpret_cast<char*>(m_row.data()), rowBytes) != rowBytes)
+		{
+			m_error = "unexpected end of file";
+			return false;
+		}
+
+		QRgb* line = reinterpret_cast<QRgb*>(dst.scanLine(dstY + j));
+		const uchar* in = m_row.data();
+
+		//Samples are big endian and scaled from the maximum value to 8 bits
+		auto sample = [this](const uchar* s) {
+			const int v = m_sampleBytes == 2 ? (s[0] << 8) | s[1] : s[0];
+			return m_maxValue == 255 ? v : (std::min(v, m_maxValue) * 255 + m_maxValue / 2) / m_maxValue;
+		};
+
+		for (int x = 0; x < width; x++)
+		{
+			const int r = sample(in);
+			const int g = m_channels == 3 ? sample(in + m_sampleBytes) : r;
+			const int b = m_channels == 3 ? sample(in + 2 * m_sampleBytes) : r;
+
+			line[x] = qRgb(r, g, b);
+			in += m_channels * m_sampleBytes;
+		}
+	}
+
+	return true;
+}
+
+bool StripReader::readClipped(int y, int count, QImage& dst, int dstY)
+{
+	//A reader only reads an image once, so every strip needs a new one
+	QImageReader reader(m_path);
+	reader.setClipRect(QRect(0, y, m_size.width(), count));
+
+	const QImage strip = reader.read().convertToFormat(dst.format());
+
+	if (strip.isNull() || strip.width() != m_size.width() || strip.height() != count)
+	{
+		m_error = strip.isNull() ? reader.errorString() : "clip rect not honoured by the image plugin";
+		return false;
+	}
+
+	for (int j = 0; j < count; j++)
+		std::memcpy(dst.scanLine(dstY + j), strip.constScanLine(j), (size_t)m_size.width() * 4);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+StripWriter::StripWriter() :
+	m_channels(3),
+	m_rows(0)
+{
+}
+
+bool StripWriter::open(const QString& path, QSize size)
+{
+	m_size = size;
+	m_rows = 0;
+	m_channels = path.endsWith(".pgm", Qt::CaseInsensitive) ? 1 : 3;
+
+	m_file.setFileName(path);
+
+	if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		m_error = m_file.errorString();
+		return false;
+	}
+
+	const QByteArray header = QString("P%1\n%2 %3\n255\n").arg(m_channels == 1 ? 5 : 6).arg(size.width()).arg(size.height()).toLatin1();
+
+	if (m_file.write(header) != (qint64)header.size())
+	{
+		m_error = m_file.errorString();
+		return false;
+	}
+
+	return true;
+}
+
+bool StripWriter::write(const QImage& img, int y, int count)
+{
+	const int width = m_size.width();
+	const qint64 rowBytes = (qint64)width * m_channels;
+
+	//Binary rows and gray rows of colour files are converted, gray rows of gray files are written as they are
+	const bool grayRows = (img.format() == ImagePipeline::GrayFormat);
+
+	if (img.format() != ImagePipeline::WorkingFormat && !(grayRows && m_channels == 1))
+		return write(img.copy(0, y, width, count).convertToFormat(ImagePipeline::WorkingFormat), 0, count);
+
+	m_row.resize(rowBytes);
+
+	for (int j = 0; j < count; j++)
+	{
+		const QRgb* line = reinterpret_cast<const QRgb*>(img.constScanLine(y + j));
+		uchar* out = m_row.data();
+
+		if (grayRows)
+		{
+			std::memcpy(out, img.constScanLine(y + j), width);
+		}
+		else if (m_channels == 1)
+		{
+			for (int x = 0; x < width; x++)
+				out[x] = (uchar)qGray(line[x]);
+		}
+		else
+		{
+			for (int x = 0; x < width; x++)
+			{
+				out[3 * x + 0] = (uchar)qRed(line[x]);
+				out[3 * x + 1] = (uchar)qGreen(line[x]);
+				out[3 * x + 2] = (uchar)qBlue(line[x]);
+			}
+		}
+
+		if (m_file.write(reinterpret_cast<const char*>(m_row.data()), rowBytes) != rowBytes)
+		{
+			m_error = m_file.errorString();
+			return false;
+		}
+	}
+
+	m_rows += count;
+	return true;
+}
+
+bool StripWriter::close()
+{
+	if (m_rows != m_size.height())
+		m_error = "image is incomplete";
+	else if (!m_file.flush())
+		m_error = m_file.errorString();
+
+	m_file.close();
+	return m_rows == m_size.height() && m_error.isEmpty();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,86 @@
+/*
+	Reading and writing images a strip of rows at a time
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <QFile>
+#include <QImage>
+#include <QString>
+
+/*
+	Reads an image file in strips of rows, so it never has to fit in memory as a whole.
+
+	Binary netpbm files (.pgm, .ppm) are read directly from their pixel data. Other formats are read
+	through QImageReader clip rects if their image plugin supports them, which may decode the file
+	from its start for every strip, so very large images are best converted to netpbm first.
+*/
+class StripReader
+{
+public:
+
+	StripReader();
+
+	//Open a file, returns false if it cannot be read in strips
+	bool open(const QString& path);
+
+	//Size of the whole image
+	QSize size() const { return m_size; }
+
+	//Read rows [y, y + count) into rows [dstY, dstY + count) of a working format image
+	bool read(int y, int count, QImage& dst, int dstY);
+
+	QString errorString() const { return m_error; }
+
+private:
+
+	bool openNetpbm();
+
+	bool readNetpbm(int y, int count, QImage& dst, int dstY);
+	bool readClipped(int y, int count, QImage& dst, int dstY);
+
+	QString m_path;
+	QString m_error;
+	QSize m_size;
+
+	//Netpbm files only
+	QFile m_file;
+	qint64 m_dataOffset;
+	int m_channels;
+	int m_sampleBytes;
+	int m_maxValue;
+	std::vector<uchar> m_row;
+};
+
+/*
+	Writes an image file in strips of rows, top to bottom.
+	Results are written as binary netpbm, gray scale if the file name ends in .pgm and colour otherwise.
+*/
+class StripWriter
+{
+public:
+
+	StripWriter();
+
+	//Create a file for an image of the given size
+	bool open(const QString& path, QSize size);
+
+	//Append rows [y, y + count) of a working format, gray scale or binary image
+	bool write(const QImage& img, int y, int count);
+
+	//Flush and close the file, returns false if it is incomplete or could not be written
+	bool close();
+
+	QString errorString() const { return m_error; }
+
+private:
+
+	QFile m_file;
+	QString m_error;
+	QSize m_size;
+	int m_channels;
+	int m_rows;
+	std::vector<uchar> m_row;
+};
@@ -0,0 +1,164 @@
+/*
+	Summed-area tables
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "SummedAreaTable.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Sum a row of values padded by radius copies of its first and last value into a table row, after its zero entry
+template<typename Function_t>
+static void prefixSum(const uint8_t* values, int width, int radius, Function_t square, uint32_t* out)
+{
+	uint32_t sum = 0;
+	out[0] = 0;
+
+	const uint32_t first = square(values[0]);
+	const uint32_t last = square(values[width - 1]);
+
+	for (int i = 0; i < radius; i++)
+		*++out = (sum += first);
+
+	for (int i = 0; i < width; i++)
+		*++out = (sum += square(values[i]));
+
+	for (int i = 0; i < radius; i++)
+		*++out = (sum += last);
+}
+
+struct Identity
+{
+	uint32_t operator()(uint8_t v) const { return v; }
+};
+
+struct Square
+{
+	uint32_t operator()(uint8_t v) const { return (uint32_t)v * v; }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SummedAreaTable::SummedAreaTable() :
+	m_width(0),
+	m_height(0),
+	m_channel(0),
+	m_radius(0),
+	m_squared(false)
+{
+}
+
+bool SummedAreaTable::reset(const QImage& img, int c, int radius, bool squares)
+{
+	m_width = img.width();
+	m_height = img.height();
+	m_channel = (img.format() == QImage::Format_Grayscale8) ? -1 : c;
+	m_radius = radius;
+	m_squared = squares;
+
+	const size_t capacity = m_sums.capacity() + m_squares.capacity();
+	const size_t size = (size_t)(rows() + 1) * (columns() + 1);
+
+	m_sums.resize(size);
+	m_squares.resize(squares ? size : 0);
+
+	//The row above the image sums nothing, every other row is written by sumRows()
+	std::fill(m_sums.begin(), m_sums.begin() + columns() + 1, 0);
+
+	if (squares)
+		std::fill(m_squares.begin(), m_squares.begin() + columns() + 1, 0);
+
+	return m_sums.capacity() + m_squares.capacity() != capacity;
+}
+
+void SummedAreaTable::sumRows(const QImage& img, int j0, int j1)
+{
+	thread_local std::vector<uint8_t> buffer;
+	buffer.resize(m_width);
+
+	//Position of the channel in a working format pixel
+	const int shift = 16 - 8 * std::max(0, m_channel);
+
+	for (int j = j0; j < j1; j++)
+	{
+		//Padding rows repeat the top and bottom rows
+		const int y = std::max(0, std::min(m_height - 1, j - m_radius));
+		const uint8_t* values = img.constScanLine(y);
+
+		if (m_channel >= 0)
+		{
+			const QRgb* pixels = reinterpret_cast<const QRgb*>(values);
+
+			for (int x = 0; x < m_width; x++)
+				buffer[x] = (uint8_t)(pixels[x] >> shift);
+
+			values = buffer.data();
+		}
+
+		prefixSum(values, m_width, m_radius, Identity(), line(m_sums, j + 1));
+
+		if (m_squared)
+			prefixSum(values, m_width, m_radius, Square(), line(m_squares, j + 1));
+	}
+}
+
+void SummedAreaTable::sumColumns(int i0, int i1)
+{
+	//Row by row over the range of columns, so the adds stay contiguous and vectorize
+	for (std::vector<uint32_t>* table : { &m_sums, &m_squares })
+	{
+		if (table->empty())
+			continue;
+
+		for (int j = 2; j <= rows(); j++)
+		{
+			const uint32_t* above = line(*table, j - 1) + 1;
+			uint32_t* row = line(*table, j) + 1;
+
+			for (int i = i0; i < i1; i++)
+				row[i] += above[i];
+		}
+	}
+}
+
+void SummedAreaTable::meanRow(int y, uchar* out) const
+{
+	const int d = 2 * m_radius + 1;
+	const float scale = 1.0f / ((float)d * d);
+
+	//The window of pixel x spans padded rows [y, y + d) and columns [x, x + d)
+	const uint32_t* top = line(m_sums, y);
+	const uint32_t* bottom = line(m_sums, y + d);
+
+	for (int x = 0; x < m_width; x++)
+	{
+		const uint32_t sum = bottom[x + d] - bottom[x] - top[x + d] + top[x];
+		out[x] = (uchar)((float)sum * scale + 0.5f);
+	}
+}
+
+void SummedAreaTable::deviationRow(int y, uchar* out) const
+{
+	const int d = 2 * m_radius + 1;
+	const qint64 n = (qint64)d * d;
+	const float scale = 1.0f / (float)n;
+
+	const uint32_t* top = line(m_sums, y);
+	const uint32_t* bottom = line(m_sums, y + d);
+	const uint32_t* topSquares = line(m_squares, y);
+	const uint32_t* bottomSquares = line(m_squares, y + d);
+
+	for (int x = 0; x < m_width; x++)
+	{
+		const uint32_t sum = bottom[x + d] - bottom[x] - top[x + d] + top[x];
+		const uint32_t squares = bottomSquares[x + d] - bottomSquares[x] - topSquares[x + d] + topSquares[x];
+
+		//n^2 times the variance, exact in integers
+		const qint64 spread = n * squares - (qint64)sum * sum;
+		out[x] = (uchar)std::min(255.0f, std::sqrt((float)spread) * scale + 0.5f);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,74 @@
+/*
+	Summed-area tables
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <QImage>
+
+/*
+	Summed-area table (integral image) of one channel of an image, for sums over square windows in constant time.
+
+	Entry (i, j) holds the sum of the values above and left of it, so the sum over any window is four
+	lookups whatever its size. The table is built for one window radius over the image padded by that radius
+	with its edge values, which clamps the image borders like the filter kernels, and gives every window the
+	same area.
+
+	Entries are 32 bits and wrap around, window sums are still exact as long as they fit 32 bits: a window of
+	values up to MaxRadius, and of squared values up to MaxSquaresRadius.
+
+	Building takes two passes, summing along rows and then down columns. Both can be split into ranges which
+	run in parallel, the column pass only starts once every row is summed.
+*/
+class SummedAreaTable
+{
+public:
+
+	static const int MaxRadius = 2047;
+	static const int MaxSquaresRadius = 128;
+
+	SummedAreaTable();
+
+	/*
+		Set up the table of channel c (0 red, 1 green, 2 blue) of a working format image or of a gray scale image,
+		for windows of the given radius, and the table of the squared values if squares is set.
+		Storage is kept if it is large enough, returns true if it had to be reallocated.
+	*/
+	bool reset(const QImage& img, int c, int radius, bool squares);
+
+	//Rows and columns of the padded image, the ranges of the two passes
+	int rows() const { return m_height + 2 * m_radius; }
+	int columns() const { return m_width + 2 * m_radius; }
+
+	//Sum rows [j0, j1) of the padded image into the table, img is the image reset() was given
+	void sumRows(const QImage& img, int j0, int j1);
+
+	//Sum columns [i0, i1) of the table, once every row is summed
+	void sumColumns(int i0, int i1);
+
+	//Mean of the window around every pixel of image row y, rounded
+	void meanRow(int y, uchar* out) const;
+
+	//Standard deviation of the window around every pixel of image row y, rounded, which needs the squared values
+	void deviationRow(int y, uchar* out) const;
+
+	qint64 sizeInBytes() const { return (qint64)(m_sums.capacity() + m_squares.capacity()) * sizeof(uint32_t); }
+
+private:
+
+	//Table row j, the sums of the padded rows above j, with a zero column first
+	const uint32_t* line(const std::vector<uint32_t>& table, int j) const { return table.data() + (size_t)j * (columns() + 1); }
+	uint32_t* line(std::vector<uint32_t>& table, int j) { return table.data() + (size_t)j * (columns() + 1); }
+
+	int m_width;
+	int m_height;
+	int m_channel;
+	int m_radius;
+	bool m_squared;
+
+	std::vector<uint32_t> m_sums;
+	std::vector<uint32_t> m_squares;
+};
@@ -0,0 +1,190 @@
+/*
+	Work stealing thread pool
+*/
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool(int threadCount) :
+	m_queued(0),
+	m_quit(false)
+{
+	start(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+ThreadPool* ThreadPool::globalInstance()
+{
+	static ThreadPool pool;
+	return &pool;
+}
+
+void ThreadPool::setThreadCount(int threadCount)
+{
+	stop();
+	start(threadCount);
+}
+
+void ThreadPool::start(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	m_quit = false;
+
+	//The calling thread of parallelFor is the last thread of the pool
+	for (int i = 0; i < threadCount - 1; i++)
+		m_queues.emplace_back(new Queue());
+
+	for (int i = 0; i < threadCount - 1; i++)
+		m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+void ThreadPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_quit = true;
+	}
+
+	m_wake.notify_all();
+
+	for (std::thread& t : m_threads)
+		t.join();
+
+	m_threads.clear();
+	m_queues.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ThreadPool::parallelFor(int begin, int end, int grain, const RangeFunction& func)
+{
+	if (begin >= end)
+		return;
+
+	grain = std::max(grain, 1);
+
+	//Nothing to share, run on the calling thread
+	if (m_queues.empty() || (end - begin) <= grain)
+	{
+		func(begin, end);
+		return;
+	}
+
+	Batch batch;
+	batch.func = &func;
+	batch.pending = (end - begin + grain - 1) / grain;
+
+	//Deal chunks out to the worker queues in contiguous runs, so each worker starts on neighbouring rows
+	const int queueCount = (int)m_queues.size();
+	const int chunks = batch.pending;
+
+	for (int q = 0; q < queueCount; q++)
+	{
+		const int first = (chunks * q) / queueCount;
+		const int last = (chunks * (q + 1)) / queueCount;
+
+		std::lock_guard<std::mutex> lock(m_queues[q]->lock);
+
+		for (int c = first; c < last; c++)
+			m_queues[q]->tasks.push_back({ &batch, begin + c * grain, std::min(end, begin + (c + 1) * grain) });
+	}
+
+	m_queued += chunks;
+
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+	}
+
+	m_wake.notify_all();
+
+	//Help out until every chunk of the batch has been taken
+	Task task;
+	while (takeTask(-1, task))
+	{
+		runTask(task);
+	}
+
+	std::unique_lock<std::mutex> lock(batch.lock);
+	batch.done.wait(lock, [&batch]() { return batch.pending == 0; });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ThreadPool::workerLoop(int index)
+{
+	for (;;)
+	{
+		Task task;
+
+		if (takeTask(index, task))
+		{
+			runTask(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_wake.wait(lock, [this]() { return m_quit || m_queued > 0; });
+
+		if (m_quit)
+			return;
+	}
+}
+
+bool ThreadPool::takeTask(int index, Task& task)
+{
+	const int queueCount = (int)m_queues.size();
+
+	//Own queue first, newest task is the most likely to be in cache
+	if (index >= 0)
+	{
+		Queue& own = *m_queues[index];
+		std::lock_guard<std::mutex> lock(own.lock);
+
+		if (!own.tasks.empty())
+		{
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			m_queued--;
+			return true;
+		}
+	}
+
+	//Steal the oldest task of another queue
+	for (int i = 1; i <= queueCount; i++)
+	{
+		Queue& victim = *m_queues[(index + i + queueCount) % queueCount];
+		std::lock_guard<std::mutex> lock(victim.lock);
+
+		if (!victim.tasks.empty())
+		{
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			m_queued--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::runTask(const Task& task)
+{
+	(*task.batch->func)(task.begin, task.end);
+
+	//Notify while holding the lock, the batch lives on the stack of the waiting thread
+	std::lock_guard<std::mutex> lock(task.batch->lock);
+
+	if (--task.batch->pending == 0)
+		task.batch->done.notify_all();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,87 @@
+/*
+	Work stealing thread pool
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Utils.h"
+
+class ThreadPool
+{
+public:
+
+	//Range function signature, processes the indices [begin, end)
+	using RangeFunction = FunctionRef<void(int begin, int end)>;
+
+	//Create a thread pool, a thread count of 0 uses every available core
+	explicit ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	//Pool shared by every image pipeline by default
+	static ThreadPool* globalInstance();
+
+	//Number of threads used by parallelFor, including the calling thread
+	int threadCount() const { return (int)m_queues.size() + 1; }
+
+	//Resize the pool, must not be called while a parallelFor is running
+	void setThreadCount(int threadCount);
+
+	/*
+		Split the indices [begin, end) into chunks of at most grain indices and run them across the pool.
+
+		The calling thread takes part in the work and the call returns once every chunk has completed.
+		Idle threads steal chunks from busy ones so uneven chunks are balanced out.
+	*/
+	void parallelFor(int begin, int end, int grain, const RangeFunction& func);
+
+private:
+
+	struct Batch
+	{
+		const RangeFunction* func;
+		int pending;
+		std::mutex lock;
+		std::condition_variable done;
+	};
+
+	struct Task
+	{
+		Batch* batch;
+		int begin;
+		int end;
+	};
+
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	void start(int threadCount);
+	void stop();
+
+	void workerLoop(int index);
+
+	//Pop a task from the given queue, or steal one from another queue, returns false if there is no work
+	bool takeTask(int index, Task& task);
+	void runTask(const Task& task);
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::atomic<int> m_queued;
+	std::mutex m_sleepLock;
+	std::condition_variable m_wake;
+	bool m_quit;
+};
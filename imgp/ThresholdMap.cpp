@@ -0,0 +1,100 @@
+/*
+	Threshold maps for ordered and pattern dithering
+*/
+
+#include <algorithm>
+
+#include "ThresholdMap.h"
+#include "ResultCache.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ThresholdMap::ThresholdMap(int n, const std::vector<int>& levels) :
+	m_size(n),
+	m_levels(levels),
+	m_thresholds(levels.size())
+{
+	const int area = n * n;
+
+	for (size_t c = 0; c < m_levels.size(); c++)
+	{
+		m_levels[c] = std::max(0, std::min(area, m_levels[c]));
+
+		//Smallest intensity whose pattern number reaches the level, the same float arithmetic as the per pixel version
+		int v = 0;
+
+		while (v < 255 && std::min((int)((float)v / 255 * (area + 1)), area) < m_levels[c])
+			v++;
+
+		m_thresholds[c] = (uint8_t)v;
+	}
+}
+
+ThresholdMap ThresholdMap::bayer(int n)
+{
+	n = std::max(2, std::min(16, n));
+
+	//Each doubling replaces every level l by the 2x2 block 4l, 4l + 2, 4l + 3, 4l + 1
+	std::vector<int> m = { 0 };
+	int size = 1;
+
+	while (size < n)
+	{
+		std::vector<int> next(4 * size * size);
+
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				const int l = 4 * m[y * size + x];
+
+				next[y * 2 * size + x] = l;
+				next[y * 2 * size + x + size] = l + 2;
+				next[(y + size) * 2 * size + x] = l + 3;
+				next[(y + size) * 2 * size + x + size] = l + 1;
+			}
+		}
+
+		m.swap(next);
+		size *= 2;
+	}
+
+	//Levels start at 1
+	for (int& l : m)
+		l++;
+
+	return ThresholdMap(size, m);
+}
+
+ThresholdMap ThresholdMap::fromLevels(int n, const std::vector<int>& levels)
+{
+	n = std::max(1, n);
+
+	std::vector<int> m(levels.begin(), levels.begin() + std::min(levels.size(), (size_t)(n * n)));
+	m.resize(n * n, n * n);
+
+	return ThresholdMap(n, m);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::vector<uint8_t> ThresholdMap::tiledRows(int width) const
+{
+	std::vector<uint8_t> rows((size_t)m_size * width);
+
+	for (int y = 0; y < m_size; y++)
+	{
+		for (int x = 0; x < width; x++)
+			rows[(size_t)y * width + x] = m_thresholds[y * m_size + x % m_size];
+	}
+
+	return rows;
+}
+
+quint64 ThresholdMap::hash() const
+{
+	const quint64 h = ResultCache::hash(&m_size, sizeof(m_size));
+	return ResultCache::hash(m_levels.data(), m_levels.size() * sizeof(int), h);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
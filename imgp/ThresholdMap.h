@@ -0,0 +1,50 @@
+/*
+	Threshold maps for ordered and pattern dithering
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <QtGlobal>
+
+/*
+	A square matrix of dithering levels, precomputed into byte thresholds.
+
+	Cell (x, y) holds a level from 1 to n*n. A gray value v quantises to the pattern number
+	min(v / 255 * (n*n + 1), n*n), and the pixel is white when that number reaches the cell's level.
+	The smallest such v is the cell's threshold, so dithering a pixel is a single byte compare.
+*/
+class ThresholdMap
+{
+public:
+
+	//Bayer matrix of size n, a power of two from 2 to 16
+	static ThresholdMap bayer(int n);
+
+	/*
+		Matrix of size n from row major levels, which are clamped to [0, n*n].
+		Level 0 is always white and level n*n only white at full intensity.
+	*/
+	static ThresholdMap fromLevels(int n, const std::vector<int>& levels);
+
+	int size() const { return m_size; }
+
+	int level(int x, int y) const { return m_levels[(y % m_size) * m_size + x % m_size]; }
+	uint8_t threshold(int x, int y) const { return m_thresholds[(y % m_size) * m_size + x % m_size]; }
+
+	//Thresholds of every row of the matrix repeated across width pixels, size() rows of width bytes
+	std::vector<uint8_t> tiledRows(int width) const;
+
+	//Hash of the levels, for result keys
+	quint64 hash() const;
+
+private:
+
+	ThresholdMap(int n, const std::vector<int>& levels);
+
+	int m_size;
+	std::vector<int> m_levels;
+	std::vector<uint8_t> m_thresholds;
+};
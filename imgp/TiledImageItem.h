@@ -0,0 +1,123 @@
+/*
+	Graphics item showing the tiles of a tiled pipeline
+*/
+
+#pragma once
+
+#include <cmath>
+
+#include <QGraphicsItem>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+#include "TiledPipeline.h"
+
+/*
+	Draws the tiles intersecting the exposed area, at the pyramid level matching the current zoom.
+	Tiles which are not ready yet are requested, and stand in for by a cached coarser tile if there is one.
+*/
+class TiledImageItem : public QGraphicsItem
+{
+public:
+
+	explicit TiledImageItem(QGraphicsItem* parent = nullptr) :
+		QGraphicsItem(parent),
+		m_source(nullptr)
+	{
+		setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+	}
+
+	using QGraphicsItem::prepareGeometryChange;
+
+	void setSource(TiledPipeline* source)
+	{
+		prepareGeometryChange();
+		m_source = source;
+		update();
+	}
+
+	//The image is centred on the origin, like the pixmap item of ImageWidget
+	QRectF boundingRect() const override
+	{
+		if (!m_source)
+			return QRectF();
+
+		const QSizeF size = m_source->sourceSize();
+		return QRectF(QPointF(-size.width() / 2, -size.height() / 2), size);
+	}
+
+	void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget) override
+	{
+		Q_UNUSED(widget);
+
+		if (!m_source || m_source->sourceSize().isEmpty())
+			return;
+
+		const QRectF bounds = boundingRect();
+		const QRectF exposed = option->exposedRect.intersected(bounds);
+		const qreal zoom = option->levelOfDetailFromTransform(painter->worldTransform());
+
+		//Coarsest level which still has at least one of its pixels per screen pixel
+		int level = 0;
+
+		while (level < m_source->maxLevel() && zoom * (1 << (level + 1)) <= 1.0)
+			level++;
+
+		painter->save();
+		painter->setClipRect(bounds, Qt::IntersectClip);
+		painter->setRenderHint(QPainter::SmoothPixmapTransform, zoom < 1.0);
+
+		const qreal span = TiledPipeline::TileSize * (qreal)(1 << level);
+		const int tx0 = (int)std::floor((exposed.left() - bounds.left()) / span);
+		const int ty0 = (int)std::floor((exposed.top() - bounds.top()) / span);
+		const int tx1 = (int)std::ceil((exposed.right() - bounds.left()) / span);
+		const int ty1 = (int)std::ceil((exposed.bottom() - bounds.top()) / span);
+
+		for (int ty = std::max(ty0, 0); ty < ty1; ty++)
+		{
+			for (int tx = std::max(tx0, 0); tx < tx1; tx++)
+			{
+				const QRectF target(bounds.left() + tx * span, bounds.top() + ty * span, span, span);
+				const QImage tile = m_source->tile(level, tx, ty);
+
+				if (!tile.isNull())
+				{
+					drawTile(painter, tile, target.topLeft(), level);
+					continue;
+				}
+
+				//Stand in with the closest coarser tile until this one is ready
+				for (int coarse = level + 1; coarse <= m_source->maxLevel(); coarse++)
+				{
+					const int shift = coarse - level;
+					const QImage parent = m_source->cachedTile(coarse, tx >> shift, ty >> shift);
+
+					if (!parent.isNull())
+					{
+						const qreal parentSpan = span * (1 << shift);
+						const QPointF parentOrigin(bounds.left() + (tx >> shift) * parentSpan, bounds.top() + (ty >> shift) * parentSpan);
+
+						painter->save();
+						painter->setClipRect(target, Qt::IntersectClip);
+						drawTile(painter, parent, parentOrigin, coarse);
+						painter->restore();
+						break;
+					}
+				}
+			}
+		}
+
+		painter->restore();
+	}
+
+private:
+
+	//Draw a tile of a level with its top left corner at origin, in image pixels
+	static void drawTile(QPainter* painter, const QImage& tile, const QPointF& origin, int level)
+	{
+		const qreal scale = (qreal)(1 << level);
+		painter->drawImage(QRectF(origin, QSizeF(tile.width() * scale, tile.height() * scale)), tile);
+	}
+
+	TiledPipeline* m_source;
+};
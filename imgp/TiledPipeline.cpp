@@ -0,0 +1,284 @@
+/*
+	Tiled, lazily evaluated image processing pipeline
+*/
+
+#include <algorithm>
+
+#include "TiledPipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Pending requests beyond this are the oldest ones, whose tiles have most likely scrolled out of view
+static const size_t maxRequests = 256;
+
+//Default budget of the tile cache
+static const qint64 defaultCacheSize = 256ll * 1024 * 1024;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TiledPipeline::TiledPipeline(QObject* parent) :
+	QObject(parent),
+	m_sourceId(0),
+	m_halo(0),
+	m_generation(0),
+	m_quit(false),
+	m_cancelled(false),
+	m_profiler(nullptr)
+{
+	setCacheSize(defaultCacheSize);
+
+	qRegisterMetaType<QImage>();
+	connect(this, &TiledPipeline::tileFinished, this, &TiledPipeline::finishTile, Qt::QueuedConnection);
+
+	m_worker = std::thread(&TiledPipeline::workerLoop, this);
+}
+
+TiledPipeline::~TiledPipeline()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_quit = true;
+		m_cancelled = true;
+	}
+
+	m_wake.notify_all();
+	m_worker.join();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+quint64 TiledPipeline::tileKey(int level, int tx, int ty)
+{
+	return ((quint64)level << 56) | ((quint64)tx << 28) | (quint64)ty;
+}
+
+QSize TiledPipeline::levelSize(int level) const
+{
+	const int scale = 1 << level;
+	return QSize((m_sourceSize.width() + scale - 1) / scale, (m_sourceSize.height() + scale - 1) / scale);
+}
+
+int TiledPipeline::maxLevel() const
+{
+	int level = 0;
+
+	while (std::max(levelSize(level).width(), levelSize(level).height()) > TileSize)
+		level++;
+
+	return level;
+}
+
+void TiledPipeline::invalidate()
+{
+	m_generation++;
+	m_requests.clear();
+	m_cancelled = true;
+}
+
+void TiledPipeline::load(const QImage& img)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_source = img;
+		m_sourceId++;
+		invalidate();
+	}
+
+	m_sourceSize = img.size();
+	m_tiles.clear();
+
+	tilesChanged();
+}
+
+void TiledPipeline::setJob(const Job& job, int halo)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_job = job;
+		m_halo = halo;
+		invalidate();
+	}
+
+	m_tiles.clear();
+
+	tilesChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+QImage TiledPipeline::cachedTile(int level, int tx, int ty) const
+{
+	const QImage* t = m_tiles.object(tileKey(level, tx, ty));
+	return t ? *t : QImage();
+}
+
+QImage TiledPipeline::tile(int level, int tx, int ty)
+{
+	const quint64 key = tileKey(level, tx, ty);
+
+	if (const QImage* t = m_tiles.object(key))
+		return *t;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		//Requests are served newest first, so a repeated request moves to the front of the queue
+		auto it = std::find_if(m_requests.begin(), m_requests.end(), [key](const Request& r) { return r.key == key; });
+
+		if (it != m_requests.end())
+			m_requests.erase(it);
+
+		m_requests.push_back({ key, m_generation });
+
+		if (m_requests.size() > maxRequests)
+			m_requests.erase(m_requests.begin());
+	}
+
+	m_wake.notify_all();
+
+	return QImage();
+}
+
+void TiledPipeline::finishTile(const QImage& tile, quint64 key, quint64 generation)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		if (generation != m_generation)
+			return;
+	}
+
+	m_tiles.insert(key, new QImage(tile), std::max(1, (int)(tile.sizeInBytes() / 1024)));
+
+	tilesChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TiledPipeline::workerLoop()
+{
+	ImagePipeline pipeline;
+	pipeline.blockSignals(true);
+	pipeline.setCancellation(&m_cancelled);
+
+	//Every tile region is a new image, finished tiles are cached by m_tiles instead
+	pipeline.resultCache().setBudget(0);
+
+	//Image pyramid, and whole level results of a job with an unbounded halo
+	std::vector<QImage> levels;
+	std::vector<QImage> processed;
+
+	quint64 levelsId = 0;
+	quint64 processedGeneration = 0;
+
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	for (;;)
+	{
+		m_wake.wait(lock, [this]() { return m_quit || !m_requests.empty(); });
+
+		if (m_quit)
+			return;
+
+		const Request request = m_requests.back();
+		m_requests.pop_back();
+
+		if (request.generation != m_generation)
+			continue;
+
+		const Job job = m_job;
+		const int halo = m_halo;
+		m_cancelled = false;
+
+		QImage source;
+
+		if (levelsId != m_sourceId)
+		{
+			source = m_source;
+			levelsId = m_sourceId;
+		}
+
+		lock.unlock();
+
+		pipeline.setProfiler(m_profiler);
+
+		if (!source.isNull())
+		{
+			levels.assign(1, source.convertToFormat(ImagePipeline::WorkingFormat));
+			processed.clear();
+		}
+
+		if (processedGeneration != request.generation)
+		{
+			processed.clear();
+			processedGeneration = request.generation;
+		}
+
+		const int level = (int)(request.key >> 56);
+		const int tx = (int)((request.key >> 28) & 0xfffffff);
+		const int ty = (int)(request.key & 0xfffffff);
+
+		//Each level halves the one before it
+		while ((int)levels.size() <= level)
+		{
+			const QImage& prev = levels.back();
+			const QSize size((prev.width() + 1) / 2, (prev.height() + 1) / 2);
+			levels.push_back(prev.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).convertToFormat(ImagePipeline::WorkingFormat));
+		}
+
+		const QImage& levelImage = levels[level];
+		const QRect rect = QRect(tx * TileSize, ty * TileSize, TileSize, TileSize).intersected(levelImage.rect());
+
+		QImage tile;
+
+		if (rect.isEmpty())
+		{
+			//Requested outside of the image
+		}
+		else if (halo < 0)
+		{
+			//The job depends on the whole image, process the level once and cut tiles from it
+			processed.resize(std::max(processed.size(), levels.size()));
+
+			if (processed[level].isNull())
+			{
+				pipeline.load(levelImage);
+				pipeline.defer();
+
+				if (job)
+					job(pipeline);
+
+				pipeline.execute();
+
+				if (!pipeline.isCancelled())
+					processed[level] = pipeline.image();
+			}
+
+			if (!processed[level].isNull())
+				tile = processed[level].copy(rect);
+		}
+		else
+		{
+			//Grow the tile by the halo, rounded so operations indexed by absolute position (dither patterns) stay aligned
+			const int margin = ((halo + 15) / 16) * 16;
+			const QRect region = rect.adjusted(-margin, -margin, margin, margin).intersected(levelImage.rect());
+
+			pipeline.load(levelImage.copy(region));
+			pipeline.defer();
+
+			if (job)
+				job(pipeline);
+
+			pipeline.execute();
+
+			tile = pipeline.image().copy(rect.translated(-region.topLeft()));
+		}
+
+		lock.lock();
+
+		if (!tile.isNull() && !m_cancelled && request.generation == m_generation)
+			tileFinished(tile, request.key, request.generation);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,114 @@
+/*
+	Tiled, lazily evaluated image processing pipeline
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QCache>
+
+#include "AsyncPipeline.h"
+
+/*
+	Renders a pipeline job tile by tile, only for the tiles a view asks for.
+
+	Tiles are TileSize pixels square and addressed by (level, tx, ty), where level L is the image
+	downscaled by 2^L, so zoomed out views never touch full resolution pixels. Missing tiles are
+	computed on a worker thread, most recently requested first, and kept in a bounded cache.
+
+	A tile is computed from the tile's region of the image grown by the job's halo, the number of
+	pixels of context each output pixel depends on. Jobs with a negative halo (error diffusion)
+	depend on the whole image and are computed once per level, then cut into tiles.
+*/
+class TiledPipeline : public QObject
+{
+	Q_OBJECT
+
+public:
+
+	static const int TileSize = 256;
+
+	using Job = AsyncPipeline::Job;
+
+	explicit TiledPipeline(QObject* parent = nullptr);
+	~TiledPipeline();
+
+	//Load the given image, dropping every tile
+	void load(const QImage& img);
+
+	//Size of the loaded image
+	QSize sourceSize() const { return m_sourceSize; }
+
+	//Size of the image at a level
+	QSize levelSize(int level) const;
+
+	//Coarsest level, at which the image fits in one tile
+	int maxLevel() const;
+
+	//Set the job rendered into tiles, dropping every tile
+	void setJob(const Job& job, int halo);
+
+	//Return a tile if it is cached, otherwise request it and return a null image
+	QImage tile(int level, int tx, int ty);
+
+	//Return a tile if it is cached, without requesting it
+	QImage cachedTile(int level, int tx, int ty) const;
+
+	//Budget of the tile cache
+	void setCacheSize(qint64 bytes) { m_tiles.setMaxCost((int)(bytes / 1024)); }
+
+	//Profiler of the worker's pipeline from the next tile on, see ImagePipeline::setProfiler
+	void setProfiler(Profiler* profiler) { m_profiler = profiler; }
+
+signals:
+
+	//A requested tile is now cached, or every tile was dropped
+	void tilesChanged();
+
+	//Internal, carries tiles from the worker thread
+	void tileFinished(const QImage& tile, quint64 key, quint64 generation);
+
+private slots:
+
+	void finishTile(const QImage& tile, quint64 key, quint64 generation);
+
+private:
+
+	struct Request
+	{
+		quint64 key;
+		quint64 generation;
+	};
+
+	static quint64 tileKey(int level, int tx, int ty);
+
+	void workerLoop();
+
+	//Drop every tile and pending request, m_lock must be held
+	void invalidate();
+
+	QSize m_sourceSize;
+	QCache<quint64, QImage> m_tiles;
+
+	//Shared with the worker thread, guarded by m_lock
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	QImage m_source;
+	quint64 m_sourceId;
+	Job m_job;
+	int m_halo;
+	quint64 m_generation;
+	std::vector<Request> m_requests;
+	bool m_quit;
+
+	//Set when the tile being computed is no longer wanted
+	std::atomic<bool> m_cancelled;
+	std::atomic<Profiler*> m_profiler;
+
+	std::thread m_worker;
+};
@@ -1,13 +1,48 @@
 
 SOURCES +=  imgp/Main.cpp \
             imgp/ImageWindow.cpp \
-            imgp/ImagePipeline.cpp
+            imgp/ImagePipeline.cpp \
+            imgp/AsyncPipeline.cpp \
+            imgp/TiledPipeline.cpp \
+            imgp/Convolution.cpp \
+            imgp/FftConvolution.cpp \
+            imgp/FourierTransform.cpp \
+            imgp/KernelRegistry.cpp \
+            imgp/Simd.cpp \
+            imgp/LookupTable.cpp \
+            imgp/ResultCache.cpp \
+            imgp/RankFilter.cpp \
+            imgp/SummedAreaTable.cpp \
+            imgp/RecursiveGaussian.cpp \
+            imgp/ThresholdMap.cpp \
+            imgp/PreciseImage.cpp \
+            imgp/Profiler.cpp \
+            imgp/RawImage.cpp \
+            imgp/ThreadPool.cpp
 
 HEADERS +=  imgp/ImageWindow.h \
             imgp/ImagePipeline.h \
+            imgp/AsyncPipeline.h \
+            imgp/TiledPipeline.h \
+            imgp/TiledImageItem.h \
+            imgp/Convolution.h \
+            imgp/FftConvolution.h \
+            imgp/FourierTransform.h \
+            imgp/KernelRegistry.h \
+            imgp/Simd.h \
+            imgp/LookupTable.h \
+            imgp/ResultCache.h \
+            imgp/RankFilter.h \
+            imgp/SummedAreaTable.h \
+            imgp/RecursiveGaussian.h \
+            imgp/ThresholdMap.h \
+            imgp/PreciseImage.h \
+            imgp/Profiler.h \
+            imgp/RawImage.h \
             imgp/ImageWidget.h \
             imgp/FilterKernels.h \
+            imgp/ThreadPool.h \
             imgp/Utils.h
 
 CONFIG += qt
-QT += widgets
\ No newline at end of file
+QT += widgets